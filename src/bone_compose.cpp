@@ -0,0 +1,258 @@
+#include "bone_compose.h"
+#include <algorithm>
+#include <glm/gtc/type_ptr.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BONE_COMPOSE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define BONE_COMPOSE_TARGET_AVX
+#else
+// Only the AVX kernel is compiled for AVX; the rest of the program keeps the baseline instruction set
+#define BONE_COMPOSE_TARGET_AVX __attribute__((target("avx")))
+#endif
+#else
+#define BONE_COMPOSE_X86 0
+#endif
+
+
+namespace BoneCompose {
+    namespace {
+        // Matrices of a block are stored element-major: element e (column-major) of lane j at [e * BLOCK + j].
+        // A constant operand is a single column-major matrix, the same for every lane.
+        enum Operands {
+            OPERANDS_BLOCK,           // block * block
+            OPERANDS_CONSTANT_LEFT,   // constant * block
+            OPERANDS_CONSTANT_RIGHT,  // block * constant
+            OPERANDS_NUM
+        };
+
+        const size_t blockFloats = 16 * BONE_COMPOSE_BLOCK;
+
+        typedef void (*MultiplyFunction)(const float *a, const float *b, float *out);
+
+        template<int Mode>
+        void multiplyScalar(const float *a, const float *b, float *out) {
+            for (int j = 0; j < BONE_COMPOSE_BLOCK; j++)
+                for (int c = 0; c < 4; c++)
+                    for (int r = 0; r < 4; r++) {
+                        float sum = 0.0f;
+                        for (int k = 0; k < 4; k++) {
+                            float x = Mode == OPERANDS_CONSTANT_LEFT ? a[k * 4 + r] : a[(k * 4 + r) * BONE_COMPOSE_BLOCK + j];
+                            float y = Mode == OPERANDS_CONSTANT_RIGHT ? b[c * 4 + k] : b[(c * 4 + k) * BONE_COMPOSE_BLOCK + j];
+                            sum += x * y;
+                        }
+                        out[(c * 4 + r) * BONE_COMPOSE_BLOCK + j] = sum;
+                    }
+        }
+
+#if BONE_COMPOSE_X86
+        template<int Mode>
+        void multiplySse(const float *a, const float *b, float *out) {
+            __m128 constant[16];  // broadcast once, reused by every lane group
+            for (int e = 0; e < 16; e++)
+                constant[e] = _mm_set1_ps(Mode == OPERANDS_CONSTANT_LEFT ? a[e] : Mode == OPERANDS_CONSTANT_RIGHT ? b[e] : 0.0f);
+            for (int j = 0; j < BONE_COMPOSE_BLOCK; j += 4) {
+                __m128 x[16], y[16];
+                for (int e = 0; e < 16; e++) {
+                    x[e] = Mode == OPERANDS_CONSTANT_LEFT ? constant[e] : _mm_loadu_ps(a + e * BONE_COMPOSE_BLOCK + j);
+                    y[e] = Mode == OPERANDS_CONSTANT_RIGHT ? constant[e] : _mm_loadu_ps(b + e * BONE_COMPOSE_BLOCK + j);
+                }
+                for (int c = 0; c < 4; c++)
+                    for (int r = 0; r < 4; r++) {
+                        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x[r], y[c * 4]), _mm_mul_ps(x[4 + r], y[c * 4 + 1])),
+                                                _mm_add_ps(_mm_mul_ps(x[8 + r], y[c * 4 + 2]), _mm_mul_ps(x[12 + r], y[c * 4 + 3])));
+                        _mm_storeu_ps(out + (c * 4 + r) * BONE_COMPOSE_BLOCK + j, sum);
+                    }
+            }
+        }
+
+        template<int Mode>
+        BONE_COMPOSE_TARGET_AVX
+        void multiplyAvx(const float *a, const float *b, float *out) {
+            __m256 constant[16];
+            for (int e = 0; e < 16; e++)
+                constant[e] = _mm256_set1_ps(Mode == OPERANDS_CONSTANT_LEFT ? a[e] : Mode == OPERANDS_CONSTANT_RIGHT ? b[e] : 0.0f);
+            for (int j = 0; j < BONE_COMPOSE_BLOCK; j += 8) {
+                __m256 x[16], y[16];
+                for (int e = 0; e < 16; e++) {
+                    x[e] = Mode == OPERANDS_CONSTANT_LEFT ? constant[e] : _mm256_loadu_ps(a + e * BONE_COMPOSE_BLOCK + j);
+                    y[e] = Mode == OPERANDS_CONSTANT_RIGHT ? constant[e] : _mm256_loadu_ps(b + e * BONE_COMPOSE_BLOCK + j);
+                }
+                for (int c = 0; c < 4; c++)
+                    for (int r = 0; r < 4; r++) {
+                        __m256 sum = _mm256_add_ps(
+                                _mm256_add_ps(_mm256_mul_ps(x[r], y[c * 4]), _mm256_mul_ps(x[4 + r], y[c * 4 + 1])),
+                                _mm256_add_ps(_mm256_mul_ps(x[8 + r], y[c * 4 + 2]), _mm256_mul_ps(x[12 + r], y[c * 4 + 3])));
+                        _mm256_storeu_ps(out + (c * 4 + r) * BONE_COMPOSE_BLOCK + j, sum);
+                    }
+            }
+        }
+
+        bool detectAvx() {
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 1);
+            bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+            return osxsave && avx && (_xgetbv(0) & 6) == 6;  // the OS must save the ymm registers
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx") != 0;
+#endif
+        }
+#endif
+
+        void multiplyFunctions(Kernel kernel, MultiplyFunction functions[OPERANDS_NUM]) {
+            functions[OPERANDS_BLOCK] = multiplyScalar<OPERANDS_BLOCK>;
+            functions[OPERANDS_CONSTANT_LEFT] = multiplyScalar<OPERANDS_CONSTANT_LEFT>;
+            functions[OPERANDS_CONSTANT_RIGHT] = multiplyScalar<OPERANDS_CONSTANT_RIGHT>;
+#if BONE_COMPOSE_X86
+            if (kernel == KERNEL_SSE) {
+                functions[OPERANDS_BLOCK] = multiplySse<OPERANDS_BLOCK>;
+                functions[OPERANDS_CONSTANT_LEFT] = multiplySse<OPERANDS_CONSTANT_LEFT>;
+                functions[OPERANDS_CONSTANT_RIGHT] = multiplySse<OPERANDS_CONSTANT_RIGHT>;
+            } else if (kernel == KERNEL_AVX) {
+                functions[OPERANDS_BLOCK] = multiplyAvx<OPERANDS_BLOCK>;
+                functions[OPERANDS_CONSTANT_LEFT] = multiplyAvx<OPERANDS_CONSTANT_LEFT>;
+                functions[OPERANDS_CONSTANT_RIGHT] = multiplyAvx<OPERANDS_CONSTANT_RIGHT>;
+            }
+#endif
+        }
+
+        // Lanes past count get the identity, so they never produce denormals or NaNs
+        void gather(const glm::fmat4 *const *matrices, size_t bone, size_t count, float *block) {
+            static const glm::fmat4 identity(1.0f);
+            for (size_t j = 0; j < BONE_COMPOSE_BLOCK; j++) {
+                const float *m = glm::value_ptr(j < count ? matrices[j][bone] : identity);
+                for (int e = 0; e < 16; e++) block[e * BONE_COMPOSE_BLOCK + j] = m[e];
+            }
+        }
+
+        void scatter(const float *block, size_t bone, size_t count, glm::fmat4 *const *matrices) {
+            for (size_t j = 0; j < count; j++) {
+                float *m = glm::value_ptr(matrices[j][bone]);
+                for (int e = 0; e < 16; e++) m[e] = block[e * BONE_COMPOSE_BLOCK + j];
+            }
+        }
+    }
+
+    const char *kernelName(Kernel kernel) {
+        switch (kernel) {
+            case KERNEL_SSE:
+                return "sse";
+            case KERNEL_AVX:
+                return "avx";
+            default:
+                return "scalar";
+        }
+    }
+
+    bool kernelSupported(Kernel kernel) {
+#if BONE_COMPOSE_X86
+        static const bool avx = detectAvx();
+        return kernel == KERNEL_SCALAR || kernel == KERNEL_SSE || (kernel == KERNEL_AVX && avx);
+#else
+        return kernel == KERNEL_SCALAR;
+#endif
+    }
+
+    Kernel bestKernel() {
+        for (int kernel = KERNEL_NUM - 1; kernel > KERNEL_SCALAR; kernel--)
+            if (kernelSupported((Kernel) kernel)) return (Kernel) kernel;
+        return KERNEL_SCALAR;
+    }
+
+    void Plan::build(const std::vector<int> &nodeParent, const std::vector<glm::fmat4> &nodeLocal,
+                     const std::vector<int> &nodeBone, const std::vector<glm::fmat4> &boneOffset,
+                     const glm::fmat4 &rootInverse) {
+        clear();
+        size_t nodeNum = nodeParent.size();
+        boneNum = boneOffset.size();
+        offsets = boneOffset;
+        paletteSlot.assign(boneNum, -1);
+
+        // Nodes with a bone at or below them; pre-order lets one backwards pass reach every ancestor
+        std::vector<unsigned char> needed(nodeNum, 0);
+        for (size_t i = nodeNum; i-- > 0;) {
+            if (nodeBone[i] >= 0 && nodeBone[i] < (int) boneNum) needed[i] = 1;
+            if (needed[i] && nodeParent[i] >= 0) needed[nodeParent[i]] = 1;
+        }
+
+        std::vector<int> slot(nodeNum, -1);  // -1 while the node's global is still constant
+        std::vector<glm::fmat4> fixed(nodeNum);  // rootInverse * global of the constant nodes
+        for (size_t i = 0; i < nodeNum; i++) {
+            if (!needed[i]) continue;
+            int parent = nodeParent[i];
+            int bone = nodeBone[i] < (int) boneNum ? nodeBone[i] : -1;
+            bool parentConstant = parent < 0 || slot[parent] < 0;
+            glm::fmat4 before = parent < 0 ? rootInverse : parentConstant ? fixed[parent] : glm::fmat4(1.0f);
+            if (parentConstant && bone < 0) {
+                fixed[i] = before * nodeLocal[i];
+                continue;
+            }
+            Step step;
+            step.parent = parentConstant ? -1 : slot[parent];
+            step.constant = addConstant(before * nodeLocal[i]);
+            step.bone = bone;
+            step.slot = slot[i] = (int) slotNum++;
+            steps.push_back(step);
+            if (bone >= 0) paletteSlot[bone] = step.slot;
+        }
+    }
+
+    void Plan::clear() {
+        boneNum = 0;
+        slotNum = 0;
+        steps.clear();
+        constants.clear();
+        offsets.clear();
+        paletteSlot.clear();
+    }
+
+    int Plan::addConstant(const glm::fmat4 &m) {
+        constants.push_back(m);
+        return (int) constants.size() - 1;
+    }
+
+    void compose(const Plan &plan, const glm::fmat4 *const *modifiers, glm::fmat4 *const *palettes,
+                 size_t count, Kernel kernel) {
+        if (!kernelSupported(kernel)) kernel = bestKernel();
+        MultiplyFunction multiply[OPERANDS_NUM];
+        multiplyFunctions(kernel, multiply);
+
+        std::vector<float> workspace((plan.slotNum + 2) * blockFloats);
+        float *modifier = &workspace[plan.slotNum * blockFloats];
+        float *product = modifier + blockFloats;
+        for (size_t first = 0; first < count; first += BONE_COMPOSE_BLOCK) {
+            size_t lanes = std::min<size_t>(BONE_COMPOSE_BLOCK, count - first);
+            for (size_t s = 0; s < plan.steps.size(); s++) {
+                const Plan::Step &step = plan.steps[s];
+                const float *constant = glm::value_ptr(plan.constants[step.constant]);
+                float *global = &workspace[step.slot * blockFloats];
+                const float *parent = step.parent >= 0 ? &workspace[step.parent * blockFloats] : NULL;
+                if (step.bone < 0) {
+                    multiply[OPERANDS_CONSTANT_RIGHT](parent, constant, global);
+                    continue;
+                }
+                gather(modifiers + first, step.bone, lanes, modifier);
+                if (!parent) {
+                    multiply[OPERANDS_CONSTANT_LEFT](constant, modifier, global);
+                } else {
+                    multiply[OPERANDS_CONSTANT_LEFT](constant, modifier, product);
+                    multiply[OPERANDS_BLOCK](parent, product, global);
+                }
+            }
+            // Written straight into each instance's column-major palette
+            for (size_t bone = 0; bone < plan.boneNum; bone++) {
+                if (plan.paletteSlot[bone] < 0) {
+                    for (size_t j = 0; j < lanes; j++) palettes[first + j][bone] = glm::fmat4(1.0f);
+                    continue;
+                }
+                multiply[OPERANDS_CONSTANT_RIGHT](&workspace[plan.paletteSlot[bone] * blockFloats],
+                                                  glm::value_ptr(plan.offsets[bone]), product);
+                scatter(product, bone, lanes, palettes + first);
+            }
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+// Instances composed together, as structure of arrays; a multiple of the widest kernel's lane count
+#define BONE_COMPOSE_BLOCK 16
+
+namespace BoneCompose {
+    enum Kernel {
+        KERNEL_SCALAR,
+        KERNEL_SSE,  // 4 instances per instruction
+        KERNEL_AVX,  // 8 instances per instruction
+        KERNEL_NUM
+    };
+
+    const char *kernelName(Kernel kernel);
+    // Whether this build and this CPU can run the kernel; the scalar one always can.
+    bool kernelSupported(Kernel kernel);
+    // The widest supported kernel, detected once.
+    Kernel bestKernel();
+
+    // A skeleton's palette composition flattened at load into steps over workspace slots, with every product
+    // that does not depend on the pose folded into constants:
+    //     palette[bone] = rootInverse * global(node) * offset[bone]
+    //     global(node)  = global(parent) * local[node] * modifier[bone of node]
+    // Nodes above every bone are folded into their first bone's constant, nodes without bones below are dropped.
+    class Plan {
+    public:
+        Plan() : boneNum(0), slotNum(0) {}
+
+        // Nodes in pre-order, so parents precede children; nodeBone is -1 for nodes without a bone.
+        void build(const std::vector<int> &nodeParent, const std::vector<glm::fmat4> &nodeLocal,
+                   const std::vector<int> &nodeBone, const std::vector<glm::fmat4> &boneOffset,
+                   const glm::fmat4 &rootInverse);
+        void clear();
+
+        size_t getBoneNum() const { return boneNum; }
+
+        size_t getStepNum() const { return steps.size(); }
+
+    private:
+        friend void compose(const Plan &plan, const glm::fmat4 *const *modifiers, glm::fmat4 *const *palettes,
+                            size_t count, Kernel kernel);
+
+        struct Step {
+            int parent;    // workspace slot of the parent's global, -1 when it was folded into constant
+            int constant;  // index into constants, multiplied between the parent and the modifier
+            int bone;      // modifier multiplied last, -1 for nodes without a bone
+            int slot;      // workspace slot receiving the node's global
+        };
+
+        size_t boneNum;
+        size_t slotNum;
+        std::vector<Step> steps;
+        std::vector<glm::fmat4> constants;
+        std::vector<glm::fmat4> offsets;  // per bone, last factor of its palette entry
+        std::vector<int> paletteSlot;  // per bone, the slot of its node's global; -1 when unbound
+
+        int addConstant(const glm::fmat4 &m);
+    };
+
+    // Composes the palettes of count instances: modifiers[i] holds the plan's bone count of local modifiers
+    // of instance i, palettes[i] receives as many column-major matrices. Unbound bones get the identity.
+    void compose(const Plan &plan, const glm::fmat4 *const *modifiers, glm::fmat4 *const *palettes,
+                 size_t count, Kernel kernel = bestKernel());
+}
@@ -0,0 +1,304 @@
+#include "bone_palette.h"
+#include "gl_state.h"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <glm/gtc/quaternion.hpp>
+
+
+namespace BonePalette {
+    size_t vectorNum(Encoding encoding) {
+        switch (encoding) {
+            case ENCODING_AFFINE:
+                return 3;
+            case ENCODING_DUAL_QUATERNION:
+                return 2;
+            default:
+                return 4;
+        }
+    }
+
+    size_t maxBones(Encoding encoding) {
+        return BONE_PALETTE_MAX_VECTORS / vectorNum(encoding);
+    }
+
+    const char *encodingName(Encoding encoding) {
+        switch (encoding) {
+            case ENCODING_AFFINE:
+                return "affine";
+            case ENCODING_DUAL_QUATERNION:
+                return "dq";
+            default:
+                return "matrix";
+        }
+    }
+
+    bool parseEncoding(const std::string &name, Encoding &encoding) {
+        const Encoding encodings[] = {ENCODING_MATRIX, ENCODING_AFFINE, ENCODING_DUAL_QUATERNION};
+        for (Encoding candidate : encodings)
+            if (name == encodingName(candidate)) {
+                encoding = candidate;
+                return true;
+            }
+        return false;
+    }
+
+    bool isRigid(const glm::fmat4 *palette, size_t boneNum) {
+        for (size_t i = 0; i < boneNum; i++) {
+            glm::fmat3 m(palette[i]);
+            for (int c = 0; c < 3; c++) {
+                if (std::fabs(glm::length(m[c]) - 1.0f) > 1e-3f) return false;
+                if (std::fabs(glm::dot(m[c], m[(c + 1) % 3])) > 1e-3f) return false;
+            }
+        }
+        return true;
+    }
+
+    bool encode(Encoding encoding, const glm::fmat4 *palette, size_t boneNum, glm::fvec4 *vectors) {
+        bool exact = true;
+        for (size_t i = 0; i < boneNum; i++) {
+            const glm::fmat4 &m = palette[i];
+            if (encoding == ENCODING_MATRIX) {
+                memcpy(vectors, &m, sizeof(glm::fmat4));
+                vectors += 4;
+            } else if (encoding == ENCODING_AFFINE) {
+                for (int row = 0; row < 3; row++)
+                    vectors[row] = glm::fvec4(m[0][row], m[1][row], m[2][row], m[3][row]);
+                vectors += 3;
+            } else {
+                // Orthonormalize first: quat_cast assumes a pure rotation
+                glm::fmat3 rotation(m);
+                for (int c = 0; c < 3; c++) {
+                    float scale = glm::length(rotation[c]);
+                    if (std::fabs(scale - 1.0f) > 1e-3f) exact = false;
+                    rotation[c] /= scale > 0.0f ? scale : 1.0f;
+                }
+                glm::fquat real = glm::normalize(glm::quat_cast(rotation));
+                glm::fvec3 t(m[3]);
+                glm::fquat dual = glm::fquat(0.0f, t.x, t.y, t.z) * real * 0.5f;
+                vectors[0] = glm::fvec4(real.x, real.y, real.z, real.w);
+                vectors[1] = glm::fvec4(dual.x, dual.y, dual.z, dual.w);
+                vectors += 2;
+            }
+        }
+        return exact;
+    }
+
+    UniformRing::UniformRing()
+        : buffer(0), binding(0), blockStride(0), blockSize(0), sliceSize(0), slice(0), cursor(0), lastUpload(0),
+          lastSlice(-1), retained(-1), retainedRead(-1), persistent(false), mapped(nullptr) {
+        for (int i = 0; i < BONE_PALETTE_RING_SIZE; i++) fence[i] = 0;
+    }
+
+    UniformRing::~UniformRing() {
+        destroy();
+    }
+
+    bool UniformRing::initialize(GLuint bindingPoint, GLsizeiptr _blockSize, int palettesPerSlice) {
+        destroy();
+
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        binding = bindingPoint;
+        blockSize = _blockSize;
+        blockStride = (blockSize + alignment - 1) / alignment * alignment;
+        sliceSize = blockStride * palettesPerSlice;
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        GLsizeiptr totalSize = sliceSize * BONE_PALETTE_RING_SIZE;
+        // Persistent mapping needs ARB_buffer_storage (core in 4.4); otherwise each upload maps unsynchronized
+        if (GLEW_ARB_buffer_storage) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_UNIFORM_BUFFER, totalSize, nullptr, flags);
+            mapped = (char *) glMapBufferRange(GL_UNIFORM_BUFFER, 0, totalSize, flags);
+            persistent = mapped != nullptr;
+        }
+        if (!persistent) {
+            glBufferData(GL_UNIFORM_BUFFER, totalSize, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        if (glGetError() != GL_NO_ERROR) {
+            std::cout << "Failed to create bone palette uniform buffer" << std::endl;
+            destroy();
+            return false;
+        }
+        slice = BONE_PALETTE_RING_SIZE - 1;
+        cursor = sliceSize;
+        lastSlice = retained = retainedRead = -1;
+        return true;
+    }
+
+    void UniformRing::destroy() {
+        for (int i = 0; i < BONE_PALETTE_RING_SIZE; i++) {
+            if (fence[i]) glDeleteSync(fence[i]);
+            fence[i] = 0;
+        }
+        if (buffer) {
+            if (persistent) {
+                glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+                glUnmapBuffer(GL_UNIFORM_BUFFER);
+                glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            }
+            glDeleteBuffers(1, &buffer);
+        }
+        buffer = 0;
+        mapped = nullptr;
+        persistent = false;
+    }
+
+    void UniformRing::beginFrame() {
+        if (!buffer) return;
+        slice = (slice + 1) % BONE_PALETTE_RING_SIZE;
+        if (slice == retained) slice = (slice + 1) % BONE_PALETTE_RING_SIZE;
+        cursor = 0;
+        if (fence[slice]) {
+            // Three frames in flight make this wait rare; flush once so the fence is guaranteed to signal
+            GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+            while (glClientWaitSync(fence[slice], waitFlags, 1000000) == GL_TIMEOUT_EXPIRED)
+                waitFlags = 0;
+            glDeleteSync(fence[slice]);
+            fence[slice] = 0;
+        }
+    }
+
+    bool UniformRing::upload(const glm::fmat4 *palette, size_t boneNum) {
+        return upload((const glm::fvec4 *) palette, boneNum * 4);
+    }
+
+    bool UniformRing::upload(const glm::fvec4 *vectors, size_t vectorNum) {
+        if (!buffer || cursor + blockStride > sliceSize) return false;
+
+        GLsizeiptr copySize = sizeof(glm::fvec4) * vectorNum;
+        if (copySize > blockSize) copySize = blockSize;
+        GLintptr offset = slice * sliceSize + cursor;
+        if (persistent) {
+            memcpy(mapped + offset, vectors, copySize);
+        } else {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            void *target = glMapBufferRange(GL_UNIFORM_BUFFER, offset, copySize,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                                            GL_MAP_UNSYNCHRONIZED_BIT);
+            if (target) {
+                memcpy(target, vectors, copySize);
+                glUnmapBuffer(GL_UNIFORM_BUFFER);
+            }
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+        cursor += blockStride;
+        lastUpload = offset;
+        lastSlice = slice;
+        retained = -1;
+        bind(offset);
+        return true;
+    }
+
+    void UniformRing::bind(GLintptr offset) const {
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, blockSize);
+    }
+
+    bool UniformRing::retain() {
+        if (!buffer || lastSlice < 0) return false;
+        retained = retainedRead = lastSlice;
+        bind(lastUpload);
+        return true;
+    }
+
+    void UniformRing::endFrame() {
+        if (!buffer) return;
+        if (retainedRead >= 0 && retainedRead != slice) {
+            if (fence[retainedRead]) glDeleteSync(fence[retainedRead]);
+            fence[retainedRead] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        retainedRead = -1;
+        if (cursor == 0) return;
+        if (fence[slice]) glDeleteSync(fence[slice]);
+        fence[slice] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    TextureBufferPalette::TextureBufferPalette()
+        : buffer(0), texture(0), capacity(0) {
+    }
+
+    TextureBufferPalette::~TextureBufferPalette() {
+        destroy();
+    }
+
+    bool TextureBufferPalette::initialize(size_t vectorNum) {
+        destroy();
+        glGenBuffers(1, &buffer);
+        glGenTextures(1, &texture);
+        return reserve(vectorNum);
+    }
+
+    void TextureBufferPalette::destroy() {
+        GLState::deleteTexture(texture);
+        if (buffer) glDeleteBuffers(1, &buffer);
+        texture = 0;
+        buffer = 0;
+        capacity = 0;
+    }
+
+    bool TextureBufferPalette::reserve(size_t vectorNum) {
+        if (!buffer) return false;
+        if (vectorNum <= capacity && capacity) return true;
+
+        GLint maxTexels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        if (vectorNum > (size_t) maxTexels) {
+            std::cout << "Bone palette of " << vectorNum << " texels exceeds GL_MAX_TEXTURE_BUFFER_SIZE ("
+                      << maxTexels << " texels)" << std::endl;
+            return false;
+        }
+
+        capacity = vectorNum ? vectorNum : 1;
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::fvec4) * capacity, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        GLState::bindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+        return true;
+    }
+
+    glm::fvec4 *TextureBufferPalette::map(size_t vectorNum) {
+        if (!reserve(vectorNum)) return nullptr;
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        void *target = glMapBufferRange(GL_TEXTURE_BUFFER, 0, sizeof(glm::fvec4) * vectorNum,
+                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        return (glm::fvec4 *) target;
+    }
+
+    void TextureBufferPalette::unmap() {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glUnmapBuffer(GL_TEXTURE_BUFFER);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    bool TextureBufferPalette::upload(const glm::fvec4 *vectors, size_t vectorNum) {
+        glm::fvec4 *target = map(vectorNum);
+        if (!target) return false;
+        memcpy(target, vectors, sizeof(glm::fvec4) * vectorNum);
+        unmap();
+        return true;
+    }
+
+    bool TextureBufferPalette::upload(const glm::fmat4 *matrices, size_t matrixNum) {
+        return upload((const glm::fvec4 *) matrices, matrixNum * 4);
+    }
+
+    bool TextureBufferPalette::update(size_t first, const glm::fvec4 *vectors, size_t vectorNum) {
+        if (!buffer || first + vectorNum > capacity) return false;
+        if (!vectorNum) return true;
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, sizeof(glm::fvec4) * first, sizeof(glm::fvec4) * vectorNum, vectors);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        return true;
+    }
+
+    void TextureBufferPalette::bind(GLuint textureUnit) const {
+        GLState::bindTexture(textureUnit, GL_TEXTURE_BUFFER, texture);
+    }
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// Uniform budget of the skinning shader's BonePalette block, in bones stored as full matrices. Compact
+// encodings fit more bones in the same BONE_PALETTE_MAX_VECTORS vec4s, see maxBones().
+// Larger skeletons go to a TextureBufferPalette instead.
+#define BONE_PALETTE_MAX_BONES 100
+#define BONE_PALETTE_MAX_VECTORS (BONE_PALETTE_MAX_BONES * 4)
+#define BONE_PALETTE_BINDING 0
+#define BONE_PALETTE_RING_SIZE 3
+
+namespace BonePalette {
+    // How each bone of a palette is stored; the values are the shader's BONE_ENCODING.
+    enum Encoding {
+        ENCODING_MATRIX = 0,           // column-major 4x4, 4 vec4s
+        ENCODING_AFFINE = 1,           // first three rows, 3 vec4s; the last row is always (0, 0, 0, 1)
+        ENCODING_DUAL_QUATERNION = 2,  // rotation quaternion and dual part, 2 vec4s, both (x, y, z, w)
+    };
+
+    // vec4s per bone
+    size_t vectorNum(Encoding encoding);
+    // Bones that fit in the BonePalette block
+    size_t maxBones(Encoding encoding);
+    const char *encodingName(Encoding encoding);
+    // Parses "matrix", "affine" or "dq"; false for anything else.
+    bool parseEncoding(const std::string &name, Encoding &encoding);
+
+    // Whether every bone is a rotation plus translation, without scale or shear, so that dual quaternions
+    // encode the palette exactly.
+    bool isRigid(const glm::fmat4 *palette, size_t boneNum);
+
+    // Writes boneNum * vectorNum(encoding) vec4s. Dual quaternions only hold rotation and translation: scale
+    // and shear are dropped, and false is returned when some bone had any; the others are always exact.
+    bool encode(Encoding encoding, const glm::fmat4 *palette, size_t boneNum, glm::fvec4 *vectors);
+
+    // Streams bone palettes into a std140 uniform block through a ring of slices guarded by fences,
+    // so writing frame N+1 never waits for the GPU still reading frame N.
+    // Every palette takes a whole block-sized range; several draws of one frame may share a slice.
+    class UniformRing {
+    public:
+        UniformRing();
+        ~UniformRing();
+
+        bool initialize(GLuint bindingPoint, GLsizeiptr blockSize, int palettesPerSlice);
+        void destroy();
+
+        // Moves to the next slice, waiting only if the GPU has not finished with it yet.
+        void beginFrame();
+        // Copies the palette into the current slice and binds its range, returns false when the slice is full.
+        bool upload(const glm::fvec4 *vectors, size_t vectorNum);
+        bool upload(const glm::fmat4 *palette, size_t boneNum);
+        // Rebinds a range returned earlier in the same frame, for draws that share one palette.
+        void bind(GLintptr offset) const;
+        // Rebinds the last upload, possibly of an earlier frame, instead of copying an unchanged palette again.
+        // Until the next upload its slice is fenced with every frame that reads it and beginFrame() passes over
+        // it, so the range is never overwritten while in use. False when nothing was uploaded yet.
+        bool retain();
+        void endFrame();
+
+        bool isPersistent() const { return persistent; }
+
+        GLintptr lastOffset() const { return lastUpload; }
+
+    private:
+        GLuint buffer;
+        GLuint binding;
+        GLsizeiptr blockStride;
+        GLsizeiptr blockSize;
+        GLsizeiptr sliceSize;
+        int slice;
+        GLsizeiptr cursor;
+        GLintptr lastUpload;
+        int lastSlice;     // slice of lastUpload, -1 before the first upload
+        int retained;      // slice kept for retain() since, -1 for none
+        int retainedRead;  // retained slice read this frame, fenced by endFrame()
+        bool persistent;
+        char *mapped;
+        GLsync fence[BONE_PALETTE_RING_SIZE];
+
+        UniformRing(const UniformRing &_copy);
+        UniformRing &operator=(const UniformRing &_copy);
+    };
+
+    // vec4s packed into a buffer texture (RGBA32F, one texel each) and read with texelFetch, so the palette is
+    // bounded by GL_MAX_TEXTURE_BUFFER_SIZE instead of uniform space. A matrix takes four texels, one per column.
+    // Used for per-instance palettes, in any Encoding, model matrices of instanced draws, and single palettes
+    // of skeletons beyond maxBones().
+    class TextureBufferPalette {
+    public:
+        TextureBufferPalette();
+        ~TextureBufferPalette();
+
+        bool initialize(size_t vectorNum);
+        void destroy();
+
+        // Orphans the storage and maps it write-only for vectorNum texels, growing it when needed.
+        glm::fvec4 *map(size_t vectorNum);
+        void unmap();
+        bool upload(const glm::fvec4 *vectors, size_t vectorNum);
+        bool upload(const glm::fmat4 *matrices, size_t matrixNum);
+        // Rewrites texels [first, first + vectorNum) in place, keeping the rest; the range must fit the capacity.
+        bool update(size_t first, const glm::fvec4 *vectors, size_t vectorNum);
+        void bind(GLuint textureUnit) const;
+
+        // In texels
+        size_t getCapacity() const { return capacity; }
+
+    private:
+        GLuint buffer;
+        GLuint texture;
+        size_t capacity;
+
+        bool reserve(size_t vectorNum);
+
+        TextureBufferPalette(const TextureBufferPalette &_copy);
+        TextureBufferPalette &operator=(const TextureBufferPalette &_copy);
+    };
+}
@@ -0,0 +1,264 @@
+#include "cpu_skinning.h"
+#include "job_system.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_SKINNING_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CPU_SKINNING_TARGET_AVX2
+#else
+// The AVX2 kernel is compiled for AVX2 on its own; the rest of the program keeps the baseline instruction set
+#define CPU_SKINNING_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define CPU_SKINNING_X86 0
+#endif
+
+
+namespace CpuSkinning {
+    namespace {
+        typedef void (*KernelFunction)(const Mesh &mesh, const float *palette, Output &output,
+                                       size_t begin, size_t end);
+
+        void skinScalar(const Mesh &mesh, const float *palette, Output &output, size_t begin, size_t end) {
+            for (size_t v = begin; v < end; v++) {
+                float m[12] = {0.0f};  // first three rows, column-major
+                float weightSum = 0.0f;
+                for (unsigned int i = 0; i < mesh.influenceNum; i++) {
+                    float w = mesh.weight[i][v];
+                    const float *bone = palette + mesh.boneId[i][v] * 16;
+                    for (int c = 0; c < 4; c++)
+                        for (int r = 0; r < 3; r++)
+                            m[c * 3 + r] += bone[c * 4 + r] * w;
+                    weightSum += w;
+                }
+                float rest = 1.0f - weightSum;
+                m[0] += rest;
+                m[4] += rest;
+                m[8] += rest;
+
+                float px = mesh.position[0][v], py = mesh.position[1][v], pz = mesh.position[2][v];
+                float nx = mesh.normal[0][v], ny = mesh.normal[1][v], nz = mesh.normal[2][v];
+                for (int r = 0; r < 3; r++) {
+                    output.position[r][v] = m[r] * px + m[3 + r] * py + m[6 + r] * pz + m[9 + r];
+                    output.normal[r][v] = m[r] * nx + m[3 + r] * ny + m[6 + r] * nz;
+                }
+                float length = std::sqrt(output.normal[0][v] * output.normal[0][v] +
+                                         output.normal[1][v] * output.normal[1][v] +
+                                         output.normal[2][v] * output.normal[2][v]);
+                float scale = length > 0.0f ? 1.0f / length : 0.0f;
+                for (int r = 0; r < 3; r++) output.normal[r][v] *= scale;
+            }
+        }
+
+#if CPU_SKINNING_X86
+        void skinSse(const Mesh &mesh, const float *palette, Output &output, size_t begin, size_t end) {
+            const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+            for (size_t v = begin; v < end; v += 4) {
+                __m128 m[12];
+                for (int e = 0; e < 12; e++) m[e] = zero;
+                __m128 weightSum = zero;
+                for (unsigned int i = 0; i < mesh.influenceNum; i++) {
+                    __m128 w = _mm_loadu_ps(&mesh.weight[i][v]);
+                    const int *id = &mesh.boneId[i][v];
+                    const float *b0 = palette + id[0] * 16, *b1 = palette + id[1] * 16;
+                    const float *b2 = palette + id[2] * 16, *b3 = palette + id[3] * 16;
+                    for (int c = 0; c < 4; c++) {
+                        // Column c of the four bones, transposed to its x, y, z, w across the four vertices
+                        __m128 x = _mm_loadu_ps(b0 + c * 4), y = _mm_loadu_ps(b1 + c * 4);
+                        __m128 z = _mm_loadu_ps(b2 + c * 4), t = _mm_loadu_ps(b3 + c * 4);
+                        _MM_TRANSPOSE4_PS(x, y, z, t);
+                        m[c * 3] = _mm_add_ps(m[c * 3], _mm_mul_ps(x, w));
+                        m[c * 3 + 1] = _mm_add_ps(m[c * 3 + 1], _mm_mul_ps(y, w));
+                        m[c * 3 + 2] = _mm_add_ps(m[c * 3 + 2], _mm_mul_ps(z, w));
+                    }
+                    weightSum = _mm_add_ps(weightSum, w);
+                }
+                __m128 rest = _mm_sub_ps(one, weightSum);
+                m[0] = _mm_add_ps(m[0], rest);
+                m[4] = _mm_add_ps(m[4], rest);
+                m[8] = _mm_add_ps(m[8], rest);
+
+                __m128 px = _mm_loadu_ps(&mesh.position[0][v]), py = _mm_loadu_ps(&mesh.position[1][v]);
+                __m128 pz = _mm_loadu_ps(&mesh.position[2][v]);
+                __m128 nx = _mm_loadu_ps(&mesh.normal[0][v]), ny = _mm_loadu_ps(&mesh.normal[1][v]);
+                __m128 nz = _mm_loadu_ps(&mesh.normal[2][v]);
+                __m128 n[3];
+                for (int r = 0; r < 3; r++) {
+                    __m128 p = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r], px), _mm_mul_ps(m[3 + r], py)),
+                                                     _mm_mul_ps(m[6 + r], pz)), m[9 + r]);
+                    _mm_storeu_ps(&output.position[r][v], p);
+                    n[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r], nx), _mm_mul_ps(m[3 + r], ny)),
+                                      _mm_mul_ps(m[6 + r], nz));
+                }
+                __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0], n[0]), _mm_mul_ps(n[1], n[1])),
+                                                       _mm_mul_ps(n[2], n[2])));
+                __m128 scale = _mm_and_ps(_mm_div_ps(one, length), _mm_cmpgt_ps(length, zero));
+                for (int r = 0; r < 3; r++) _mm_storeu_ps(&output.normal[r][v], _mm_mul_ps(n[r], scale));
+            }
+        }
+
+        CPU_SKINNING_TARGET_AVX2
+        void skinAvx2(const Mesh &mesh, const float *palette, Output &output, size_t begin, size_t end) {
+            const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+            for (size_t v = begin; v < end; v += 8) {
+                __m256 m[12];
+                for (int e = 0; e < 12; e++) m[e] = zero;
+                __m256 weightSum = zero;
+                for (unsigned int i = 0; i < mesh.influenceNum; i++) {
+                    __m256 w = _mm256_loadu_ps(&mesh.weight[i][v]);
+                    __m256i base = _mm256_slli_epi32(_mm256_loadu_si256((const __m256i *) &mesh.boneId[i][v]), 4);
+                    for (int c = 0; c < 4; c++)
+                        for (int r = 0; r < 3; r++) {
+                            __m256 element = _mm256_i32gather_ps(palette + c * 4 + r, base, 4);
+                            m[c * 3 + r] = _mm256_add_ps(m[c * 3 + r], _mm256_mul_ps(element, w));
+                        }
+                    weightSum = _mm256_add_ps(weightSum, w);
+                }
+                __m256 rest = _mm256_sub_ps(one, weightSum);
+                m[0] = _mm256_add_ps(m[0], rest);
+                m[4] = _mm256_add_ps(m[4], rest);
+                m[8] = _mm256_add_ps(m[8], rest);
+
+                __m256 px = _mm256_loadu_ps(&mesh.position[0][v]), py = _mm256_loadu_ps(&mesh.position[1][v]);
+                __m256 pz = _mm256_loadu_ps(&mesh.position[2][v]);
+                __m256 nx = _mm256_loadu_ps(&mesh.normal[0][v]), ny = _mm256_loadu_ps(&mesh.normal[1][v]);
+                __m256 nz = _mm256_loadu_ps(&mesh.normal[2][v]);
+                __m256 n[3];
+                for (int r = 0; r < 3; r++) {
+                    __m256 p = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[r], px),
+                                                                         _mm256_mul_ps(m[3 + r], py)),
+                                                           _mm256_mul_ps(m[6 + r], pz)), m[9 + r]);
+                    _mm256_storeu_ps(&output.position[r][v], p);
+                    n[r] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[r], nx), _mm256_mul_ps(m[3 + r], ny)),
+                                         _mm256_mul_ps(m[6 + r], nz));
+                }
+                __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[0], n[0]),
+                                                                           _mm256_mul_ps(n[1], n[1])),
+                                                             _mm256_mul_ps(n[2], n[2])));
+                __m256 scale = _mm256_and_ps(_mm256_div_ps(one, length), _mm256_cmp_ps(length, zero, _CMP_GT_OQ));
+                for (int r = 0; r < 3; r++) _mm256_storeu_ps(&output.normal[r][v], _mm256_mul_ps(n[r], scale));
+            }
+        }
+
+        bool detectAvx2() {
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 1);
+            bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;  // the OS must save the ymm registers
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") != 0;
+#endif
+        }
+#endif
+
+        KernelFunction kernelFunction(Kernel kernel) {
+            switch (kernel) {
+#if CPU_SKINNING_X86
+                case KERNEL_SSE:
+                    return skinSse;
+                case KERNEL_AVX2:
+                    return skinAvx2;
+#endif
+                default:
+                    return skinScalar;
+            }
+        }
+    }
+
+    const char *kernelName(Kernel kernel) {
+        switch (kernel) {
+            case KERNEL_SSE:
+                return "sse";
+            case KERNEL_AVX2:
+                return "avx2";
+            default:
+                return "scalar";
+        }
+    }
+
+    bool kernelSupported(Kernel kernel) {
+#if CPU_SKINNING_X86
+        static const bool avx2 = detectAvx2();
+        return kernel == KERNEL_SCALAR || kernel == KERNEL_SSE || (kernel == KERNEL_AVX2 && avx2);
+#else
+        return kernel == KERNEL_SCALAR;
+#endif
+    }
+
+    Kernel bestKernel() {
+        for (int kernel = KERNEL_NUM - 1; kernel > KERNEL_SCALAR; kernel--)
+            if (kernelSupported((Kernel) kernel)) return (Kernel) kernel;
+        return KERNEL_SCALAR;
+    }
+
+    void Mesh::resize(size_t _vertexNum, unsigned int _influenceNum) {
+        vertexNum = _vertexNum;
+        influenceNum = _influenceNum < CPU_SKINNING_INFLUENCES ? _influenceNum : CPU_SKINNING_INFLUENCES;
+        size_t padded = (vertexNum + CPU_SKINNING_LANES - 1) / CPU_SKINNING_LANES * CPU_SKINNING_LANES;
+        for (int k = 0; k < 3; k++) {
+            position[k].assign(padded, 0.0f);
+            normal[k].assign(padded, 0.0f);
+        }
+        for (int i = 0; i < CPU_SKINNING_INFLUENCES; i++) {
+            boneId[i].assign(padded, 0);
+            weight[i].assign(padded, 0.0f);
+        }
+    }
+
+    void Mesh::set(size_t index, const float _position[3], const float _normal[3],
+                   const unsigned int _boneId[CPU_SKINNING_INFLUENCES], const float _weight[CPU_SKINNING_INFLUENCES]) {
+        for (int k = 0; k < 3; k++) {
+            position[k][index] = _position[k];
+            normal[k][index] = _normal[k];
+        }
+        for (int i = 0; i < CPU_SKINNING_INFLUENCES; i++) {
+            boneId[i][index] = (int) _boneId[i];
+            weight[i][index] = _weight[i];
+        }
+    }
+
+    bool skin(const Mesh &mesh, const glm::fmat4 *palette, size_t boneNum, Output &output,
+              Kernel kernel, bool parallel) {
+        if (boneNum == 0 && mesh.influenceNum > 0) return false;
+        if (!kernelSupported(kernel)) kernel = bestKernel();
+        size_t padded = mesh.paddedNum();
+        output.vertexNum = mesh.vertexNum;
+        for (int k = 0; k < 3; k++) {
+            output.position[k].resize(padded);
+            output.normal[k].resize(padded);
+        }
+
+        KernelFunction function = kernelFunction(kernel);
+        const float *elements = (const float *) palette;
+        if (!parallel || padded <= CPU_SKINNING_BATCH) {
+            function(mesh, elements, output, 0, padded);
+            return true;
+        }
+        JobSystem::Counter counter;
+        JobSystem::parallelFor(padded, CPU_SKINNING_BATCH, [&](size_t begin, size_t end) {
+            function(mesh, elements, output, begin, end);
+        }, counter);
+        JobSystem::wait(counter);
+        return true;
+    }
+
+    bool bounds(const Output &output, glm::fvec3 &min, glm::fvec3 &max) {
+        if (output.vertexNum == 0) return false;
+        for (int k = 0; k < 3; k++) {
+            min[k] = max[k] = output.position[k][0];
+            for (size_t v = 1; v < output.vertexNum; v++) {
+                min[k] = std::min(min[k], output.position[k][v]);
+                max[k] = std::max(max[k], output.position[k][v]);
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+#define CPU_SKINNING_INFLUENCES 4
+// Vertices are padded to a multiple of the widest kernel's lane count
+#define CPU_SKINNING_LANES 8
+// Vertices per job when skinning in parallel; a multiple of CPU_SKINNING_LANES
+#define CPU_SKINNING_BATCH 4096
+
+namespace CpuSkinning {
+    enum Kernel {
+        KERNEL_SCALAR,
+        KERNEL_SSE,   // 4 vertices at a time, palette columns transposed in registers
+        KERNEL_AVX2,  // 8 vertices at a time, palette elements gathered
+        KERNEL_NUM
+    };
+
+    const char *kernelName(Kernel kernel);
+    // Whether this build and this CPU can run the kernel; the scalar one always can.
+    bool kernelSupported(Kernel kernel);
+    // The widest supported kernel, detected once.
+    Kernel bestKernel();
+
+    // Bind-pose vertices as structure of arrays, padded with unweighted vertices at the origin.
+    struct Mesh {
+        size_t vertexNum;
+        unsigned int influenceNum;  // weights read per vertex, at most CPU_SKINNING_INFLUENCES
+        std::vector<float> position[3];
+        std::vector<float> normal[3];
+        std::vector<int> boneId[CPU_SKINNING_INFLUENCES];
+        std::vector<float> weight[CPU_SKINNING_INFLUENCES];
+
+        Mesh() : vertexNum(0), influenceNum(0) {}
+
+        void resize(size_t _vertexNum, unsigned int _influenceNum);
+        void set(size_t index, const float _position[3], const float _normal[3],
+                 const unsigned int _boneId[CPU_SKINNING_INFLUENCES], const float _weight[CPU_SKINNING_INFLUENCES]);
+
+        size_t paddedNum() const { return position[0].size(); }
+    };
+
+    // Skinned vertices, as structure of arrays with the padding of the mesh.
+    struct Output {
+        size_t vertexNum;
+        std::vector<float> position[3];
+        std::vector<float> normal[3];
+
+        Output() : vertexNum(0) {}
+    };
+
+    // Linear blend skinning as in the hand vertex shader with matrix or affine palettes: the weighted sum of
+    // the bone matrices plus the identity for the weight missing to 1, applied to the position and, normalized
+    // afterwards, to the normal. Bone ids must be below boneNum. Batches run on the JobSystem when parallel.
+    bool skin(const Mesh &mesh, const glm::fmat4 *palette, size_t boneNum, Output &output,
+              Kernel kernel = bestKernel(), bool parallel = true);
+
+    // Axis-aligned bounds of the skinned positions; false for an empty output.
+    bool bounds(const Output &output, glm::fvec3 &min, glm::fvec3 &max);
+}
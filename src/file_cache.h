@@ -0,0 +1,202 @@
+// On-disk cache helpers: content hashing, read-only file mapping and blob assembly.
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace FileCache {
+    typedef unsigned long long Hash;
+
+    // 64-bit FNV-1a, good enough to detect changed sources; not meant to resist collisions on purpose.
+    const Hash HASH_SEED = 14695981039346656037ULL;
+    const Hash HASH_PRIME = 1099511628211ULL;
+
+    inline Hash hashBytes(const void *data, size_t size, Hash seed = HASH_SEED) {
+        const unsigned char *bytes = (const unsigned char *) data;
+        for (size_t i = 0; i < size; i++) {
+            seed ^= bytes[i];
+            seed *= HASH_PRIME;
+        }
+        return seed;
+    }
+
+    inline Hash hashString(const std::string &str, Hash seed = HASH_SEED) {
+        return hashBytes(str.data(), str.size(), seed);
+    }
+
+    inline bool hashFile(const std::string &filename, Hash &hash, Hash seed = HASH_SEED) {
+        FILE *fi = fopen(filename.c_str(), "rb");
+        if (fi == NULL) return false;
+        unsigned char buffer[1 << 16];
+        size_t readSize;
+        while ((readSize = fread(buffer, 1, sizeof(buffer), fi)) > 0)
+            seed = hashBytes(buffer, readSize, seed);
+        fclose(fi);
+        hash = seed;
+        return true;
+    }
+
+    inline std::string hashToHex(Hash hash) {
+        char text[17];
+        snprintf(text, sizeof(text), "%016llx", hash);
+        return std::string(text);
+    }
+
+    // Cache file name for _source inside _directory: "<basename>-<hash of full path><suffix>".
+    inline std::string cacheFilename(const std::string &_directory, const std::string &_source,
+                                     const std::string &_suffix) {
+        size_t slashpos = _source.find_last_of("/\\");
+        std::string basename = slashpos == std::string::npos ? _source : _source.substr(slashpos + 1);
+        return _directory + "/" + basename + "-" + hashToHex(hashString(_source)) + _suffix;
+    }
+
+    // Writes through a temporary file so that a crash never leaves a truncated cache behind.
+    inline bool writeFile(const std::string &filename, const void *data, size_t size) {
+        std::string tmpname = filename + ".tmp";
+        FILE *fo = fopen(tmpname.c_str(), "wb");
+        if (fo == NULL) return false;
+        bool ok = fwrite(data, 1, size, fo) == size;
+        ok = (fclose(fo) == 0) && ok;
+        if (ok) {
+            remove(filename.c_str());
+            ok = rename(tmpname.c_str(), filename.c_str()) == 0;
+        }
+        if (!ok) remove(tmpname.c_str());
+        return ok;
+    }
+
+    class MappedFile {
+    private:
+        const char *base;
+        size_t length;
+#ifdef _WIN32
+        HANDLE file;
+        HANDLE mapping;
+#endif
+
+        // Forbid copying, the mapping has a single owner
+        MappedFile(const MappedFile &_copy);
+        MappedFile &operator=(const MappedFile &_copy);
+
+    public:
+        MappedFile() : base(NULL), length(0) {
+#ifdef _WIN32
+            file = INVALID_HANDLE_VALUE;
+            mapping = NULL;
+#endif
+        }
+
+        ~MappedFile() { close(); }
+
+        bool open(const std::string &filename) {
+            close();
+#ifdef _WIN32
+            file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL, NULL);
+            if (file == INVALID_HANDLE_VALUE) return false;
+            LARGE_INTEGER fileSize;
+            if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+                close();
+                return false;
+            }
+            mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping == NULL) {
+                close();
+                return false;
+            }
+            base = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (base == NULL) {
+                close();
+                return false;
+            }
+            length = (size_t) fileSize.QuadPart;
+#else
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat fileStat;
+            if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+                ::close(fd);
+                return false;
+            }
+            void *addr = mmap(NULL, (size_t) fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (addr == MAP_FAILED) return false;
+            base = (const char *) addr;
+            length = (size_t) fileStat.st_size;
+#endif
+            return true;
+        }
+
+        void close() {
+#ifdef _WIN32
+            if (base) UnmapViewOfFile(base);
+            if (mapping) CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+            mapping = NULL;
+            file = INVALID_HANDLE_VALUE;
+#else
+            if (base) munmap((void *) base, length);
+#endif
+            base = NULL;
+            length = 0;
+        }
+
+        bool isOpen() const { return base != NULL; }
+
+        const char *data() const { return base; }
+
+        size_t size() const { return length; }
+
+        // Typed view of _count elements at byte _offset, NULL if the range is out of the file.
+        template<typename T>
+        const T *view(size_t _offset, size_t _count = 1) const {
+            if (!base || _offset > length || _count > (length - _offset) / sizeof(T)) return NULL;
+            return (const T *) (base + _offset);
+        }
+    };
+
+    // Accumulates aligned sections of a cache file in memory before a single write.
+    class BlobWriter {
+    public:
+        std::vector<char> bytes;
+
+        size_t append(const void *data, size_t size, size_t alignment = 16) {
+            size_t offset = (bytes.size() + alignment - 1) / alignment * alignment;
+            bytes.resize(offset + size, 0);
+            if (size) memcpy(bytes.data() + offset, data, size);
+            return offset;
+        }
+
+        template<typename T>
+        size_t appendArray(const std::vector<T> &array, size_t alignment = 16) {
+            return append(array.data(), sizeof(T) * array.size(), alignment);
+        }
+
+        // Patches a previously reserved region, typically the header once all offsets are known.
+        void overwrite(size_t offset, const void *data, size_t size) {
+            memcpy(bytes.data() + offset, data, size);
+        }
+
+        bool save(const std::string &filename) const {
+            return writeFile(filename, bytes.data(), bytes.size());
+        }
+    };
+}
@@ -0,0 +1,142 @@
+#include "gl_state.h"
+
+namespace GLState {
+    namespace {
+        // Texture targets shadowed per unit; others are passed through
+        const GLenum trackedTargets[] = {GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BUFFER, GL_TEXTURE_CUBE_MAP};
+        const int trackedTargetNum = sizeof(trackedTargets) / sizeof(trackedTargets[0]);
+        const GLuint unknown = ~0u;
+
+        struct Shadow {
+            GLuint program;
+            GLuint vao;
+            GLuint activeUnit;
+            GLuint texture[GL_STATE_MAX_TEXTURE_UNITS][trackedTargetNum];
+            int depthTest;  // -1 unknown
+            GLenum depthFunc;  // 0 unknown
+            int depthMask;  // -1 unknown
+        };
+
+        Shadow shadow;
+        Counters counters = {0, 0};
+        bool initialized = false;
+
+        int targetSlot(GLenum target) {
+            for (int i = 0; i < trackedTargetNum; i++)
+                if (trackedTargets[i] == target) return i;
+            return -1;
+        }
+
+        void ensureInitialized() {
+            if (!initialized) invalidate();
+        }
+
+        bool filter(bool redundant) {
+            if (redundant) counters.filtered++;
+            else counters.issued++;
+            return redundant;
+        }
+    }
+
+    void useProgram(GLuint program) {
+        ensureInitialized();
+        if (filter(shadow.program == program)) return;
+        glUseProgram(shadow.program = program);
+    }
+
+    void bindVertexArray(GLuint vao) {
+        ensureInitialized();
+        if (filter(shadow.vao == vao)) return;
+        glBindVertexArray(shadow.vao = vao);
+    }
+
+    void activeTexture(GLuint unit) {
+        ensureInitialized();
+        if (filter(shadow.activeUnit == unit)) return;
+        glActiveTexture(GL_TEXTURE0 + (shadow.activeUnit = unit));
+    }
+
+    void bindTexture(GLuint unit, GLenum target, GLuint texture) {
+        ensureInitialized();
+        int slot = targetSlot(target);
+        if (unit < GL_STATE_MAX_TEXTURE_UNITS && slot >= 0) {
+            if (filter(shadow.texture[unit][slot] == texture)) return;
+            shadow.texture[unit][slot] = texture;
+        } else {
+            counters.issued++;
+        }
+        activeTexture(unit);
+        glBindTexture(target, texture);
+    }
+
+    void bindTexture(GLenum target, GLuint texture) {
+        ensureInitialized();
+        if (shadow.activeUnit == unknown) activeTexture(0);
+        bindTexture(shadow.activeUnit, target, texture);
+    }
+
+    void setDepthTest(bool enable) {
+        ensureInitialized();
+        if (filter(shadow.depthTest == (int) enable)) return;
+        shadow.depthTest = enable;
+        if (enable) glEnable(GL_DEPTH_TEST);
+        else glDisable(GL_DEPTH_TEST);
+    }
+
+    void depthFunc(GLenum func) {
+        ensureInitialized();
+        if (filter(shadow.depthFunc == func)) return;
+        glDepthFunc(shadow.depthFunc = func);
+    }
+
+    void depthMask(GLboolean mask) {
+        ensureInitialized();
+        if (filter(shadow.depthMask == (int) mask)) return;
+        shadow.depthMask = mask;
+        glDepthMask(mask);
+    }
+
+    void deleteProgram(GLuint program) {
+        if (!program) return;
+        ensureInitialized();
+        glDeleteProgram(program);
+        // A program in use is only flagged for deletion and stays current until another one is used
+        if (shadow.program == program) shadow.program = unknown;
+    }
+
+    void deleteVertexArray(GLuint vao) {
+        if (!vao) return;
+        ensureInitialized();
+        glDeleteVertexArrays(1, &vao);
+        if (shadow.vao == vao) shadow.vao = 0;
+    }
+
+    void deleteTexture(GLuint texture) {
+        if (!texture) return;
+        ensureInitialized();
+        glDeleteTextures(1, &texture);
+        for (int unit = 0; unit < GL_STATE_MAX_TEXTURE_UNITS; unit++)
+            for (int slot = 0; slot < trackedTargetNum; slot++)
+                if (shadow.texture[unit][slot] == texture) shadow.texture[unit][slot] = 0;
+    }
+
+    void invalidate() {
+        initialized = true;
+        shadow.program = unknown;
+        shadow.vao = unknown;
+        shadow.activeUnit = unknown;
+        for (int unit = 0; unit < GL_STATE_MAX_TEXTURE_UNITS; unit++)
+            for (int slot = 0; slot < trackedTargetNum; slot++)
+                shadow.texture[unit][slot] = unknown;
+        shadow.depthTest = -1;
+        shadow.depthFunc = 0;
+        shadow.depthMask = -1;
+    }
+
+    void beginFrame() {
+        counters.issued = 0;
+        counters.filtered = 0;
+    }
+
+    const Counters &frameCounters() { return counters; }
+}
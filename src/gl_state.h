@@ -0,0 +1,41 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstddef>
+
+// Texture units whose bindings are shadowed; binds to higher units always reach GL.
+#define GL_STATE_MAX_TEXTURE_UNITS 16
+
+// Shadows the GL state the renderer changes most (program, vertex array, texture bindings per unit, depth
+// state) and drops calls that would set what is already set. It only knows what goes through it: code that
+// changes this state directly must call invalidate() afterwards. Objects are deleted through it as well, since
+// GL reverts bindings of deleted objects to 0 and later reuses their names. Single context, GL thread only.
+namespace GLState {
+    struct Counters {
+        size_t issued;    // calls that reached GL
+        size_t filtered;  // calls dropped as redundant
+    };
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    void activeTexture(GLuint unit);
+    // Binds to the given unit, activating it only when the binding actually changes.
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+    // Binds to the active unit, for creating and uploading textures.
+    void bindTexture(GLenum target, GLuint texture);
+
+    void setDepthTest(bool enable);
+    void depthFunc(GLenum func);
+    void depthMask(GLboolean mask);
+
+    void deleteProgram(GLuint program);
+    void deleteVertexArray(GLuint vao);
+    void deleteTexture(GLuint texture);
+
+    // Forgets everything, so that the next call of each kind reaches GL.
+    void invalidate();
+
+    // Starts counting a new frame; frameCounters() then covers the calls made since.
+    void beginFrame();
+    const Counters &frameCounters();
+}
@@ -0,0 +1,176 @@
+#include "job_system.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace JobSystem {
+    struct Job {
+        Task task;
+        Counter *counter;
+    };
+
+    // A mutex per deque keeps stealing simple; jobs are batches of work, so the lock is never hot.
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<Job> jobs;
+    };
+
+    static std::vector<WorkQueue *> queues;  // queues[0] belongs to the thread that called initialize()
+    static WorkQueue background;
+    static std::vector<std::thread> workers;
+    static std::atomic<int> queuedJobs(0);
+    static std::atomic<bool> running(false);
+    static std::mutex sleepLock;
+    static std::condition_variable wakeUp;
+    static thread_local unsigned queueIndex = 0;
+
+    void finish(Counter &counter) {
+        counter.pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    static bool popJob(Job &job) {
+        if (queues.empty()) return false;
+        {
+            WorkQueue &own = *queues[queueIndex];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.jobs.empty()) {
+                job = own.jobs.back();
+                own.jobs.pop_back();
+                queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            WorkQueue &victim = *queues[(queueIndex + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.jobs.empty()) {
+                job = victim.jobs.front();
+                victim.jobs.pop_front();
+                queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool popBackgroundJob(Job &job) {
+        std::lock_guard<std::mutex> guard(background.lock);
+        if (background.jobs.empty()) return false;
+        job = background.jobs.front();
+        background.jobs.pop_front();
+        queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    static void wakeWorker() {
+        {
+            // Taking the lock orders the increment with a worker about to sleep, so no wake-up is lost
+            std::lock_guard<std::mutex> guard(sleepLock);
+            queuedJobs.fetch_add(1, std::memory_order_relaxed);
+        }
+        wakeUp.notify_one();
+    }
+
+    static void execute(Job &job) {
+        job.task();
+        finish(*job.counter);
+    }
+
+    static void workerLoop(unsigned index) {
+        queueIndex = index;
+        Job job;
+        while (running.load(std::memory_order_acquire)) {
+            if (popJob(job) || popBackgroundJob(job)) {
+                execute(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(sleepLock);
+            wakeUp.wait(guard, [] {
+                return !running.load(std::memory_order_acquire) || queuedJobs.load(std::memory_order_relaxed) > 0;
+            });
+        }
+    }
+
+    void initialize(unsigned _threadNum) {
+        shutdown();
+        if (_threadNum == 0) _threadNum = std::thread::hardware_concurrency();
+        unsigned workerNum = _threadNum > 1 ? _threadNum - 1 : 0;
+        queueIndex = 0;
+        for (unsigned i = 0; i <= workerNum; i++) queues.push_back(new WorkQueue);
+        running.store(true, std::memory_order_release);
+        for (unsigned i = 1; i <= workerNum; i++) workers.push_back(std::thread(workerLoop, i));
+    }
+
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            running.store(false, std::memory_order_release);
+        }
+        wakeUp.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+        workers.clear();
+        // Nobody is left to run them; finish leftovers of every deque and the background queue here so their
+        // counters still reach zero. Jobs submitted meanwhile run inline now that there are no workers.
+        Job job;
+        while (popJob(job) || popBackgroundJob(job)) execute(job);
+        for (size_t i = 0; i < queues.size(); i++) delete queues[i];
+        queues.clear();
+        queuedJobs.store(0);
+    }
+
+    unsigned threadNum() {
+        return (unsigned) workers.size() + 1;
+    }
+
+    void submit(const Task &task, Counter &counter) {
+        counter.pending.fetch_add(1, std::memory_order_relaxed);
+        if (workers.empty()) {
+            task();
+            finish(counter);
+            return;
+        }
+        {
+            WorkQueue &own = *queues[queueIndex];
+            std::lock_guard<std::mutex> guard(own.lock);
+            Job job = {task, &counter};
+            own.jobs.push_back(job);
+        }
+        wakeWorker();
+    }
+
+    void submitBackground(const Task &task, Counter &counter) {
+        counter.pending.fetch_add(1, std::memory_order_relaxed);
+        if (workers.empty()) {
+            task();
+            finish(counter);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(background.lock);
+            Job job = {task, &counter};
+            background.jobs.push_back(job);
+        }
+        wakeWorker();
+    }
+
+    void wait(Counter &counter) {
+        Job job;
+        while (!counter.done()) {
+            if (popJob(job))
+                execute(job);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    void parallelFor(size_t count, size_t batchSize, const RangeTask &task, Counter &counter) {
+        if (batchSize == 0) batchSize = 1;
+        for (size_t begin = 0; begin < count; begin += batchSize) {
+            size_t end = begin + batchSize < count ? begin + batchSize : count;
+            submit([task, begin, end] { task(begin, end); }, counter);
+        }
+    }
+}
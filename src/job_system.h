@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+namespace JobSystem {
+    typedef std::function<void()> Task;
+    // Processes the half-open range [begin, end) of a parallelFor.
+    typedef std::function<void(size_t begin, size_t end)> RangeTask;
+
+    // Number of jobs still pending; jobs decrement it when they finish.
+    class Counter {
+    public:
+        Counter() : pending(0) {}
+
+        bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+    private:
+        friend void submit(const Task &task, Counter &counter);
+        friend void submitBackground(const Task &task, Counter &counter);
+        friend void finish(Counter &counter);
+        std::atomic<int> pending;
+
+        Counter(const Counter &_copy);
+        Counter &operator=(const Counter &_copy);
+    };
+
+    // Runs jobs on _threadNum threads including the caller, one per core when _threadNum is 0.
+    // Every thread owns a deque: it pops its own jobs LIFO and steals the oldest jobs of others.
+    // With a single thread every job runs inline on the submitting thread.
+    void initialize(unsigned _threadNum = 0);
+    void shutdown();
+
+    // Workers plus the calling thread, i.e. how many jobs can run at once.
+    unsigned threadNum();
+
+    void submit(const Task &task, Counter &counter);
+    // Long-running jobs (file decoding) go to a shared queue that only workers drain once their own and
+    // stolen work is exhausted; wait() never picks them up, so a frame never stalls behind a decode.
+    void submitBackground(const Task &task, Counter &counter);
+    // Runs pending jobs on the calling thread until the counter drops to zero.
+    void wait(Counter &counter);
+
+    // Splits [0, count) into batches of batchSize and submits one job per batch; does not wait.
+    void parallelFor(size_t count, size_t batchSize, const RangeTask &task, Counter &counter);
+}
@@ -6,6 +6,8 @@
 
 #include <cstdlib>  // 标准库，用于exit等。
 #include <cstdio>   // 标准库，用于printf等。
+#include <map>      // 标准库，按动作编号缓存手势姿态。
+#include <cstddef>  // 标准库，用于offsetof。
 #include <config.h> // 配置文件，可能包含数据目录等。
 
 #ifndef M_PI
@@ -23,54 +25,164 @@
 
 #include "texture_image.h"  // 纹理图像加载器头文件，用于加载和绑定纹理。
 #include "skybox.h"  // 天空盒渲染器头文件。
-
+#include "bone_palette.h"  // 骨骼矩阵uniform缓冲环。
+#include "job_system.h"  // 工作窃取线程池，用于并行计算多实例姿态。
+#include "gl_state.h"  // GL状态缓存，过滤重复的绑定和状态设置。
+#include "shader_program.h"  // 链接时反射uniform的着色器程序，按句柄设置并跳过未变化的值。
+#include "skin_feedback.h"  // 变换反馈蒙皮的输出缓冲，蒙皮一次供多个绘制遍使用。
+#include "cpu_skinning.h"  // CPU蒙皮，SSE/AVX2内核按CPU选择，用于离线处理和校验。
+
+// 着色器按特性定义宏生成特化版本（见ShaderProgram::Permutations），特性在预处理时确定，着色器中不再有分支：
+// CROWD：多实例，骨骼和模型矩阵从缓冲纹理按gl_InstanceID读取。PALETTE_BUFFER：单只手的骨骼也从缓冲纹理读取，
+// 骨骼数只受缓冲纹理大小限制；两者都为0时从BonePalette块读取。
+// MAX_BONES：BonePalette块容纳的骨骼数，取模型的骨骼数。BONE_INFLUENCES：每个顶点读取的骨骼权重数，每个影响桶一个版本。
+// BONE_ENCODING：骨骼的存放方式，取值同BonePalette::Encoding：0=4x4矩阵，1=3x4仿射矩阵的三行，2=对偶四元数。
+// QUANTIZED：顶点为量化格式，需要还原位置和纹理坐标。TEXTURE_MAPPING：采样材质纹理数组，否则以纹理坐标作为颜色。
+// SKIN_FEEDBACK：只做蒙皮，模型空间的位置、纹理坐标和法线由变换反馈写入SkinFeedback::SkinnedBuffer。
 namespace SkeletalAnimation {  // 定义一个命名空间，包含骨骼动画相关的着色器代码。
     const char *vertex_shader_330 =  // 顶点着色器代码，使用GLSL 3.30版本。
             "#version 330 core\n"
-            "const int MAX_BONES = 100;\n"  // 最大骨骼数量。
-            "uniform mat4 u_bone_transf[MAX_BONES];\n"  // 骨骼变换矩阵的uniform变量，从CPU传递过来。
-            "uniform mat4 u_mvp;\n"  // 模型视图投影矩阵。
+            "#if BONE_ENCODING == 0\n"  // 每根骨骼占的vec4个数。
+            "#define BONE_VECTORS 4\n"
+            "#elif BONE_ENCODING == 1\n"
+            "#define BONE_VECTORS 3\n"
+            "#else\n"
+            "#define BONE_VECTORS 2\n"
+            "#endif\n"
+            "#if CROWD || PALETTE_BUFFER\n"
+            "uniform samplerBuffer u_palettes;\n"  // 骨骼；多实例时是所有实例的，每个实例u_bone_num个。
+            "#define BONE_VECTOR(bone, k) texelFetch(u_palettes, (palette_base + (bone)) * BONE_VECTORS + (k))\n"
+            "#else\n"
+            "layout(std140) uniform BonePalette {\n"  // 骨骼变换放在uniform块中，由CPU通过缓冲环写入。
+            "    vec4 u_bone_vectors[MAX_BONES * BONE_VECTORS];\n"
+            "};\n"
+            "#define BONE_VECTOR(bone, k) u_bone_vectors[(bone) * BONE_VECTORS + (k)]\n"
+            "#endif\n"
+            "#if CROWD\n"
+            "uniform samplerBuffer u_models;\n"  // 每个实例的模型矩阵。
+            "uniform int u_bone_num;\n"
+            "uniform int u_instance_base;\n"  // 按LOD分组绘制时，本组第一个实例在缓冲纹理中的位置。
+            "mat4 fetch_matrix(samplerBuffer matrices, int index) {\n"  // 每个矩阵占4个RGBA32F纹素（按列存放）。
+            "    int texel = index * 4;\n"
+            "    return mat4(texelFetch(matrices, texel), texelFetch(matrices, texel + 1),\n"
+            "                texelFetch(matrices, texel + 2), texelFetch(matrices, texel + 3));\n"
+            "}\n"
+            "#endif\n"
+            "#if BONE_ENCODING == 0\n"
+            "#define BONE_MATRIX(b) mat4(BONE_VECTOR(b, 0), BONE_VECTOR(b, 1), BONE_VECTOR(b, 2), BONE_VECTOR(b, 3))\n"
+            "#elif BONE_ENCODING == 1\n"  // 三行放进前三列再转置，第四行固定为(0, 0, 0, 1)。
+            "#define BONE_MATRIX(b) transpose(mat4(BONE_VECTOR(b, 0), BONE_VECTOR(b, 1), BONE_VECTOR(b, 2), vec4(0.0, 0.0, 0.0, 1.0)))\n"
+            "#else\n"
+            "mat4 dual_quaternion_matrix(vec4 real, vec4 dual) {\n"  // 单位对偶四元数转为刚体变换矩阵。
+            "    vec3 r = real.xyz;\n"
+            "    vec3 t = 2.0 * (real.w * dual.xyz - dual.w * r + cross(r, dual.xyz));\n"
+            "    return mat4(1.0 - 2.0 * (r.y * r.y + r.z * r.z), 2.0 * (r.x * r.y + real.w * r.z), 2.0 * (r.x * r.z - real.w * r.y), 0.0,\n"
+            "                2.0 * (r.x * r.y - real.w * r.z), 1.0 - 2.0 * (r.x * r.x + r.z * r.z), 2.0 * (r.y * r.z + real.w * r.x), 0.0,\n"
+            "                2.0 * (r.x * r.z + real.w * r.y), 2.0 * (r.y * r.z - real.w * r.x), 1.0 - 2.0 * (r.x * r.x + r.y * r.y), 0.0,\n"
+            "                t, 1.0);\n"
+            "}\n"
+            "#endif\n"
+            "uniform mat4 u_mvp;\n"  // 模型视图投影矩阵；多实例时为视图投影矩阵。
+            "#if QUANTIZED\n"
+            "uniform vec3 u_position_scale;\n"  // 量化顶点的还原参数。
+            "uniform vec3 u_position_bias;\n"
+            "uniform vec4 u_texcoord_transform;\n"  // xy为缩放，zw为偏移。
+            "#endif\n"
             "layout(location = 0) in vec3 in_position;\n"  // 输入顶点位置。
             "layout(location = 1) in vec2 in_texcoord;\n"  // 输入纹理坐标。
             "layout(location = 2) in vec3 in_normal;\n"  // 输入法线。
             "layout(location = 3) in ivec4 in_bone_index;\n"  // 输入骨骼索引，每个顶点最多影响4个骨骼。
             "layout(location = 4) in vec4 in_bone_weight;\n"  // 输入骨骼权重。
             "out vec2 pass_texcoord;\n"  // 输出纹理坐标到片段着色器。
+            "#if SKIN_FEEDBACK\n"
+            "out vec3 skinned_position;\n"  // 与pass_texcoord一起按SkinFeedback::SkinnedVertex的顺序写入缓冲。
+            "out vec3 skinned_normal;\n"
+            "#endif\n"
+            "void main() {\n"
+            "#if CROWD\n"
+            "    int instance = u_instance_base + gl_InstanceID;\n"
+            "    int palette_base = instance * u_bone_num;\n"
+            "#else\n"
+            "    const int palette_base = 0;\n"
+            "#endif\n"
+            "    float weight_sum = 0.0;\n"
+            "#if BONE_ENCODING == 2\n"  // 对偶四元数线性混合后归一化，扭转时不会像矩阵混合那样体积塌缩。
+            "    vec4 real = vec4(0.0), dual = vec4(0.0);\n"
+            "    vec4 pivot = BONE_VECTOR(in_bone_index[0], 0);\n"
+            "    for (int i = 0; i < BONE_INFLUENCES; i++) {\n"  // 权重导入时已按大小排序并归一化，只读前BONE_INFLUENCES个。
+            "        vec4 bone_real = BONE_VECTOR(in_bone_index[i], 0);\n"
+            "        float weight = dot(bone_real, pivot) < 0.0 ? -in_bone_weight[i] : in_bone_weight[i];\n"  // q和-q是同一旋转，取与第一根骨骼相同的半球。
+            "        real += bone_real * weight;\n"
+            "        dual += BONE_VECTOR(in_bone_index[i], 1) * weight;\n"
+            "        weight_sum += in_bone_weight[i];\n"
+            "    }\n"
+            "    real.w += 1.0 - weight_sum;\n"  // 不受骨骼影响的顶点混合出单位变换。
+            "    float norm = length(real);\n"
+            "    mat4 bone_transform = dual_quaternion_matrix(real / norm, dual / norm);\n"
+            "#else\n"
+            "    mat4 bone_transform = mat4(0.0);\n"
+            "    for (int i = 0; i < BONE_INFLUENCES; i++) {\n"  // 权重导入时已按大小排序并归一化，只读前BONE_INFLUENCES个。
+            "        bone_transform += BONE_MATRIX(in_bone_index[i]) * in_bone_weight[i];\n"
+            "        weight_sum += in_bone_weight[i];\n"
+            "    }\n"
+            "    bone_transform += mat4(1.0 - weight_sum);\n"  // 权重和为1时不变；不受骨骼影响的顶点保持不动。
+            "#endif\n"
+            "#if QUANTIZED\n"
+            "    vec3 position = in_position * u_position_scale + u_position_bias;\n"  // 还原量化的位置。
+            "    pass_texcoord = in_texcoord * u_texcoord_transform.xy + u_texcoord_transform.zw;\n"  // 传递纹理坐标。
+            "#else\n"
+            "    vec3 position = in_position;\n"
+            "    pass_texcoord = in_texcoord;\n"
+            "#endif\n"
+            "#if SKIN_FEEDBACK\n"
+            "#if QUANTIZED\n"  // 八面体编码的法线，z分量读入为0。
+            "    vec3 normal = vec3(in_normal.xy, 1.0 - abs(in_normal.x) - abs(in_normal.y));\n"
+            "    normal.xy -= sign(normal.xy) * max(-normal.z, 0.0);\n"
+            "#else\n"
+            "    vec3 normal = in_normal;\n"
+            "#endif\n"
+            "    skinned_position = (bone_transform * vec4(position, 1.0)).xyz;\n"
+            "    skinned_normal = normalize(mat3(bone_transform) * normal);\n"
+            "    gl_Position = vec4(skinned_position, 1.0);\n"  // 蒙皮时丢弃光栅化，不会用到。
+            "#elif CROWD\n"
+            "    gl_Position = u_mvp * fetch_matrix(u_models, instance) * bone_transform * vec4(position, 1.0);\n"
+            "#else\n"
+            "    gl_Position = u_mvp * bone_transform * vec4(position, 1.0);\n"  // 计算最终顶点位置。
+            "#endif\n"
+            "}\n";
+
+    // 变换反馈蒙皮之后各个绘制遍使用的顶点着色器：顶点已经蒙皮，只做投影。
+    const char *skinned_vertex_shader_330 =
+            "#version 330 core\n"
+            "uniform mat4 u_mvp;\n"
+            "layout(location = 0) in vec3 in_position;\n"  // 蒙皮后的位置。
+            "layout(location = 1) in vec2 in_texcoord;\n"  // 已还原的纹理坐标。
+            "out vec2 pass_texcoord;\n"
             "void main() {\n"
-            "    float adjust_factor = 0.0;\n"  // 调整因子，用于归一化权重。
-            "    for (int i = 0; i < 4; i++) adjust_factor += in_bone_weight[i] * 0.25;\n"  // 计算调整因子。
-            "    mat4 bone_transform = mat4(1.0);\n"  // 初始化骨骼变换矩阵为单位矩阵。
-            "    if (adjust_factor > 1e-3) {\n"  // 如果调整因子大于阈值，表示顶点受骨骼影响。
-            "        bone_transform -= bone_transform;\n"  // 重置为零矩阵。
-            "        for (int i = 0; i < 4; i++)\n"  // 循环4个骨骼。
-            "            bone_transform += u_bone_transf[in_bone_index[i]] * in_bone_weight[i] / adjust_factor;\n"  // 根据权重累加变换矩阵。
-            "	 }\n"
-            "    gl_Position = u_mvp * bone_transform * vec4(in_position, 1.0);\n"  // 计算最终顶点位置。
-            "    pass_texcoord = in_texcoord;\n"  // 传递纹理坐标。
+            "    pass_texcoord = in_texcoord;\n"
+            "    gl_Position = u_mvp * vec4(in_position, 1.0);\n"
             "}\n";
 
     const char *fragment_shader_330 =  // 片段着色器代码。
             "#version 330 core\n"
-            "uniform sampler2D u_basecolor;\n"  // 基础颜色纹理采样器。
-            "uniform sampler2D u_normal;\n"  // 法线纹理采样器。
-            "uniform sampler2D u_metallic;\n"  // 金属度纹理采样器。
-            "uniform sampler2D u_roughness;\n"  // 粗糙度纹理采样器。
-            "uniform sampler2D u_ao;\n"  // AO纹理采样器。
-            "uniform int texture_mode;\n"  // 纹理模式：1=使用纹理，0=使用漫反射通道。
+            "#if TEXTURE_MAPPING\n"
+            "uniform sampler2DArray u_basecolor;\n"  // 基础颜色纹理数组，每层一组材质。
+            "uniform sampler2DArray u_normal;\n"  // 法线纹理数组。
+            "uniform sampler2DArray u_orm;\n"  // 打包纹理数组：R=AO，G=粗糙度，B=金属度。
+            "uniform int u_material_layer;\n"  // 当前材质在纹理数组中的层号。
+            "#endif\n"
             "in vec2 pass_texcoord;\n"  // 从顶点着色器接收的纹理坐标。
             "out vec4 out_color;\n"  // 输出颜色。
             "void main() {\n"
-            #ifdef DIFFUSE_TEXTURE_MAPPING  // 如果启用了纹理映射。
-            "    if (texture_mode == 1) {\n"
-            "        vec3 basecolor = texture(u_basecolor, pass_texcoord).xyz;\n"  // 采样基础颜色。
-            "        float ao = texture(u_ao, pass_texcoord).r;\n"  // 采样AO（使用红色通道）。
-            "        out_color = vec4(basecolor * ao, 1.0);\n"  // 叠加基础颜色和AO。
-            "    } else {\n"
-            "        out_color = vec4(pass_texcoord, 0.0, 1.0);\n"  // 使用纹理坐标作为颜色，像origin.cpp一样。
-            "    }\n"
-            #else
-            "    out_color = vec4(pass_texcoord, 0.0, 1.0);\n"  // 否则，使用纹理坐标作为颜色（调试用）。
-            #endif
+            "#if TEXTURE_MAPPING\n"
+            "    vec3 coord = vec3(pass_texcoord, float(u_material_layer));\n"  // 第三个分量选择数组层。
+            "    vec3 basecolor = texture(u_basecolor, coord).xyz;\n"  // 采样基础颜色。
+            "    vec3 orm = texture(u_orm, coord).rgb;\n"  // 一次采样得到AO、粗糙度和金属度。
+            "    float ao = orm.r;\n"
+            "    out_color = vec4(basecolor * ao, 1.0);\n"  // 叠加基础颜色和AO。
+            "#else\n"
+            "    out_color = vec4(pass_texcoord, 0.0, 1.0);\n"  // 使用纹理坐标作为颜色，像origin.cpp一样。
+            "#endif\n"
             "}\n";
 }
 
@@ -81,6 +193,7 @@ static void error_callback(int error, const char *description) {  // GLFW错误
 static int current_action = 10;  // 当前默认动作
 static int current_tex = 0;  // 当前纹理：0=mano-hand-cyborg, 1=hand-sculpture, 2=no texture
 static bool input_mode = false;  // 是否进入输入模式
+static bool animation_paused = false;  // 是否暂停动画；暂停时姿态不变，骨骼不再重新计算和上传
 
 // Camera control variables
 static glm::vec3 camera_eye = glm::vec3(30.0f, 5.0f, 10.0f);  // 相机位置 (Camera position)
@@ -163,6 +276,10 @@ static void key_callback(GLFWwindow *window, int key, int scancode, int action,
         current_action = 11;
     if (key == GLFW_KEY_L && action == GLFW_PRESS)  // 按L键锁定/解锁相机
         camera_locked = !camera_locked;
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {  // 按P键暂停/继续动画
+        animation_paused = !animation_paused;
+        std::cout << (animation_paused ? "Animation paused" : "Animation resumed") << std::endl;
+    }
     if (key == GLFW_KEY_F1 && action == GLFW_PRESS) {  // 按F1键设置A点
         camera_mode = SET_POINT_A;
         std::cout << "Set Point A mode: Click to set camera position A" << std::endl;
@@ -270,33 +387,1157 @@ static void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
     }
 }
 
+// 手部骨骼句柄：加载模型后按名称解析一次，之后每帧按下标直接写入姿态，不再做字符串查找。
+struct HandBones {
+    SkeletalMesh::BoneHandle metacarpals;
+    SkeletalMesh::BoneHandle thumb_proximal_phalange, thumb_intermediate_phalange, thumb_distal_phalange;
+    SkeletalMesh::BoneHandle index_proximal_phalange, index_intermediate_phalange, index_distal_phalange;
+    SkeletalMesh::BoneHandle middle_proximal_phalange, middle_intermediate_phalange, middle_distal_phalange;
+    SkeletalMesh::BoneHandle ring_proximal_phalange, ring_intermediate_phalange, ring_distal_phalange;
+    SkeletalMesh::BoneHandle pinky_proximal_phalange, pinky_intermediate_phalange, pinky_distal_phalange;
+
+    void resolve(const SkeletalMesh::Scene &scene) {
+        metacarpals = scene.findBone("metacarpals");
+        thumb_proximal_phalange = scene.findBone("thumb_proximal_phalange");
+        thumb_intermediate_phalange = scene.findBone("thumb_intermediate_phalange");
+        thumb_distal_phalange = scene.findBone("thumb_distal_phalange");
+        index_proximal_phalange = scene.findBone("index_proximal_phalange");
+        index_intermediate_phalange = scene.findBone("index_intermediate_phalange");
+        index_distal_phalange = scene.findBone("index_distal_phalange");
+        middle_proximal_phalange = scene.findBone("middle_proximal_phalange");
+        middle_intermediate_phalange = scene.findBone("middle_intermediate_phalange");
+        middle_distal_phalange = scene.findBone("middle_distal_phalange");
+        ring_proximal_phalange = scene.findBone("ring_proximal_phalange");
+        ring_intermediate_phalange = scene.findBone("ring_intermediate_phalange");
+        ring_distal_phalange = scene.findBone("ring_distal_phalange");
+        pinky_proximal_phalange = scene.findBone("pinky_proximal_phalange");
+        pinky_intermediate_phalange = scene.findBone("pinky_intermediate_phalange");
+        pinky_distal_phalange = scene.findBone("pinky_distal_phalange");
+    }
+};
+
 // 复原函数：让所有手指伸直
-static void resetFingers(SkeletalMesh::SkeletonModifier &modifier) {
+static void resetFingers(SkeletalMesh::SkeletonPose &pose, const HandBones &hand) {
     // 食指
-    modifier["index_proximal_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-    modifier["index_intermediate_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-    modifier["index_distal_phalange"] = glm::identity<glm::mat4>();
+    pose.set(hand.index_proximal_phalange, glm::identity<glm::mat4>());  // 食指伸直
+    pose.set(hand.index_intermediate_phalange, glm::identity<glm::mat4>());  // 食指伸直
+    pose.set(hand.index_distal_phalange, glm::identity<glm::mat4>());
     // 中指
-    modifier["middle_proximal_phalange"] = glm::identity<glm::mat4>();  // 中指伸直
-    modifier["middle_intermediate_phalange"] = glm::identity<glm::mat4>();  // 中指伸直
-    modifier["middle_distal_phalange"] = glm::identity<glm::mat4>();
+    pose.set(hand.middle_proximal_phalange, glm::identity<glm::mat4>());  // 中指伸直
+    pose.set(hand.middle_intermediate_phalange, glm::identity<glm::mat4>());  // 中指伸直
+    pose.set(hand.middle_distal_phalange, glm::identity<glm::mat4>());
     // 无名指
-    modifier["ring_proximal_phalange"] = glm::identity<glm::mat4>();  // 无名指伸直
-    modifier["ring_intermediate_phalange"] = glm::identity<glm::mat4>();  // 无名指伸直
-    modifier["ring_distal_phalange"] = glm::identity<glm::mat4>();
+    pose.set(hand.ring_proximal_phalange, glm::identity<glm::mat4>());  // 无名指伸直
+    pose.set(hand.ring_intermediate_phalange, glm::identity<glm::mat4>());  // 无名指伸直
+    pose.set(hand.ring_distal_phalange, glm::identity<glm::mat4>());
     // 小指
-    modifier["pinky_proximal_phalange"] = glm::identity<glm::mat4>();  // 小指伸直
-    modifier["pinky_intermediate_phalange"] = glm::identity<glm::mat4>();  // 小指伸直
-    modifier["pinky_distal_phalange"] = glm::identity<glm::mat4>();
+    pose.set(hand.pinky_proximal_phalange, glm::identity<glm::mat4>());  // 小指伸直
+    pose.set(hand.pinky_intermediate_phalange, glm::identity<glm::mat4>());  // 小指伸直
+    pose.set(hand.pinky_distal_phalange, glm::identity<glm::mat4>());
     // 大拇指
-    modifier["thumb_proximal_phalange"] = glm::identity<glm::mat4>();  // 大拇指伸直
-    modifier["thumb_intermediate_phalange"] = glm::identity<glm::mat4>();  // 大拇指伸直
-    modifier["thumb_distal_phalange"] = glm::identity<glm::mat4>();
+    pose.set(hand.thumb_proximal_phalange, glm::identity<glm::mat4>());  // 大拇指伸直
+    pose.set(hand.thumb_intermediate_phalange, glm::identity<glm::mat4>());  // 大拇指伸直
+    pose.set(hand.thumb_distal_phalange, glm::identity<glm::mat4>());
+}
+
+// 根据动作编号和时间设置手掌（metacarpals）的旋转，这是静态手势中唯一随时间变化的骨骼。
+static void rotateHand(SkeletalMesh::SkeletonPose &pose, const HandBones &hand, int action, float passed_time) {
+    // ===== 挥手动作 =====
+    if (action == 11) {
+        // 使用时间让手挥动
+        float wave_time = passed_time * 2.0f;  // 挥手速度
+        float wave_angle = sin(wave_time) * M_PI / 3.0f;  // 左右摆动角度
+
+        // 整个手掌左右摆动，手掌面向屏幕朝外
+        pose.set(hand.metacarpals, glm::rotate(glm::identity<glm::mat4>(), wave_angle, glm::fvec3(0.0, 1.0, 0.0)));
+        return;
+    }
+
+    // Example: Rotate the hand  // 示例：旋转整个手。
+    // * turn around every 4 seconds  // 每4秒转一圈。
+    float metacarpals_angle = passed_time * (M_PI / 4.0f);  // 计算旋转角度，passed_time * (PI/4) 意味着每4秒转90度，但由于是连续的，每秒转PI/4弧度，即每4秒转2PI。
+    // * target = metacarpals  // 目标是手掌部分（metacarpals）。
+    // * rotation axis = (1, 0, 0)  // 旋转轴是X轴。
+    pose.set(hand.metacarpals, glm::rotate(glm::identity<glm::mat4>(), metacarpals_angle, glm::fvec3(1.0, 0.0, 0.0)));  // 设置手掌的变换矩阵为绕X轴旋转。
+}
+
+// 动作的手指姿态是否随时间变化（动作10依次弯曲手指）。其余动作只有手掌随时间旋转。
+static bool fingersFollowTime(int action) {
+    return action == 10;
+}
+
+// 根据动作编号和时间设置一只手的姿态。主循环和多实例（crowd）模式共用。
+static void animateHand(SkeletalMesh::SkeletonPose &pose, const HandBones &hand, int action, float passed_time) {
+    // --- You may edit below ---  // 以下是作业需要修改的地方，实现手的运动。
+
+    // 先复原所有手指
+    resetFingers(pose, hand);
+
+    // 手掌的旋转，挥手动作时左右摆动
+    rotateHand(pose, hand, action, passed_time);
+
+    /**********************************************************************************\
+    *
+    * To animate fingers, call pose.set(hand.HAND_SECTION, ...) each frame,  // 要让手指动起来，每帧调用 pose.set(hand.手的部分名称, ...)。
+    * where HAND_SECTION can only be one of the bone names in the Hand's Hierarchy.  // HAND_SECTION 只能是手的层次结构中的骨骼名称之一。
+    *
+    * A virtual hand's structure is like this: (slightly DIFFERENT from the real world)  // 虚拟手的手指结构（与现实略有不同）：
+    *    5432 1
+    *    ....        1 = thumb           . = fingertip  // 1=大拇指，. = 指尖
+    *    |||| .      2 = index finger    | = distal phalange  // 2=食指，| = 远端指节
+    *    $$$$ |      3 = middle finger   $ = intermediate phalange  // 3=中指，$ = 中间指节
+    *    #### $      4 = ring finger     # = proximal phalange  // 4=无名指，# = 近端指节
+    *    OOOO#       5 = pinky           O = metacarpals  // 5=小指，O = 手掌
+    *     OOO
+    * (Hand in the real world -> https://en.wikipedia.org/wiki/Hand)  // （现实中的手请参考维基百科）
+    *
+    * From the structure we can infer the Hand's Hierarchy:  // 从结构可以推断出手的层次：
+    *	- metacarpals  // 手掌
+    *		- thumb_proximal_phalange  // 大拇指近端指节
+    *			- thumb_intermediate_phalange  // 大拇指中间指节
+    *				- thumb_distal_phalange  // 大拇指远端指节
+    *					- thumb_fingertip  // 大拇指尖
+    *		- index_proximal_phalange  // 食指...
+    *			- index_intermediate_phalange
+    *				- index_distal_phalange
+    *					- index_fingertip
+    *		- middle_proximal_phalange  // 中指...
+    *			- middle_intermediate_phalange
+    *				- middle_distal_phalange
+    *					- middle_fingertip
+    *		- ring_proximal_phalange  // 无名指...
+    *			- ring_intermediate_phalange
+    *				- ring_distal_phalange
+    *					- ring_fingertip
+    *		- pinky_proximal_phalange  // 小指...
+    *			- pinky_intermediate_phalange
+    *				- pinky_distal_phalange
+    *					- pinky_fingertip
+    *
+    * Notice that pose.set(hand.HAND_SECTION, ...) takes a local transformation matrix,  // 注意 pose.set(hand.手的部分, ...) 接收一个局部变换矩阵，
+    * where (1, 0, 0) is the bone's direction, and apparently (0, 1, 0) / (0, 0, 1)  // 其中 (1,0,0) 是骨骼的方向，(0,1,0) 和 (0,0,1) 垂直于骨骼。
+    * is perpendicular to the bone.  // 特别是 (0,0,1) 是近端关节的主要旋转轴。
+    * Particularly, (0, 0, 1) is the rotation axis of the nearer joint.  // 手指第一指节也可沿 (0,1,0) 小范围转动。
+    *
+    \**********************************************************************************/
+    
+    
+
+
+    float angle_90 = M_PI / 2.0f;  // 90度
+    float angle_72 = M_PI / 2.5f;  // 75度
+    float angle_60 = M_PI / 3.0f;  // 60度
+    float angle_45 = M_PI / 4.0f;  // 45度
+    float angle_30 = M_PI / 6.0f;  // 30度
+    float angle_10 = M_PI / 18.0f;  // 10度弯曲角度
+
+    
+    // ===== 让手指依次动起来 =====
+    // 如果当前动作是依次弯曲（默认），
+    if (action == 10) {
+        // 使用时间延迟，让每个手指在不同时间开始弯曲，实现依次动作
+        float period = 2.4f;  // 每个手指的弯曲周期
+        float delay_step = 0.5f;  // 每个手指之间的延迟时间（秒）
+        // 食指（最先动）
+        float time_index = passed_time;
+        float time_in_period_index = fmod(time_index, period);  // 当前周期内的时间，使用fmod取模
+        // * angle: 0 -> PI/3 -> 0  // 角度：0 -> PI/3 -> 0，即从0到60度再回到0。
+        float angle_index = abs(time_in_period_index / (period * 0.5f) - 1.0f) * (M_PI / 3.0);  // 计算角度，使用abs函数使之先增后减
+        pose.set(hand.index_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_index, glm::fvec3(0.0, 0.0, 1.0)));
+
+        // 中指（延迟0.5秒）
+        //逻辑：当程序刚启动时（passed_time < 0.5），time_middle 会是负数，中指不动。
+        //当程序运行超过0.5秒时（passed_time >= 0.5），time_middle 变成正数，中指开始动。
+        float time_middle = passed_time - delay_step;
+        if (time_middle > 0) {
+            float time_in_period_middle = fmod(time_middle, period);
+            float angle_middle = abs(time_in_period_middle / (period * 0.5f) - 1.0f) * (M_PI / 3.0);
+            pose.set(hand.middle_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_middle, glm::fvec3(0.0, 0.0, 1.0)));
+        }
+
+        // 无名指（延迟1秒）
+        float time_ring = passed_time - 2 * delay_step;
+        if (time_ring > 0) {
+            float time_in_period_ring = fmod(time_ring, period);
+            float angle_ring = abs(time_in_period_ring / (period * 0.5f) - 1.0f) * (M_PI / 3.0);
+            pose.set(hand.ring_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_ring, glm::fvec3(0.0, 0.0, 1.0)));
+        }
+
+        // 小指（延迟1.5秒）
+        float time_pinky = passed_time - 3 * delay_step;
+        if (time_pinky > 0) {
+            float time_in_period_pinky = fmod(time_pinky, period);
+            float angle_pinky = abs(time_in_period_pinky / (period * 0.5f) - 1.0f) * (M_PI / 3.0);
+            pose.set(hand.pinky_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_pinky, glm::fvec3(0.0, 0.0, 1.0)));
+        }
+
+        // 大拇指（延迟2秒，可能用不同的轴）
+        float time_thumb = passed_time - 4 * delay_step;
+        if (time_thumb > 0) {
+            float time_in_period_thumb = fmod(time_thumb, period);
+            float angle_thumb = abs(time_in_period_thumb / (period * 0.5f) - 1.0f) * (M_PI / 3.0);
+            pose.set(hand.thumb_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_thumb, glm::fvec3(0.0, 1.0, 0.0)));  // 大拇指用Y轴
+        }
+    }
+
+    // ===== 比心动作 =====
+    // 如果当前动作是比心（按0键切换），覆盖上面的动画
+    if (action == 0) {
+        //拇指
+        pose.set(hand.thumb_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));  // 大拇指弯曲30度
+        pose.set(hand.thumb_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_10, glm::fvec3(0.0, 0.0, 1.0)));
+        //食指
+        pose.set(hand.index_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_60, glm::fvec3(0.0, 0.0, 1.0)));  // 食指弯曲90度
+        pose.set(hand.index_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0)));  // 食指中间指节弯曲90度
+        pose.set(hand.index_distal_phalange, glm::identity<glm::mat4>());
+        //中指
+        pose.set(hand.middle_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));  // 中指弯曲90度
+        pose.set(hand.middle_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        //无名指
+        pose.set(hand.ring_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));    // 无名指弯曲90度
+        pose.set(hand.ring_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        //小指
+        pose.set(hand.pinky_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));   // 小指弯曲90度
+        pose.set(hand.pinky_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+
+    }
+    // ===== 比数字1 =====
+    if (action == 1) {
+        //拇指
+        pose.set(hand.thumb_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0)));
+        pose.set(hand.thumb_distal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));  // 大拇指弯曲60度
+        pose.set(hand.thumb_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));
+        //食指
+        pose.set(hand.index_proximal_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_intermediate_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_distal_phalange, glm::identity<glm::mat4>());
+        //中指
+        pose.set(hand.middle_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));  // 中指弯曲90度
+        pose.set(hand.middle_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        //无名指
+        pose.set(hand.ring_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));    // 无名指弯曲90度
+        pose.set(hand.ring_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        //小指
+        pose.set(hand.pinky_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));   // 小指弯曲90度
+        pose.set(hand.pinky_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+
+    }
+    // ===== 比数字2 =====
+    if (action == 2) {
+        //拇指
+        pose.set(hand.thumb_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0)));
+        pose.set(hand.thumb_distal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));  // 大拇指弯曲60度
+        pose.set(hand.thumb_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));
+        //食指
+        pose.set(hand.index_proximal_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_intermediate_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_distal_phalange, glm::identity<glm::mat4>());
+        //中指
+        pose.set(hand.middle_proximal_phalange, glm::identity<glm::mat4>());  // 中指伸直
+        pose.set(hand.middle_intermediate_phalange, glm::identity<glm::mat4>());  // 中指伸直
+        //无名指
+        pose.set(hand.ring_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));    // 无名指弯曲90度
+        pose.set(hand.ring_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        //小指
+        pose.set(hand.pinky_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));   // 小指弯曲90度
+        pose.set(hand.pinky_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+
+    }
+    // ===== 比数字3 =====
+    if (action == 3) {
+        //拇指
+        pose.set(hand.thumb_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0)));
+        pose.set(hand.thumb_distal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));  // 大拇指弯曲60度
+        pose.set(hand.thumb_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));
+        //食指
+        pose.set(hand.index_proximal_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_intermediate_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_distal_phalange, glm::identity<glm::mat4>());
+        //中指
+        pose.set(hand.middle_proximal_phalange, glm::identity<glm::mat4>());  // 中指伸直
+        pose.set(hand.middle_intermediate_phalange, glm::identity<glm::mat4>());  // 中指伸直
+        //无名指
+        pose.set(hand.ring_proximal_phalange, glm::identity<glm::mat4>());  // 无名指伸直
+        pose.set(hand.ring_intermediate_phalange, glm::identity<glm::mat4>());  // 无名指伸直
+        //小指
+        pose.set(hand.pinky_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));   // 小指弯曲90度
+        pose.set(hand.pinky_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+
+    }
+    // ===== 比数字4 =====
+    if (action == 4) {
+        //拇指
+        pose.set(hand.thumb_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0)));
+        pose.set(hand.thumb_distal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));  // 大拇指弯曲60度
+        pose.set(hand.thumb_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));
+         //食指
+        pose.set(hand.index_proximal_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_intermediate_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_distal_phalange, glm::identity<glm::mat4>());
+        //中指
+        pose.set(hand.middle_proximal_phalange, glm::identity<glm::mat4>());  // 中指伸直
+        pose.set(hand.middle_intermediate_phalange, glm::identity<glm::mat4>());  // 中指伸直
+        //无名指
+        pose.set(hand.ring_proximal_phalange, glm::identity<glm::mat4>());  // 无名指伸直
+        pose.set(hand.ring_intermediate_phalange, glm::identity<glm::mat4>());  // 无名指伸直
+        //小指
+        pose.set(hand.pinky_proximal_phalange, glm::identity<glm::mat4>());  // 小指伸直
+        pose.set(hand.pinky_intermediate_phalange, glm::identity<glm::mat4>());  // 小指伸直
+
+    }
+    // ===== 比数字5 =====
+    if (action == 5) {
+        //拇指
+        pose.set(hand.thumb_proximal_phalange, glm::identity<glm::mat4>());  // 拇指伸直
+        pose.set(hand.thumb_intermediate_phalange, glm::identity<glm::mat4>());  // 拇指伸直
+        pose.set(hand.thumb_distal_phalange, glm::identity<glm::mat4>());  // 拇指伸直
+         //食指
+        pose.set(hand.index_proximal_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_intermediate_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_distal_phalange, glm::identity<glm::mat4>());
+        //中指
+        pose.set(hand.middle_proximal_phalange, glm::identity<glm::mat4>());  // 中指伸直
+        pose.set(hand.middle_intermediate_phalange, glm::identity<glm::mat4>());  // 中指伸直
+        //无名指
+        pose.set(hand.ring_proximal_phalange, glm::identity<glm::mat4>());  // 无名指伸直
+        pose.set(hand.ring_intermediate_phalange, glm::identity<glm::mat4>());  // 无名指伸直
+        //小指
+        pose.set(hand.pinky_proximal_phalange, glm::identity<glm::mat4>());  // 小指伸直
+        pose.set(hand.pinky_intermediate_phalange, glm::identity<glm::mat4>());  // 小指伸直
+
+    }
+    // ===== 比数字6 =====
+    if (action == 6) {
+        //拇指
+        pose.set(hand.thumb_proximal_phalange, glm::identity<glm::mat4>());  // 拇指伸直
+        pose.set(hand.thumb_intermediate_phalange, glm::identity<glm::mat4>());  // 拇指伸直
+        pose.set(hand.thumb_distal_phalange, glm::identity<glm::mat4>());  // 拇指伸直
+        //食指
+        pose.set(hand.index_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));  // 食指弯曲90度
+        pose.set(hand.index_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        pose.set(hand.index_distal_phalange, glm::identity<glm::mat4>());
+        //中指
+        pose.set(hand.middle_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));  // 中指弯曲90度
+        pose.set(hand.middle_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        //无名指
+        pose.set(hand.ring_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));    // 无名指弯曲90度
+        pose.set(hand.ring_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        //小指
+        pose.set(hand.pinky_proximal_phalange, glm::identity<glm::mat4>());  // 小指伸直
+        pose.set(hand.pinky_intermediate_phalange, glm::identity<glm::mat4>());  // 小指伸直
+    }
+    // ===== 比数字7 =====
+    if (action == 7) {
+        //拇指
+        pose.set(hand.thumb_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_10, glm::fvec3(0.0, 0.0, 1.0)));
+        pose.set(hand.thumb_distal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));  // 大拇指弯曲60度
+        pose.set(hand.thumb_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));
+        //食指
+        pose.set(hand.index_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_72, glm::fvec3(0.0, 0.0, 1.0)));  // 食指弯曲90度
+        pose.set(hand.index_intermediate_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_distal_phalange, glm::identity<glm::mat4>());
+        //中指
+        pose.set(hand.middle_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_72, glm::fvec3(0.0, 0.0, 1.0)));  // 中指弯曲90度
+        pose.set(hand.middle_intermediate_phalange, glm::identity<glm::mat4>());
+        //无名指
+        pose.set(hand.ring_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));    // 无名指弯曲90度
+        pose.set(hand.ring_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        //小指
+        pose.set(hand.pinky_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));   // 小指弯曲90度
+        pose.set(hand.pinky_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+
+    }
+    // ===== 比数字8 =====
+    if (action == 8) {
+        //拇指
+        pose.set(hand.thumb_proximal_phalange, glm::identity<glm::mat4>());  // 拇指伸直
+        pose.set(hand.thumb_intermediate_phalange, glm::identity<glm::mat4>());  // 拇指伸直
+        pose.set(hand.thumb_distal_phalange, glm::identity<glm::mat4>());  // 拇指伸直
+        //食指
+        pose.set(hand.index_proximal_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_intermediate_phalange, glm::identity<glm::mat4>());  // 食指伸直
+        pose.set(hand.index_distal_phalange, glm::identity<glm::mat4>());
+        //中指
+        pose.set(hand.middle_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));  // 中指弯曲90度
+        pose.set(hand.middle_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        //无名指
+        pose.set(hand.ring_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));    // 无名指弯曲90度
+        pose.set(hand.ring_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        //小指
+        pose.set(hand.pinky_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));   // 小指弯曲90度
+        pose.set(hand.pinky_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+
+    }
+    // ===== 比数字9 =====
+    if (action == 9) {
+        //拇指
+        pose.set(hand.thumb_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0)));
+        pose.set(hand.thumb_distal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));  // 大拇指弯曲60度
+        pose.set(hand.thumb_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));
+        //食指
+        pose.set(hand.index_proximal_phalange, glm::identity<glm::mat4>());
+        pose.set(hand.index_distal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));  // 食指弯曲60度
+        pose.set(hand.index_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_60, glm::fvec3(0.0, 0.0, 1.0)));
+        //中指
+        pose.set(hand.middle_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));  // 中指弯曲90度
+        pose.set(hand.middle_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        //无名指
+        pose.set(hand.ring_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));    // 无名指弯曲90度
+        pose.set(hand.ring_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+        //小指
+        pose.set(hand.pinky_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));   // 小指弯曲90度
+        pose.set(hand.pinky_intermediate_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0)));
+
+    }
+
+    // ===== 挥手动作 =====
+    if (action == 11) {
+        // 手指稍微弯曲，模拟自然挥手姿势
+        pose.set(hand.index_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));
+        pose.set(hand.middle_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));
+        pose.set(hand.ring_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));
+        pose.set(hand.pinky_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0)));
+        pose.set(hand.thumb_proximal_phalange, glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0)));
+    }
+    // --- You may edit above ---  // 以上是需要修改的地方。
+}
+
+// 对偶四元数只能表示旋转和平移：检查静止姿态和每个动作的姿态，有骨骼带缩放或错切时返回false。
+// 动作只旋转骨骼，时间只改变旋转角度，所以每个动作检查一个时刻即可。
+static bool hand_palettes_rigid(const SkeletalMesh::Scene &scene, const HandBones &hand) {
+    SkeletalMesh::SkeletonPose probe;
+    scene.initPose(probe);
+    for (int action = -1; action < 12; action++) {  // -1为静止姿态
+        if (action >= 0) animateHand(probe, hand, action, 0.0f);
+        scene.getSkeletonTransform(probe);
+        if (!BonePalette::isRigid(probe.getPalette().data(), probe.getPalette().size())) return false;
+    }
+    return true;
+}
+
+// 着色器uniform句柄：链接后解析一次，之后每帧按句柄设置，不再做字符串查找；程序中没有的uniform句柄为-1，设置时忽略。
+struct HandUniforms {
+    ShaderProgram::Program::Uniform mvp, basecolor, normal, orm, material_layer;  // 材质相关的仅纹理版本有
+    ShaderProgram::Program::Uniform palettes, models, bone_num, instance_base;  // 仅多实例着色器有
+    ShaderProgram::Program::Uniform position_scale, position_bias, texcoord_transform;  // 仅量化顶点的版本有
+
+    void resolve(const ShaderProgram::Program &program) {
+        mvp = program.uniform("u_mvp");
+        basecolor = program.uniform("u_basecolor");
+        normal = program.uniform("u_normal");
+        orm = program.uniform("u_orm");
+        material_layer = program.uniform("u_material_layer");
+        palettes = program.uniform("u_palettes");
+        models = program.uniform("u_models");
+        bone_num = program.uniform("u_bone_num");
+        instance_base = program.uniform("u_instance_base");
+        position_scale = program.uniform("u_position_scale");
+        position_bias = program.uniform("u_position_bias");
+        texcoord_transform = program.uniform("u_texcoord_transform");
+    }
+};
+
+// ===== 多实例（crowd）模式 =====
+// 每只手有自己的姿态、动作和时间偏移，骨骼矩阵一起写入缓冲纹理，用一次实例化绘制画出所有手。
+#define PALETTE_UNIT 5  // 缓冲纹理中的骨骼（多实例，或单只手使用缓冲纹理存放骨骼时）；纹理单元0-2留给材质贴图，3-4保留。
+#define CROWD_MODEL_UNIT 6
+#define MATERIAL_UNIT 0  // 材质纹理数组占用通道0-2。
+#define CROWD_SPACING 12.0f  // 相邻两只手的间距。
+
+// 一个特化的着色器版本及其uniform句柄。
+struct HandProgram {
+    ShaderProgram::Program *program;
+    HandUniforms uniforms;
+};
+
+// 加载时确定、各个版本共用的特性。
+struct HandFeatures {
+    bool crowd;  // 多实例
+    bool palette_buffer;  // 单只手的骨骼放在缓冲纹理中
+    BonePalette::Encoding encoding;
+    size_t max_bones;  // BonePalette块声明的骨骼数，不超过BonePalette::maxBones(encoding)
+};
+
+// 变换反馈写出的顶点着色器输出，顺序与SkinFeedback::SkinnedVertex一致。
+static const ShaderProgram::FeedbackVaryings skin_feedback_varyings = {"skinned_position", "pass_texcoord",
+                                                                       "skinned_normal"};
+
+// 按特性、纹理模式和影响桶取得特化版本：首次取用时编译，或从程序二进制缓存直接加载；然后设置之后不再变化的输入。
+// capture为true时取只做蒙皮、由变换反馈输出顶点的版本。
+static bool load_hand_program(ShaderProgram::Permutations &permutations, const SkeletalMesh::Scene &scene,
+                              const HandFeatures &features, bool textured, unsigned int bucket,
+                              HandProgram &hand_program, bool capture = false) {
+    bool crowd = features.crowd;
+    BonePalette::Encoding encoding = features.encoding;
+    ShaderProgram::Defines defines;
+    defines.push_back(std::make_pair(std::string("CROWD"), crowd ? 1 : 0));
+    defines.push_back(std::make_pair(std::string("PALETTE_BUFFER"), features.palette_buffer ? 1 : 0));
+    defines.push_back(std::make_pair(std::string("MAX_BONES"),
+                                     (int) glm::clamp<size_t>(features.max_bones, 1, BonePalette::maxBones(encoding))));
+    defines.push_back(std::make_pair(std::string("BONE_INFLUENCES"), (int) SkeletalMesh::bucketInfluenceNum(bucket)));
+    defines.push_back(std::make_pair(std::string("BONE_ENCODING"), (int) encoding));
+    defines.push_back(std::make_pair(std::string("QUANTIZED"),
+                                     scene.getVertexFormat() == SkeletalMesh::VERTEX_FORMAT_QUANTIZED ? 1 : 0));
+    defines.push_back(std::make_pair(std::string("TEXTURE_MAPPING"), textured ? 1 : 0));
+    defines.push_back(std::make_pair(std::string("SKIN_FEEDBACK"), capture ? 1 : 0));
+    ShaderProgram::Program *program = capture ? permutations.get(defines, skin_feedback_varyings)
+                                              : permutations.get(defines);
+    if (!program) return false;
+    std::cout << "Shader variant " << (crowd ? "crowd" : "single")
+              << (capture ? "/capture" : textured ? "/textured" : "/plain") << ": "
+              << SkeletalMesh::bucketInfluenceNum(bucket) << " influences, "
+              << BonePalette::encodingName(encoding) << (crowd || features.palette_buffer ? " buffer" : " uniform")
+              << " palette, "
+              << (program->fromCache() ? "loaded from program binary cache" : "compiled") << std::endl;
+
+    hand_program.program = program;
+    hand_program.uniforms.resolve(*program);
+    program->bindUniformBlock("BonePalette", BONE_PALETTE_BINDING);  // 骨骼矩阵uniform块绑定到固定绑定点；多实例版本没有这个块。
+    program->use();
+    SkeletalMesh::Dequantize dequantize = scene.getDequantize();  // 量化格式的还原参数；完整格式的版本中没有这些uniform。
+    program->set(hand_program.uniforms.position_scale, dequantize.positionScale);
+    program->set(hand_program.uniforms.position_bias, dequantize.positionBias);
+    program->set(hand_program.uniforms.texcoord_transform, dequantize.texcoordTransf);
+    program->set(hand_program.uniforms.basecolor, MATERIAL_UNIT);  // 纹理数组固定在这三个通道，之后不再设置采样器。
+    program->set(hand_program.uniforms.normal, MATERIAL_UNIT + 1);
+    program->set(hand_program.uniforms.orm, MATERIAL_UNIT + 2);
+    program->set(hand_program.uniforms.palettes, PALETTE_UNIT);  // 只有缓冲纹理版本有。
+    return true;
+}
+
+// 取得绘制变换反馈蒙皮结果的版本，只按纹理模式特化。
+static bool load_skinned_program(ShaderProgram::Permutations &permutations, bool textured,
+                                 HandProgram &hand_program) {
+    ShaderProgram::Defines defines;
+    defines.push_back(std::make_pair(std::string("TEXTURE_MAPPING"), textured ? 1 : 0));
+    ShaderProgram::Program *program = permutations.get(defines);
+    if (!program) return false;
+    std::cout << "Shader variant skinned" << (textured ? "/textured" : "/plain") << ": "
+              << (program->fromCache() ? "loaded from program binary cache" : "compiled") << std::endl;
+
+    hand_program.program = program;
+    hand_program.uniforms.resolve(*program);
+    program->use();
+    program->set(hand_program.uniforms.basecolor, MATERIAL_UNIT);
+    program->set(hand_program.uniforms.normal, MATERIAL_UNIT + 1);
+    program->set(hand_program.uniforms.orm, MATERIAL_UNIT + 2);
+    return true;
+}
+
+// 上传单只手的骨骼：写入uniform缓冲环的当前切片并绑定，或按特性写入缓冲纹理并绑定。
+// 缓冲纹理只改写变化的向量[first, first + count)，其余保留上次的内容；uniform缓冲环每帧换一个切片，总是写入整个palette。
+static void upload_hand_palette(const HandFeatures &features, BonePalette::UniformRing &ring,
+                                BonePalette::TextureBufferPalette &buffer, const std::vector<glm::fvec4> &vectors,
+                                size_t first, size_t count) {
+    if (features.palette_buffer) {
+        if (count == vectors.size() || !buffer.update(first, vectors.data() + first, count))
+            buffer.upload(vectors.data(), vectors.size());
+        buffer.bind(PALETTE_UNIT);
+    } else {
+        ring.upload(vectors.data(), vectors.size());
+    }
+}
+
+static void upload_hand_palette(const HandFeatures &features, BonePalette::UniformRing &ring,
+                                BonePalette::TextureBufferPalette &buffer, const std::vector<glm::fvec4> &vectors) {
+    upload_hand_palette(features, ring, buffer, vectors, 0, vectors.size());
+}
+
+// 骨骼与上次上传时相同：重新绑定上次写入的内容，不再复制。uniform缓冲环保留上次写入的切片和偏移。
+static void rebind_hand_palette(const HandFeatures &features, BonePalette::UniformRing &ring,
+                                BonePalette::TextureBufferPalette &buffer) {
+    if (features.palette_buffer)
+        buffer.bind(PALETTE_UNIT);
+    else
+        ring.retain();
+}
+
+// 手势的局部姿态缓存：按动作编号记住除手掌外所有骨骼的局部变换。手指不随时间变化的动作切换过来时
+// 一次设置好，之后每帧只设置手掌的旋转，骨骼变换只重算手掌的子树。
+class GesturePoseCache {
+public:
+    // 把动作的手指姿态设置到pose上；第一次用到时在另一个姿态上按动画计算一次并记住。
+    void apply(SkeletalMesh::SkeletonPose &pose, const SkeletalMesh::Scene &scene, const HandBones &hand,
+               int action) {
+        std::vector<glm::fmat4> &modifiers = gestures[action];
+        if (modifiers.empty()) {
+            SkeletalMesh::SkeletonPose scratch;
+            scene.initPose(scratch);
+            animateHand(scratch, hand, action, 0.0f);
+            modifiers.resize(scratch.boneNum());
+            for (size_t i = 0; i < modifiers.size(); i++) modifiers[i] = scratch.get((SkeletalMesh::BoneHandle) i);
+        }
+        for (size_t i = 0; i < modifiers.size(); i++)
+            if ((SkeletalMesh::BoneHandle) i != hand.metacarpals) pose.set((SkeletalMesh::BoneHandle) i, modifiers[i]);
+    }
+
+private:
+    std::map<int, std::vector<glm::fmat4> > gestures;
+};
+
+// 切换到一个着色器版本并设置每帧变化的uniform；与上次设置的值相同时不会重新上传。不采样纹理的版本没有层号。
+static ShaderProgram::Program &use_hand_program(HandProgram &hand_program, const glm::fmat4 &mvp,
+                                                GLint material_layer) {
+    ShaderProgram::Program &program = *hand_program.program;
+    program.use();
+    program.set(hand_program.uniforms.mvp, mvp);
+    program.set(hand_program.uniforms.material_layer, material_layer);
+    return program;
+}
+
+struct CrowdInstance {
+    SkeletalMesh::SkeletonPose pose;
+    int action;
+    float time_offset;
+};
+
+// 把n只手排成方阵，动作0-11轮流分配。
+static void layout_crowd(std::vector<CrowdInstance> &crowd, std::vector<glm::fmat4> &models,
+                         const SkeletalMesh::Scene &scene, int n) {
+    crowd.resize(n);
+    models.resize(n);
+    int side = (int) ceil(sqrt((double) n));
+    for (int i = 0; i < n; i++) {
+        scene.initPose(crowd[i].pose);
+        crowd[i].action = i % 12;
+        crowd[i].time_offset = fmod(i * 0.37f, 8.0f);
+        float x = (i % side - (side - 1) * 0.5f) * CROWD_SPACING;
+        float z = (i / side - (side - 1) * 0.5f) * CROWD_SPACING;
+        models[i] = glm::translate(glm::identity<glm::mat4>(), glm::fvec3(x, 0.0f, z));
+    }
+}
+
+// 计算所有实例的姿态，并把骨骼按encoding编码后连续写入palettes（每个实例scene.boneNum()根骨骼）。
+// 实例分批交给线程池，各批只写自己的那段palettes，主线程只等待计数器归零；每批的骨骼矩阵用向量化的批量合成一起计算。
+// order不为空时，第k段palettes属于实例order[k]（按LOD分组后的顺序）。
+static void update_crowd(std::vector<CrowdInstance> &crowd, const SkeletalMesh::Scene &scene, const HandBones &hand,
+                         float time, BonePalette::Encoding encoding, glm::fvec4 *palettes,
+                         const unsigned int *order = nullptr) {
+    size_t bone_num = scene.boneNum();
+    size_t palette_size = bone_num * BonePalette::vectorNum(encoding);
+    size_t batch_size = crowd.size() / (JobSystem::threadNum() * 4) + 1;  // 每个线程约4批，便于窃取平衡负载。
+    if (batch_size < 16) batch_size = 16;
+    JobSystem::Counter counter;
+    JobSystem::parallelFor(crowd.size(), batch_size, [&](size_t begin, size_t end) {
+        std::vector<SkeletalMesh::SkeletonPose *> poses(end - begin);
+        for (size_t k = begin; k < end; k++) {
+            CrowdInstance &instance = crowd[order ? order[k] : k];
+            animateHand(instance.pose, hand, instance.action, time + instance.time_offset);
+            poses[k - begin] = &instance.pose;
+        }
+        scene.getSkeletonTransforms(poses.data(), poses.size());
+        for (size_t k = begin; k < end; k++)
+            BonePalette::encode(encoding, poses[k - begin]->getPalette().data(), bone_num, palettes + k * palette_size);
+    }, counter);
+    JobSystem::wait(counter);
+}
+
+// 按每只手到相机的距离选择LOD，并把实例按LOD分组：order依次存放各组的实例下标，
+// 第l组是order[lod_first[l], lod_first[l + 1])。pixels_at_unit_distance是距离为1时每单位长度占的像素数。
+static void select_crowd_lods(const std::vector<glm::fmat4> &models, const SkeletalMesh::Scene &scene,
+                              const glm::fvec3 &eye, float pixels_at_unit_distance,
+                              std::vector<unsigned int> &order, std::vector<unsigned int> &lod_first) {
+    size_t lod_num = scene.lodNum() ? scene.lodNum() : 1;
+    std::vector<unsigned int> lods(models.size());
+    lod_first.assign(lod_num + 1, 0);
+    for (size_t i = 0; i < models.size(); i++) {
+        float distance = glm::max(glm::length(glm::fvec3(models[i][3]) - eye), 1e-3f);
+        lods[i] = scene.selectLod(pixels_at_unit_distance / distance);
+        lod_first[lods[i] + 1]++;
+    }
+    for (size_t l = 0; l < lod_num; l++) lod_first[l + 1] += lod_first[l];
+    std::vector<unsigned int> cursor(lod_first.begin(), lod_first.end() - 1);
+    order.resize(models.size());
+    for (size_t i = 0; i < models.size(); i++) order[cursor[lods[i]]++] = (unsigned int) i;
+}
+
+static void bind_crowd(ShaderProgram::Program &program, const HandUniforms &uniforms,
+                       const SkeletalMesh::Scene &scene,
+                       const BonePalette::TextureBufferPalette &palettes,
+                       const BonePalette::TextureBufferPalette &models) {
+    palettes.bind(PALETTE_UNIT);
+    models.bind(CROWD_MODEL_UNIT);
+    program.set(uniforms.models, CROWD_MODEL_UNIT);
+    program.set(uniforms.bone_num, (GLint) scene.boneNum());
+}
+
+// 画出一组同一LOD的实例（缓冲纹理中从instance_base开始的count个）：每个非空的影响桶切换到相应的着色器版本，
+// 这个桶的网格条目放进绘制列表按材质排序后提交，支持间接绘制时一个桶一次调用。
+static void render_crowd_group(HandProgram *programs, const SkeletalMesh::Scene &scene,
+                               const BonePalette::TextureBufferPalette &palettes,
+                               const BonePalette::TextureBufferPalette &models,
+                               const glm::fmat4 &view_projection, GLint material_layer,
+                               unsigned int lod, GLint instance_base, GLsizei count, SkeletalMesh::DrawList &draws) {
+    for (unsigned int bucket = 0; bucket < SCENE_INFLUENCE_BUCKET_NUM; bucket++) {
+        draws.clear();
+        draws.add(scene, lod, count, bucket);
+        if (!draws.entryNum()) continue;
+        ShaderProgram::Program &program = use_hand_program(programs[bucket], view_projection, material_layer);
+        bind_crowd(program, programs[bucket].uniforms, scene, palettes, models);
+        program.set(programs[bucket].uniforms.instance_base, instance_base);
+        draws.submit();
+    }
+}
+
+// 基准测试：实例数从1增加到10000，分别统计姿态计算、骨骼矩阵上传和整帧（含GPU完成）的平均耗时。
+static void run_crowd_benchmark(GLFWwindow *window, HandProgram *programs, BonePalette::Encoding encoding,
+                                const SkeletalMesh::Scene &scene, const HandBones &hand) {
+    const int crowd_sizes[] = {1, 10, 100, 1000, 10000};
+    const int warmup_frames = 10;
+    const int measured_frames = 100;
+
+    BonePalette::TextureBufferPalette palettes, models;
+    size_t palette_size = scene.boneNum() * BonePalette::vectorNum(encoding);  // 每个实例的vec4个数。
+    palettes.initialize(palette_size);
+    models.initialize(4);
+    SkeletalMesh::DrawList draws;
+
+    glm::fmat4 view_projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 2000.0f) *
+                                 glm::lookAt(glm::fvec3(0.0f, 400.0f, 600.0f), glm::fvec3(0.0f),
+                                             glm::fvec3(0.0f, 1.0f, 0.0f));
+    GLState::setDepthTest(true);
+
+    std::cout << "Pose threads: " << JobSystem::threadNum() << ", palette encoding: "
+              << BonePalette::encodingName(encoding) << std::endl;
+    std::cout << "instances, pose ms, upload ms, frame ms, hands per second" << std::endl;
+    for (int crowd_size : crowd_sizes) {
+        std::vector<CrowdInstance> crowd;
+        std::vector<glm::fmat4> model_matrices;
+        layout_crowd(crowd, model_matrices, scene, crowd_size);
+        models.upload(model_matrices.data(), model_matrices.size());
+        std::vector<glm::fvec4> palette_data(crowd_size * palette_size);
+
+        double pose_time = 0.0, upload_time = 0.0, frame_time = 0.0;
+        for (int frame = 0; frame < warmup_frames + measured_frames; frame++) {
+            double t0 = glfwGetTime();
+            update_crowd(crowd, scene, hand, frame / 60.0f, encoding, palette_data.data());
+            double t1 = glfwGetTime();
+            palettes.upload(palette_data.data(), palette_data.size());
+            double t2 = glfwGetTime();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            render_crowd_group(programs, scene, palettes, models, view_projection, 0, 0, 0, crowd_size, draws);
+            glFinish();  // 等待GPU完成，使整帧时间包含顶点处理。
+            double t3 = glfwGetTime();
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+            if (frame >= warmup_frames) {
+                pose_time += t1 - t0;
+                upload_time += t2 - t1;
+                frame_time += t3 - t0;
+            }
+        }
+        std::cout << crowd_size << ", "
+                  << pose_time * 1000.0 / measured_frames << ", "
+                  << upload_time * 1000.0 / measured_frames << ", "
+                  << frame_time * 1000.0 / measured_frames << ", "
+                  << crowd_size * measured_frames / frame_time << std::endl;
+    }
+}
+
+// 基准测试用的顶点：完整格式，骨骼编号可以超过量化格式的8位。
+struct PaletteBenchVertex {
+    float position[3];
+    float normal[3];
+    GLint bone_id[SCENE_RESOURCE_BONE_PER_VERTEX];
+    float bone_weight[SCENE_RESOURCE_BONE_PER_VERTEX];
+};
+
+// 用模型的顶点（CPU副本）生成基准测试的顶点数组，共用模型的索引缓冲：第v个顶点的骨骼编号加上
+// (v % copies) * 模型骨骼数，copies = bone_num / 模型骨骼数，使取用分散到palette的全部copies份骨骼上。
+static void build_palette_bench_vertices(const SkeletalMesh::Scene &scene, size_t bone_num, GLuint vao, GLuint vbo) {
+    const CpuSkinning::Mesh &mesh = scene.getSkinningMesh();
+    size_t copies = bone_num / scene.boneNum();
+    std::vector<PaletteBenchVertex> vertices(mesh.vertexNum);
+    for (size_t v = 0; v < mesh.vertexNum; v++) {
+        PaletteBenchVertex &vertex = vertices[v];
+        for (int c = 0; c < 3; c++) {
+            vertex.position[c] = mesh.position[c][v];
+            vertex.normal[c] = mesh.normal[c][v];
+        }
+        for (int k = 0; k < SCENE_RESOURCE_BONE_PER_VERTEX; k++) {
+            bool used = k < CPU_SKINNING_INFLUENCES && (unsigned int) k < mesh.influenceNum;
+            vertex.bone_id[k] = used ? (GLint) (mesh.boneId[k][v] + (v % copies) * scene.boneNum()) : 0;
+            vertex.bone_weight[k] = used ? mesh.weight[k][v] : 0.0f;
+        }
+    }
+
+    GLState::bindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(PaletteBenchVertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene.indexBuffer());
+    GLsizei stride = sizeof(PaletteBenchVertex);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (const void *) offsetof(PaletteBenchVertex, position));
+    glDisableVertexAttribArray(1);  // 纹理坐标取常量
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (const void *) offsetof(PaletteBenchVertex, normal));
+    glEnableVertexAttribArray(3);
+    glVertexAttribIPointer(3, SCENE_RESOURCE_BONE_PER_VERTEX, GL_INT, stride,
+                           (const void *) offsetof(PaletteBenchVertex, bone_id));
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, SCENE_RESOURCE_BONE_PER_VERTEX, GL_FLOAT, GL_FALSE, stride,
+                          (const void *) offsetof(PaletteBenchVertex, bone_weight));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// 基准测试：比较uniform块和缓冲纹理两种骨骼存放方式在不同骨骼数下的上传和取用耗时。
+// 骨骼数不少于模型的骨骼数，palette由模型姿态的多份拷贝组成，顶点的骨骼编号按顶点分散到各份拷贝上，
+// 所以取用确实覆盖bone_num个不同的骨骼，而画出的形状不变；uniform块只测到BonePalette::maxBones(encoding)。
+// 每帧画palette_draws次手，所有影响桶用读4个权重的版本一次画完，GPU时间用GL_TIME_ELAPSED查询统计。
+static void run_palette_benchmark(GLFWwindow *window, ShaderProgram::Permutations &permutations,
+                                  BonePalette::UniformRing &ring, BonePalette::Encoding encoding,
+                                  const SkeletalMesh::Scene &scene) {
+    const size_t bone_nums[] = {32, 64, 100, 133, 200, 1000, 4000};
+    const int palette_draws = 100;
+    const int warmup_frames = 10;
+    const int measured_frames = 100;
+
+    SkeletalMesh::SkeletonPose pose;
+    scene.initPose(pose);
+    scene.getSkeletonTransform(pose);
+    const SkeletalMesh::Scene::SkeletonTransf &pose_palette = pose.getPalette();
+    if (pose_palette.empty()) return;
+    if (scene.getSkinningMesh().vertexNum != scene.getVertexNum()) {
+        std::cout << "Palette benchmark needs the CPU copy of the vertices" << std::endl;
+        return;
+    }
+    GLuint bench_vao, bench_vbo;
+    glGenVertexArrays(1, &bench_vao);
+    glGenBuffers(1, &bench_vbo);
+
+    glm::fmat4 view_projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 2000.0f) *
+                                 glm::lookAt(glm::fvec3(0.0f, 0.0f, 60.0f), glm::fvec3(0.0f),
+                                             glm::fvec3(0.0f, 1.0f, 0.0f));
+    GLState::setDepthTest(true);
+    BonePalette::TextureBufferPalette buffer_palette;
+    GLuint query;
+    glGenQueries(1, &query);
+
+    std::cout << "Palette encoding: " << BonePalette::encodingName(encoding) << ", " << scene.boneNum()
+              << " bones referenced, " << palette_draws << " draws per frame" << std::endl;
+    std::cout << "bones, storage, upload us, gpu ms, gpu us per draw" << std::endl;
+    for (size_t bone_num : bone_nums) {
+        if (bone_num < scene.boneNum()) continue;
+        std::vector<glm::fmat4> palette(bone_num);
+        for (size_t i = 0; i < bone_num; i++) palette[i] = pose_palette[i % pose_palette.size()];
+        std::vector<glm::fvec4> vectors(bone_num * BonePalette::vectorNum(encoding));
+        BonePalette::encode(encoding, palette.data(), bone_num, vectors.data());
+        build_palette_bench_vertices(scene, bone_num, bench_vao, bench_vbo);
+
+        for (int buffer = 0; buffer < 2; buffer++) {
+            if (!buffer && bone_num > BonePalette::maxBones(encoding)) continue;
+            if (buffer && !buffer_palette.initialize(vectors.size())) break;
+            HandFeatures features = {false, buffer != 0, encoding, bone_num};
+            HandProgram program = {};
+            if (!load_hand_program(permutations, scene, features, false, SCENE_INFLUENCE_BUCKET_NUM - 1, program))
+                continue;
+            // 顶点已是完整格式，量化版本的还原参数设为恒等。
+            program.program->set(program.uniforms.position_scale, glm::fvec3(1.0f));
+            program.program->set(program.uniforms.position_bias, glm::fvec3(0.0f));
+
+            double upload_time = 0.0;
+            GLuint64 gpu_time = 0;
+            for (int frame = 0; frame < warmup_frames + measured_frames; frame++) {
+                ring.beginFrame();
+                double t0 = glfwGetTime();
+                if (buffer) {
+                    buffer_palette.upload(vectors.data(), vectors.size());
+                    buffer_palette.bind(PALETTE_UNIT);
+                } else {
+                    ring.upload(vectors.data(), vectors.size());
+                }
+                double t1 = glfwGetTime();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                glBeginQuery(GL_TIME_ELAPSED, query);
+                use_hand_program(program, view_projection, 0);
+                for (int draw = 0; draw < palette_draws; draw++)
+                    scene.renderFrom(bench_vao, 0);
+                glEndQuery(GL_TIME_ELAPSED);
+                ring.endFrame();
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);  // 等待GPU完成这一帧的绘制。
+                glfwSwapBuffers(window);
+                glfwPollEvents();
+                if (frame >= warmup_frames) {
+                    upload_time += t1 - t0;
+                    gpu_time += elapsed;
+                }
+            }
+            double gpu_ms = gpu_time / 1e6 / measured_frames;
+            std::cout << bone_num << ", " << (buffer ? "buffer" : "uniform") << ", "
+                      << upload_time * 1e6 / measured_frames << ", "
+                      << gpu_ms << ", "
+                      << gpu_ms * 1000.0 / palette_draws << std::endl;
+        }
+    }
+    glDeleteQueries(1, &query);
+    GLState::deleteVertexArray(bench_vao);
+    glDeleteBuffers(1, &bench_vbo);
+}
+
+// 基准测试：绘制遍数从1增加到8，比较每遍都在顶点着色器中蒙皮，和变换反馈蒙皮一次、各遍只做投影两种方式。
+// 测量时丢弃光栅化，GL_TIME_ELAPSED查询只包含顶点阶段。
+static void run_feedback_benchmark(GLFWwindow *window, HandProgram *programs, HandProgram &capture,
+                                   HandProgram &skinned, SkinFeedback::SkinnedBuffer &skinned_buffer,
+                                   const HandFeatures &features, BonePalette::UniformRing &ring,
+                                   BonePalette::TextureBufferPalette &buffer, const SkeletalMesh::Scene &scene) {
+    const int pass_nums[] = {1, 2, 3, 4, 6, 8};
+    const int warmup_frames = 10;
+    const int measured_frames = 100;
+
+    SkeletalMesh::SkeletonPose pose;
+    scene.initPose(pose);
+    scene.getSkeletonTransform(pose);
+    const SkeletalMesh::Scene::SkeletonTransf &palette = pose.getPalette();
+    std::vector<glm::fvec4> vectors(palette.size() * BonePalette::vectorNum(features.encoding));
+    BonePalette::encode(features.encoding, palette.data(), palette.size(), vectors.data());
+
+    glm::fmat4 view_projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 2000.0f) *
+                                 glm::lookAt(glm::fvec3(0.0f, 0.0f, 60.0f), glm::fvec3(0.0f),
+                                             glm::fvec3(0.0f, 1.0f, 0.0f));
+    GLuint query;
+    glGenQueries(1, &query);
+
+    std::cout << scene.getVertexNum() << " vertices skinned per capture, " << scene.lodTriangleNum(0)
+              << " triangles per pass" << std::endl;
+    std::cout << "passes, skin per pass us, feedback us, of which capture us" << std::endl;
+    for (int pass_num : pass_nums) {
+        GLuint64 direct_time = 0, capture_time = 0, draw_time = 0;
+        for (int frame = 0; frame < warmup_frames + measured_frames; frame++) {
+            ring.beginFrame();
+            upload_hand_palette(features, ring, buffer, vectors);
+            GLuint64 elapsed[3] = {0, 0, 0};
+
+            glEnable(GL_RASTERIZER_DISCARD);
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            for (int pass = 0; pass < pass_num; pass++)
+                for (unsigned int bucket = 0; bucket < SCENE_INFLUENCE_BUCKET_NUM; bucket++) {
+                    if (!programs[bucket].program) continue;
+                    use_hand_program(programs[bucket], view_projection, 0);
+                    scene.renderBucket(0, bucket);
+                }
+            glEndQuery(GL_TIME_ELAPSED);
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed[0]);
+
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            use_hand_program(capture, view_projection, 0);
+            skinned_buffer.beginCapture();
+            scene.renderPoints();
+            skinned_buffer.endCapture();
+            glEndQuery(GL_TIME_ELAPSED);
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed[1]);
+
+            glEnable(GL_RASTERIZER_DISCARD);  // endCapture()恢复了光栅化。
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            for (int pass = 0; pass < pass_num; pass++) {
+                use_hand_program(skinned, view_projection, 0);
+                scene.renderFrom(skinned_buffer.vertexArray(), 0);
+            }
+            glEndQuery(GL_TIME_ELAPSED);
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed[2]);
+            glDisable(GL_RASTERIZER_DISCARD);
+            ring.endFrame();
+
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+            if (frame >= warmup_frames) {
+                direct_time += elapsed[0];
+                capture_time += elapsed[1];
+                draw_time += elapsed[2];
+            }
+        }
+        std::cout << pass_num << ", "
+                  << direct_time / 1e3 / measured_frames << ", "
+                  << (capture_time + draw_time) / 1e3 / measured_frames << ", "
+                  << capture_time / 1e3 / measured_frames << std::endl;
+    }
+    glDeleteQueries(1, &query);
+}
+
+// 校验CPU蒙皮：12个动作各取一个姿态，GPU用变换反馈蒙皮后读回，与每种CPU内核的结果逐顶点比较。
+// 位置误差相对于蒙皮后包围盒的对角线，法线误差为1 - cos夹角。CPU按矩阵线性混合，对偶四元数编码不做校验。
+static bool run_skinning_validation(const SkeletalMesh::Scene &scene, const HandBones &hand, HandProgram &capture,
+                                    SkinFeedback::SkinnedBuffer &skinned_buffer, const HandFeatures &features,
+                                    BonePalette::UniformRing &ring, BonePalette::TextureBufferPalette &buffer) {
+    const float position_tolerance = 1e-4f;
+    const float normal_tolerance = 1e-3f;
+    const int action_num = 12;
+
+    const CpuSkinning::Mesh &mesh = scene.getSkinningMesh();
+    if (features.encoding == BonePalette::ENCODING_DUAL_QUATERNION) {
+        std::cout << "CPU skinning blends matrices, validate with --palette matrix or affine" << std::endl;
+        return false;
+    }
+    if (!skinned_buffer.isValid() || mesh.vertexNum != scene.getVertexNum()) {
+        std::cout << "Skinning validation needs transform feedback skinning of a single hand" << std::endl;
+        return false;
+    }
+
+    SkeletalMesh::SkeletonPose pose;
+    scene.initPose(pose);
+    std::vector<glm::fvec4> vectors;
+    std::vector<SkinFeedback::SkinnedVertex> gpu;
+    CpuSkinning::Output cpu;
+    bool matched = true;
+    std::cout << "Validating " << mesh.vertexNum << " vertices against the GPU" << std::endl;
+    std::cout << "action, kernel, max position error, max normal error" << std::endl;
+    for (int action = 0; action < action_num; action++) {
+        animateHand(pose, hand, action, 1.0f);
+        scene.getSkeletonTransform(pose);
+        const SkeletalMesh::Scene::SkeletonTransf &palette = pose.getPalette();
+        vectors.resize(palette.size() * BonePalette::vectorNum(features.encoding));
+        BonePalette::encode(features.encoding, palette.data(), palette.size(), vectors.data());
+
+        ring.beginFrame();
+        upload_hand_palette(features, ring, buffer, vectors);
+        use_hand_program(capture, glm::fmat4(1.0f), 0);
+        skinned_buffer.beginCapture();
+        scene.renderPoints();
+        skinned_buffer.endCapture();
+        ring.endFrame();
+        skinned_buffer.read(gpu);
+
+        for (int kernel = 0; kernel < CpuSkinning::KERNEL_NUM; kernel++) {
+            if (!CpuSkinning::kernelSupported((CpuSkinning::Kernel) kernel)) continue;
+            CpuSkinning::skin(mesh, palette.data(), palette.size(), cpu, (CpuSkinning::Kernel) kernel);
+            glm::fvec3 lower, upper;
+            if (!CpuSkinning::bounds(cpu, lower, upper)) continue;
+            float extent = glm::max(glm::length(upper - lower), 1e-6f);
+            float position_error = 0.0f, normal_error = 0.0f;
+            for (size_t v = 0; v < mesh.vertexNum; v++) {
+                glm::fvec3 position(cpu.position[0][v], cpu.position[1][v], cpu.position[2][v]);
+                glm::fvec3 normal(cpu.normal[0][v], cpu.normal[1][v], cpu.normal[2][v]);
+                position_error = glm::max(position_error,
+                                          glm::length(position - glm::make_vec3(gpu[v].position)) / extent);
+                if (glm::dot(normal, normal) > 0.0f)  // 零长度的法线在GPU上归一化的结果未定义。
+                    normal_error = glm::max(normal_error, 1.0f - glm::dot(normal, glm::make_vec3(gpu[v].normal)));
+            }
+            std::cout << action << ", " << CpuSkinning::kernelName((CpuSkinning::Kernel) kernel) << ", "
+                      << position_error << ", " << normal_error << std::endl;
+            if (!(position_error <= position_tolerance && normal_error <= normal_tolerance)) matched = false;
+        }
+    }
+    std::cout << (matched ? "CPU skinning matches the GPU" : "CPU skinning differs from the GPU") << std::endl;
+    return matched;
 }
 
+// 基准测试：每种CPU内核分别在单线程和全部线程上蒙皮一批手，输出每秒顶点数和每个线程每秒顶点数。
+static void run_skinning_benchmark(const SkeletalMesh::Scene &scene, const HandBones &hand) {
+    const size_t hand_num = 256;  // 每次蒙皮的手数，多线程时按手分给各线程。
+    const double min_time = 0.5;  // 每项至少测量的秒数。
+
+    const CpuSkinning::Mesh &mesh = scene.getSkinningMesh();
+    SkeletalMesh::SkeletonPose pose;
+    scene.initPose(pose);
+    animateHand(pose, hand, 10, 1.0f);
+    scene.getSkeletonTransform(pose);
+    const SkeletalMesh::Scene::SkeletonTransf &palette = pose.getPalette();
+    if (mesh.vertexNum == 0 || palette.empty()) return;
+
+    std::vector<CpuSkinning::Output> outputs(hand_num);
+    std::cout << mesh.vertexNum << " vertices, " << mesh.influenceNum << " influences, " << hand_num
+              << " hands per run, best kernel " << CpuSkinning::kernelName(CpuSkinning::bestKernel()) << std::endl;
+    std::cout << "kernel, threads, Mvertices per second, per thread" << std::endl;
+    for (int k = 0; k < CpuSkinning::KERNEL_NUM; k++) {
+        CpuSkinning::Kernel kernel = (CpuSkinning::Kernel) k;
+        if (!CpuSkinning::kernelSupported(kernel)) continue;
+        for (int parallel = 0; parallel < 2; parallel++) {
+            unsigned threads = parallel ? JobSystem::threadNum() : 1;
+            if (parallel && threads == 1) continue;
+            JobSystem::RangeTask skin_hands = [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                    CpuSkinning::skin(mesh, palette.data(), palette.size(), outputs[i], kernel, false);
+            };
+            size_t runs = 0;
+            double start = glfwGetTime(), elapsed;
+            do {
+                if (parallel) {
+                    JobSystem::Counter counter;
+                    JobSystem::parallelFor(hand_num, 1, skin_hands, counter);
+                    JobSystem::wait(counter);
+                } else {
+                    skin_hands(0, hand_num);
+                }
+                runs++;
+                elapsed = glfwGetTime() - start;
+            } while (elapsed < min_time);
+            double rate = (double) mesh.vertexNum * hand_num * runs / elapsed / 1e6;
+            std::cout << CpuSkinning::kernelName(kernel) << ", " << threads << ", " << rate << ", "
+                      << rate / threads << std::endl;
+        }
+    }
+}
+
+#define GL_STATS_FRAME 100  // 在这一帧输出GL状态调用统计。
+
 int main(int argc, char *argv[]) {  // 主函数，程序入口。
     GLFWwindow *window;  // GLFW窗口指针。
-    GLuint vertex_shader, fragment_shader, program;  // OpenGL着色器和程序对象。
+    // 手部着色器的特化版本，加载模型后按模型的骨骼数和顶点格式生成，每个影响桶一个。
+    ShaderProgram::Permutations handPrograms(SkeletalAnimation::vertex_shader_330,
+                                             SkeletalAnimation::fragment_shader_330);
+    HandProgram plainPrograms[SCENE_INFLUENCE_BUCKET_NUM] = {};  // 不采样纹理的版本，按影响桶下标；没有三角形的桶为空。
+    HandProgram texturedPrograms[SCENE_INFLUENCE_BUCKET_NUM] = {};  // 采样材质纹理数组的版本。
+    // 绘制变换反馈蒙皮结果的版本。
+    ShaderProgram::Permutations skinnedPrograms(SkeletalAnimation::skinned_vertex_shader_330,
+                                                SkeletalAnimation::fragment_shader_330);
+#ifdef DIFFUSE_TEXTURE_MAPPING
+    const bool texture_mapping = true;
+#else
+    const bool texture_mapping = false;
+#endif
+
+    // ===== 命令行参数 =====
+    // --crowd N：多实例模式，一次实例化绘制N只手；--bench-crowd：运行多实例基准测试后退出。
+    // --threads N：计算姿态的线程数（含主线程），默认每个核心一个，1表示串行。
+    // --quantize-vertices：使用24字节的量化顶点格式（原为64字节），减少顶点缓冲大小和顶点读取带宽。
+    // --palette matrix|affine|dq：骨骼的存放方式，默认4x4矩阵；3x4仿射矩阵少传1/4，对偶四元数少传一半并避免扭转时的塌缩。
+    // --palette-storage uniform|buffer：单只手的骨骼放在uniform块（默认，超出容量时自动改用缓冲纹理）或缓冲纹理中。
+    // --bench-palette：比较两种存放方式在不同骨骼数下的耗时后退出。
+    // --skin-feedback：单只手每帧用变换反馈蒙皮一次，绘制遍从蒙皮结果读取顶点；--bench-feedback：比较两种方式随绘制遍数增加的顶点阶段耗时后退出。
+    // --validate-skinning：比较CPU蒙皮和GPU蒙皮的结果后退出，不一致时返回失败；--bench-skinning：测量CPU蒙皮各内核的吞吐量后退出。
+    int crowd_size = 0;
+    bool bench_crowd = false;
+    int thread_num = 0;
+    bool quantize_vertices = false;
+    BonePalette::Encoding palette_encoding = BonePalette::ENCODING_MATRIX;
+    bool palette_buffer = false;
+    bool bench_palette = false;
+    bool skin_feedback = false;
+    bool bench_feedback = false;
+    bool validate_skinning = false;
+    bool bench_skinning = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--crowd" && i + 1 < argc)
+            crowd_size = atoi(argv[++i]);
+        else if (arg == "--bench-crowd")
+            bench_crowd = true;
+        else if (arg == "--threads" && i + 1 < argc)
+            thread_num = atoi(argv[++i]);
+        else if (arg == "--quantize-vertices")
+            quantize_vertices = true;
+        else if (arg == "--palette" && i + 1 < argc) {
+            if (!BonePalette::parseEncoding(argv[++i], palette_encoding))
+                std::cout << "Unknown palette encoding " << argv[i] << ", expected matrix, affine or dq" << std::endl;
+        } else if (arg == "--palette-storage" && i + 1 < argc) {
+            std::string storage = argv[++i];
+            if (storage == "buffer" || storage == "uniform")
+                palette_buffer = storage == "buffer";
+            else
+                std::cout << "Unknown palette storage " << storage << ", expected uniform or buffer" << std::endl;
+        } else if (arg == "--bench-palette")
+            bench_palette = true;
+        else if (arg == "--skin-feedback")
+            skin_feedback = true;
+        else if (arg == "--bench-feedback")
+            bench_feedback = true;
+        else if (arg == "--validate-skinning")
+            validate_skinning = true;
+        else if (arg == "--bench-skinning")
+            bench_skinning = true;
+    }
+    JobSystem::initialize(thread_num > 0 ? thread_num : 0);
+    atexit(JobSystem::shutdown);  // 所有exit()路径都先回收工作线程。
 
     // ===== 初始化 GLFW 和窗口 =====
     glfwSetErrorCallback(error_callback);  // 设置GLFW错误回调。
@@ -337,30 +1578,27 @@ int main(int argc, char *argv[]) {  // 主函数，程序入口。
     if (glewInit() != GLEW_OK)  // 初始化GLEW库。
         exit(EXIT_FAILURE);  // 如果失败，退出。
 
-    // ===== 加载和编译着色器 =====
-
-    vertex_shader = glCreateShader(GL_VERTEX_SHADER);  // 创建顶点着色器对象。
-    glShaderSource(vertex_shader, 1, &SkeletalAnimation::vertex_shader_330, NULL);  // 设置着色器源码。
-    glCompileShader(vertex_shader);  // 编译顶点着色器。
-
-    fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);  // 创建片段着色器对象。
-    glShaderSource(fragment_shader, 1, &SkeletalAnimation::fragment_shader_330, NULL);  // 设置着色器源码。
-    glCompileShader(fragment_shader);  // 编译片段着色器。
-
-    program = glCreateProgram();  // 创建着色器程序对象。
-    glAttachShader(program, vertex_shader);  // 附加顶点着色器。
-    glAttachShader(program, fragment_shader);  // 附加片段着色器。
-    glLinkProgram(program);  // 链接程序。
-
-    int linkStatus;  // 链接状态。
-    if (glGetProgramiv(program, GL_LINK_STATUS, &linkStatus), linkStatus == GL_FALSE)  // 检查链接是否成功。
-        std::cout << "Error occured in glLinkProgram()" << std::endl;  // 如果失败，输出错误。
+    // 骨骼矩阵uniform块的三个切片轮流写入，避免等待GPU读完上一帧。
+    BonePalette::UniformRing paletteRing;
+    if (!paletteRing.initialize(BONE_PALETTE_BINDING, sizeof(glm::fvec4) * BONE_PALETTE_MAX_VECTORS, 1))
+        std::cout << "Error occured in BonePalette::UniformRing::initialize()" << std::endl;
+    std::vector<glm::fvec4> paletteVectors;  // 按palette_encoding编码后的骨骼，也是上次上传的内容。
+    GesturePoseCache gestureCache;
+    int posed_action = -1;  // pose中的手指姿态属于哪个动作，-1为还没有设置
+    bool palette_uploaded = false;  // uploaded_action和uploaded_time是否有效
+    int uploaded_action = 0;
+    float uploaded_time = 0.0f;
 
     // ===== 加载模型 =====
     // 你可以在这里切换加载不同的模型文件来测试纹理
     // 当前加载的是原始的Hand.fbxmano-hand-cyborg
     //SkeletalMesh::Scene &sr = SkeletalMesh::Scene::loadScene("Mano_Hand_Cyborg", DATA_DIR"/Mano_Hand_Cyborg.fbx");  // 加载手部模型场景，从FBX文件中读取。
     // 当前加载的是原始的Hand.fbx
+    SkeletalMesh::Scene::cacheDirectory = CACHE_DIR;  // 首次导入后写入烘焙缓存，之后启动直接映射缓存，跳过Assimp解析。
+    if (quantize_vertices)  // 烘焙缓存仍保存完整顶点，上传时再量化。
+        SkeletalMesh::Scene::preferredVertexFormat = SkeletalMesh::VERTEX_FORMAT_QUANTIZED;
+    if (validate_skinning || bench_skinning || bench_palette)  // 保留顶点的CPU副本。
+        SkeletalMesh::Scene::keepSkinningMesh = true;
     SkeletalMesh::Scene &sr = SkeletalMesh::Scene::loadScene("Hand", DATA_DIR"/Hand.fbx");  // 加载原始手部模型场景，从FBX文件中读取。
 
     if (&sr == &SkeletalMesh::Scene::error)  // 如果加载失败。
@@ -370,20 +1608,32 @@ int main(int argc, char *argv[]) {  // 主函数，程序入口。
     }
 
     // ===== 加载纹理 =====
+    // 异步加载：立即返回占位纹理，解码在线程池中进行，主循环中每帧通过PBO上传已解码的图像。
+    // 首次加载时压缩成BC格式并烘焙mip链写入缓存，之后启动直接上传压缩数据。
+    TextureImage::Texture::cacheDirectory = CACHE_DIR;
     // 加载mano-hand-cyborg的各种纹理 (纹理0)
-    TextureImage::Texture &manoBaseColorTex = TextureImage::Texture::loadTexture("mano_basecolor", DATA_DIR"/ManoHand_Cyborg_BaseColor.jpeg");
-    TextureImage::Texture &manoMetallicTex = TextureImage::Texture::loadTexture("mano_metallic", DATA_DIR"/ManoHand_Cyborg_Metallic.jpeg");
-    TextureImage::Texture &manoNormalTex = TextureImage::Texture::loadTexture("mano_normal", DATA_DIR"/ManoHand_Cyborg_Normal.jpeg");
-
-    TextureImage::Texture &manoRoughnessTex = TextureImage::Texture::loadTexture("mano_roughness", DATA_DIR"/ManoHand_Cyborg_Roughness.jpg");
-    TextureImage::Texture &manoAoTex = TextureImage::Texture::loadTexture("mano_ao", DATA_DIR"/ManoHand_Cyborg_ao.jpeg");
+    TextureImage::Texture &manoBaseColorTex = TextureImage::Texture::loadTextureAsync("mano_basecolor", DATA_DIR"/ManoHand_Cyborg_BaseColor.jpeg");
+    TextureImage::Texture &manoNormalTex = TextureImage::Texture::loadTextureAsync("mano_normal", DATA_DIR"/ManoHand_Cyborg_Normal.jpeg", TextureCook::USAGE_NORMAL);
+    // AO、粗糙度、金属度打包成一张ORM纹理。
+    TextureImage::Texture &manoOrmTex = TextureImage::Texture::loadPackedTextureAsync("mano_orm",
+                                                                                      DATA_DIR"/ManoHand_Cyborg_ao.jpeg",
+                                                                                      DATA_DIR"/ManoHand_Cyborg_Roughness.jpg",
+                                                                                      DATA_DIR"/ManoHand_Cyborg_Metallic.jpeg");
 
     // 加载hand-sculpture的各种纹理 (纹理1)
-    TextureImage::Texture &handBaseColorTex = TextureImage::Texture::loadTexture("hand_basecolor", DATA_DIR"/hand-sculpture/textures/hand_albedo.jpg");
-    TextureImage::Texture &handNormalTex = TextureImage::Texture::loadTexture("hand_normal", DATA_DIR"/hand-sculpture/textures/hand_normal.jpg");
-    TextureImage::Texture &handMetallicTex = TextureImage::Texture::loadTexture("hand_metallic", DATA_DIR"/hand-sculpture/textures/hand_metallic.jpg");
-    TextureImage::Texture &handRoughnessTex = TextureImage::Texture::loadTexture("hand_roughness", DATA_DIR"/hand-sculpture/textures/hand_roughness.jpg");
-    TextureImage::Texture &handAoTex = TextureImage::Texture::loadTexture("hand_ao", DATA_DIR"/hand-sculpture/textures/hand_ao.jpg");
+    TextureImage::Texture &handBaseColorTex = TextureImage::Texture::loadTextureAsync("hand_basecolor", DATA_DIR"/hand-sculpture/textures/hand_albedo.jpg");
+    TextureImage::Texture &handNormalTex = TextureImage::Texture::loadTextureAsync("hand_normal", DATA_DIR"/hand-sculpture/textures/hand_normal.jpg", TextureCook::USAGE_NORMAL);
+    TextureImage::Texture &handOrmTex = TextureImage::Texture::loadPackedTextureAsync("hand_orm",
+                                                                                      DATA_DIR"/hand-sculpture/textures/hand_ao.jpg",
+                                                                                      DATA_DIR"/hand-sculpture/textures/hand_roughness.jpg",
+                                                                                      DATA_DIR"/hand-sculpture/textures/hand_metallic.jpg");
+
+    // 两组材质装进纹理数组，每种贴图一个数组、每组材质一层；贴图全部加载后源纹理即可卸载。
+    TextureImage::TextureArraySet materials({TEXTURE_PLACEHOLDER_GREY, TEXTURE_PLACEHOLDER_NORMAL,
+                                             TEXTURE_PLACEHOLDER_ORM});
+    materials.addSet({&manoBaseColorTex, &manoNormalTex, &manoOrmTex});
+    materials.addSet({&handBaseColorTex, &handNormalTex, &handOrmTex});
+    bool materials_final = false;
 
     // ===== 初始化天空盒 =====
     Skybox::SkyboxRenderer skyboxRenderer;
@@ -391,20 +1641,151 @@ int main(int argc, char *argv[]) {  // 主函数，程序入口。
         std::cout << "Failed to initialize skybox" << std::endl;
     }
 
+    HandBones hand;  // 骨骼句柄。
+    hand.resolve(sr);
+    // 对偶四元数丢掉缩放和错切：加载后检查一次，不能精确表示时改用仿射编码，而不是每帧画出错误的形状。
+    if (palette_encoding == BonePalette::ENCODING_DUAL_QUATERNION && !hand_palettes_rigid(sr, hand)) {
+        std::cout << "Bone palette has scaled or sheared bones, dual quaternions would drop them; "
+                  << "using the affine encoding" << std::endl;
+        palette_encoding = BonePalette::ENCODING_AFFINE;
+    }
 
-    sr.setShaderInput(program, "in_position", "in_texcoord", "in_normal", "in_bone_index", "in_bone_weight");  // 设置着色器输入属性，与模型数据对应。
+    // ===== 加载和编译着色器 =====
+    // 多实例模式使用按gl_InstanceID取骨骼矩阵的版本。链接后的程序二进制按驱动和源码哈希缓存，之后启动不再编译。
+    ShaderProgram::Program::cacheDirectory = CACHE_DIR;
+    // 只为有三角形的影响桶生成版本：手指末端等只受一根骨骼影响的部分只读取一个骨骼矩阵。
+    bool crowd_program = crowd_size > 0 || bench_crowd;
+    // 骨骼超出uniform块容量时单只手改用缓冲纹理，骨骼数只受GL_MAX_TEXTURE_BUFFER_SIZE限制；多实例本来就用缓冲纹理。
+    if (!crowd_program && !palette_buffer && sr.boneNum() > BonePalette::maxBones(palette_encoding)) {
+        std::cout << "Scene has " << sr.boneNum() << " bones, " << BonePalette::encodingName(palette_encoding)
+                  << " uniform palettes hold " << BonePalette::maxBones(palette_encoding)
+                  << ", using a buffer palette" << std::endl;
+        palette_buffer = true;
+    }
+    HandFeatures features = {crowd_program, palette_buffer && !crowd_program, palette_encoding, sr.boneNum()};
+    BonePalette::TextureBufferPalette handPalette;  // 单只手使用缓冲纹理时的骨骼。
+    if (features.palette_buffer && !handPalette.initialize(sr.boneNum() * BonePalette::vectorNum(palette_encoding))) {
+        std::cout << "Error occured in BonePalette::TextureBufferPalette::initialize()" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    ShaderProgram::Program *input_program = NULL;  // 读取权重最多的版本，所有顶点属性都是活动的。
+    for (unsigned int bucket = 0; bucket < SCENE_INFLUENCE_BUCKET_NUM; bucket++) {
+        size_t triangle_num = 0;
+        for (unsigned int lod = 0; lod < sr.lodNum(); lod++) triangle_num += sr.bucketTriangleNum(lod, bucket);
+        if (triangle_num == 0) continue;
+        if (!load_hand_program(handPrograms, sr, features, false, bucket, plainPrograms[bucket])) {
+            std::cout << "Error occured in load_hand_program()" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (!texture_mapping ||
+            !load_hand_program(handPrograms, sr, features, true, bucket, texturedPrograms[bucket]))
+            texturedPrograms[bucket] = plainPrograms[bucket];  // 没有纹理版本时始终以纹理坐标作为颜色。
+        input_program = plainPrograms[bucket].program;
+    }
+
+    // 变换反馈蒙皮：每帧把所有LOD共用的顶点蒙皮一次写入缓冲，绘制遍只做投影；多实例模式不使用。
+    HandProgram captureProgram = {}, skinnedPlainProgram = {}, skinnedTexturedProgram = {};
+    SkinFeedback::SkinnedBuffer skinFeedback;
+    if ((skin_feedback || bench_feedback || validate_skinning) && !crowd_program) {
+        unsigned int bucket = SkeletalMesh::influenceBucket(sr.boneInfluenceNum());  // 读取任何顶点的全部权重。
+        if (!skinFeedback.initialize(sr.getVertexNum(), sr.indexBuffer()) ||
+            !load_hand_program(handPrograms, sr, features, false, bucket, captureProgram, true) ||
+            !load_skinned_program(skinnedPrograms, false, skinnedPlainProgram)) {
+            std::cout << "Transform feedback skinning is unavailable, skinning in every pass" << std::endl;
+            skinFeedback.destroy();
+        } else if (!texture_mapping || !load_skinned_program(skinnedPrograms, true, skinnedTexturedProgram)) {
+            skinnedTexturedProgram = skinnedPlainProgram;
+        }
+    }
+
+    // 设置着色器输入属性，与模型数据对应；各版本的属性位置在着色器中固定，共用同一个VAO。
+    if (input_program)
+        sr.setShaderInput(input_program->id(), "in_position", "in_texcoord", "in_normal", "in_bone_index", "in_bone_weight");
+    std::cout << "Vertex buffer: " << sr.vertexBufferSize() << " bytes"
+              << (sr.getVertexFormat() == SkeletalMesh::VERTEX_FORMAT_QUANTIZED ? " (quantized)" : "")
+              << ", " << sr.indexSize() * 8 << "-bit indices" << std::endl;
 
     float passed_time;  // 经过的时间，用于动画。
     float last_time = 0.0f;  // 上次时间，用于计算帧间隔。
-    SkeletalMesh::SkeletonModifier modifier;  // 骨骼修改器，用于修改骨骼变换。
+    float animation_time = 0.0f;  // 动画时间，暂停时不再增加。
+    SkeletalMesh::SkeletonPose pose;  // 骨骼姿态，按骨骼句柄存放局部变换。
+    sr.initPose(pose);
+
+    if (validate_skinning) {  // 校验结束后直接退出。
+        bool matched = run_skinning_validation(sr, hand, captureProgram, skinFeedback, features, paletteRing,
+                                               handPalette);
+        TextureImage::Texture::finishAsyncLoads();
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        exit(matched ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
 
-    glEnable(GL_DEPTH_TEST);  // 启用深度测试，确保正确渲染3D场景。
+    if (bench_crowd || bench_palette || bench_feedback || bench_skinning) {  // 基准测试结束后直接退出。
+        if (bench_skinning)
+            run_skinning_benchmark(sr, hand);
+        else if (bench_crowd)
+            run_crowd_benchmark(window, plainPrograms, palette_encoding, sr, hand);
+        else if (bench_palette)
+            run_palette_benchmark(window, handPrograms, paletteRing, palette_encoding, sr);
+        else if (skinFeedback.isValid())
+            run_feedback_benchmark(window, plainPrograms, captureProgram, skinnedPlainProgram, skinFeedback,
+                                   features, paletteRing, handPalette, sr);
+        else
+            std::cout << "--bench-feedback needs transform feedback skinning of a single hand" << std::endl;
+        TextureImage::Texture::finishAsyncLoads();
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        exit(EXIT_SUCCESS);
+    }
+
+    // 多实例模式：每只手的骨骼矩阵每帧写入缓冲纹理，模型矩阵只上传一次。
+    std::vector<CrowdInstance> crowd;
+    std::vector<glm::fmat4> crowdModels;
+    std::vector<unsigned int> crowdOrder, crowdLodFirst, uploadedOrder;  // 按LOD分组后的实例顺序。
+    std::vector<unsigned int> paletteOrder;  // 缓冲纹理中骨骼的实例顺序，与crowd_palette_time一起决定是否需要重新计算
+    float crowd_palette_time = 0.0f;
+    BonePalette::TextureBufferPalette crowdPalettes, crowdModelBuffer;
+    float far_plane = 100.0f;  // 远裁剪面，多实例时按方阵大小放大。
+    if (crowd_size > 0) {
+        layout_crowd(crowd, crowdModels, sr, crowd_size);
+        crowdPalettes.initialize(crowd_size * sr.boneNum() * BonePalette::vectorNum(palette_encoding));
+        crowdModelBuffer.initialize(crowd_size * 4);
+        crowdModelBuffer.upload(crowdModels.data(), crowdModels.size());
+        far_plane += (float) ceil(sqrt((double) crowd_size)) * CROWD_SPACING * 1.5f;
+        std::cout << "Crowd mode: " << crowd_size << " hands, one instanced draw" << std::endl;
+    }
+
+    GLState::setDepthTest(true);  // 启用深度测试，确保正确渲染3D场景。
+
+    bool first_frame = true;  // 用于统计启动到第一帧的时间。
+    int frame_index = 0;  // 第GL_STATS_FRAME帧输出一次GL状态调用统计，此时纹理和LOD已经稳定。
+    unsigned int last_lod = 0;  // 单只手时上一帧使用的LOD，变化时输出。
+    // 单只手的绘制列表：每个影响桶一个，变换反馈蒙皮时从捕获的顶点绘制一个；只在LOD变化时重建，之后每帧直接提交。
+    SkeletalMesh::DrawList handDraws[SCENE_INFLUENCE_BUCKET_NUM], skinnedDraws, crowdDraws;
+    unsigned int listed_lod = (unsigned int) -1;
+    bool textures_streaming = true;  // 是否还有异步纹理在加载。
 
     // ===== 主渲染循环 =====
     while (!glfwWindowShouldClose(window)) {  // 主渲染循环，直到窗口关闭。
+        GLState::beginFrame();  // 重新统计本帧发出和过滤掉的GL状态调用。
+        paletteRing.beginFrame();  // 切换到下一个骨骼矩阵切片。
+        if (textures_streaming && TextureImage::Texture::pumpUploads() == 0) {  // 上传已解码的纹理，替换占位纹理。
+            textures_streaming = false;
+            std::cout << "All textures streamed in after " << glfwGetTime() * 1000.0 << " ms, "
+                      << TextureImage::Texture::uniqueImageNum() << " unique images" << std::endl;
+        }
+        if (!materials_final && materials.update()) {  // 贴图上传后重新组装纹理数组。
+            materials_final = true;
+            std::cout << "Material arrays: 2 sets in " << materials.arrayNum() << " array(s) per map" << std::endl;
+            const char *sources[] = {"mano_basecolor", "mano_normal", "mano_orm",
+                                     "hand_basecolor", "hand_normal", "hand_orm"};
+            for (const char *source : sources)  // 图像已复制进数组，释放原来的2D纹理。
+                TextureImage::Texture::unloadTexture(source);
+        }
         passed_time = (float) glfwGetTime();  // 获取从程序启动以来经过的时间，用于动画。
         float delta_time = passed_time - last_time;  // 计算帧间隔时间。
         last_time = passed_time;  // 更新上次时间。
+        if (!animation_paused) animation_time += delta_time;
 
         // ===== 交互输入两个数字 =====
         if (input_mode) {
@@ -451,351 +1832,6 @@ int main(int argc, char *argv[]) {  // 主函数，程序入口。
             camera_pitch = asin(forward.y);
         }
 
-        // ===== 更新动画状态 =====
-        // --- You may edit below ---  // 以下是作业需要修改的地方，实现手的运动。
-
-        // 先复原所有手指
-        resetFingers(modifier);
-
-        // Example: Rotate the hand  // 示例：旋转整个手。
-        // * turn around every 4 seconds  // 每4秒转一圈。
-        float metacarpals_angle = passed_time * (M_PI / 4.0f);  // 计算旋转角度，passed_time * (PI/4) 意味着每4秒转90度，但由于是连续的，每秒转PI/4弧度，即每4秒转2PI。
-        // * target = metacarpals  // 目标是手掌部分（metacarpals）。
-        // * rotation axis = (1, 0, 0)  // 旋转轴是X轴。
-        modifier["metacarpals"] = glm::rotate(glm::identity<glm::mat4>(), metacarpals_angle, glm::fvec3(1.0, 0.0, 0.0));  // 设置手掌的变换矩阵为绕X轴旋转。
-
-        /**********************************************************************************\
-        *
-        * To animate fingers, modify modifier["HAND_SECTION"] each frame,  // 要让手指动起来，每帧修改 modifier["手的部分名称"]。
-        * where HAND_SECTION can only be one of the bone names in the Hand's Hierarchy.  // HAND_SECTION 只能是手的层次结构中的骨骼名称之一。
-        *
-        * A virtual hand's structure is like this: (slightly DIFFERENT from the real world)  // 虚拟手的手指结构（与现实略有不同）：
-        *    5432 1
-        *    ....        1 = thumb           . = fingertip  // 1=大拇指，. = 指尖
-        *    |||| .      2 = index finger    | = distal phalange  // 2=食指，| = 远端指节
-        *    $$$$ |      3 = middle finger   $ = intermediate phalange  // 3=中指，$ = 中间指节
-        *    #### $      4 = ring finger     # = proximal phalange  // 4=无名指，# = 近端指节
-        *    OOOO#       5 = pinky           O = metacarpals  // 5=小指，O = 手掌
-        *     OOO
-        * (Hand in the real world -> https://en.wikipedia.org/wiki/Hand)  // （现实中的手请参考维基百科）
-        *
-        * From the structure we can infer the Hand's Hierarchy:  // 从结构可以推断出手的层次：
-        *	- metacarpals  // 手掌
-        *		- thumb_proximal_phalange  // 大拇指近端指节
-        *			- thumb_intermediate_phalange  // 大拇指中间指节
-        *				- thumb_distal_phalange  // 大拇指远端指节
-        *					- thumb_fingertip  // 大拇指尖
-        *		- index_proximal_phalange  // 食指...
-        *			- index_intermediate_phalange
-        *				- index_distal_phalange
-        *					- index_fingertip
-        *		- middle_proximal_phalange  // 中指...
-        *			- middle_intermediate_phalange
-        *				- middle_distal_phalange
-        *					- middle_fingertip
-        *		- ring_proximal_phalange  // 无名指...
-        *			- ring_intermediate_phalange
-        *				- ring_distal_phalange
-        *					- ring_fingertip
-        *		- pinky_proximal_phalange  // 小指...
-        *			- pinky_intermediate_phalange
-        *				- pinky_distal_phalange
-        *					- pinky_fingertip
-        *
-        * Notice that modifier["HAND_SECTION"] is a local transformation matrix,  // 注意 modifier["手的部分"] 是一个局部变换矩阵，
-        * where (1, 0, 0) is the bone's direction, and apparently (0, 1, 0) / (0, 0, 1)  // 其中 (1,0,0) 是骨骼的方向，(0,1,0) 和 (0,0,1) 垂直于骨骼。
-        * is perpendicular to the bone.  // 特别是 (0,0,1) 是近端关节的主要旋转轴。
-        * Particularly, (0, 0, 1) is the rotation axis of the nearer joint.  // 手指第一指节也可沿 (0,1,0) 小范围转动。
-        *
-        \**********************************************************************************/
-        
-        
-
-
-        float angle_90 = M_PI / 2.0f;  // 90度
-        float angle_72 = M_PI / 2.5f;  // 75度
-        float angle_60 = M_PI / 3.0f;  // 60度
-        float angle_45 = M_PI / 4.0f;  // 45度
-        float angle_30 = M_PI / 6.0f;  // 30度
-        float angle_10 = M_PI / 18.0f;  // 10度弯曲角度
-
-        
-        // ===== 让手指依次动起来 =====
-        // 如果当前动作是依次弯曲（默认），
-        if (current_action == 10) {
-            // 使用时间延迟，让每个手指在不同时间开始弯曲，实现依次动作
-            float period = 2.4f;  // 每个手指的弯曲周期
-            float delay_step = 0.5f;  // 每个手指之间的延迟时间（秒）
-            // 食指（最先动）
-            float time_index = passed_time;
-            float time_in_period_index = fmod(time_index, period);  // 当前周期内的时间，使用fmod取模
-            // * angle: 0 -> PI/3 -> 0  // 角度：0 -> PI/3 -> 0，即从0到60度再回到0。
-            float angle_index = abs(time_in_period_index / (period * 0.5f) - 1.0f) * (M_PI / 3.0);  // 计算角度，使用abs函数使之先增后减
-            modifier["index_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_index, glm::fvec3(0.0, 0.0, 1.0));
-
-            // 中指（延迟0.5秒）
-            //逻辑：当程序刚启动时（passed_time < 0.5），time_middle 会是负数，中指不动。
-            //当程序运行超过0.5秒时（passed_time >= 0.5），time_middle 变成正数，中指开始动。
-            float time_middle = passed_time - delay_step;
-            if (time_middle > 0) {
-                float time_in_period_middle = fmod(time_middle, period);
-                float angle_middle = abs(time_in_period_middle / (period * 0.5f) - 1.0f) * (M_PI / 3.0);
-                modifier["middle_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_middle, glm::fvec3(0.0, 0.0, 1.0));
-            }
-
-            // 无名指（延迟1秒）
-            float time_ring = passed_time - 2 * delay_step;
-            if (time_ring > 0) {
-                float time_in_period_ring = fmod(time_ring, period);
-                float angle_ring = abs(time_in_period_ring / (period * 0.5f) - 1.0f) * (M_PI / 3.0);
-                modifier["ring_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_ring, glm::fvec3(0.0, 0.0, 1.0));
-            }
-
-            // 小指（延迟1.5秒）
-            float time_pinky = passed_time - 3 * delay_step;
-            if (time_pinky > 0) {
-                float time_in_period_pinky = fmod(time_pinky, period);
-                float angle_pinky = abs(time_in_period_pinky / (period * 0.5f) - 1.0f) * (M_PI / 3.0);
-                modifier["pinky_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_pinky, glm::fvec3(0.0, 0.0, 1.0));
-            }
-
-            // 大拇指（延迟2秒，可能用不同的轴）
-            float time_thumb = passed_time - 4 * delay_step;
-            if (time_thumb > 0) {
-                float time_in_period_thumb = fmod(time_thumb, period);
-                float angle_thumb = abs(time_in_period_thumb / (period * 0.5f) - 1.0f) * (M_PI / 3.0);
-                modifier["thumb_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_thumb, glm::fvec3(0.0, 1.0, 0.0));  // 大拇指用Y轴
-            }
-        }
-
-        // ===== 比心动作 =====
-        // 如果当前动作是比心（按0键切换），覆盖上面的动画
-        if (current_action == 0) {
-            //拇指
-            modifier["thumb_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));  // 大拇指弯曲30度
-            modifier["thumb_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_10, glm::fvec3(0.0, 0.0, 1.0));
-            //食指
-            modifier["index_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_60, glm::fvec3(0.0, 0.0, 1.0));  // 食指弯曲90度
-            modifier["index_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0));  // 食指中间指节弯曲90度
-            modifier["index_distal_phalange"] = glm::identity<glm::mat4>();
-            //中指
-            modifier["middle_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));  // 中指弯曲90度
-            modifier["middle_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            //无名指
-            modifier["ring_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));    // 无名指弯曲90度
-            modifier["ring_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            //小指
-            modifier["pinky_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));   // 小指弯曲90度
-            modifier["pinky_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-
-        }
-        // ===== 比数字1 =====
-        if (current_action == 1) {
-            //拇指
-            modifier["thumb_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0));
-            modifier["thumb_distal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));  // 大拇指弯曲60度
-            modifier["thumb_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));
-            //食指
-            modifier["index_proximal_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_intermediate_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_distal_phalange"] = glm::identity<glm::mat4>();
-            //中指
-            modifier["middle_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));  // 中指弯曲90度
-            modifier["middle_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            //无名指
-            modifier["ring_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));    // 无名指弯曲90度
-            modifier["ring_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            //小指
-            modifier["pinky_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));   // 小指弯曲90度
-            modifier["pinky_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-
-        }
-        // ===== 比数字2 =====
-        if (current_action == 2) {
-            //拇指
-            modifier["thumb_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0));
-            modifier["thumb_distal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));  // 大拇指弯曲60度
-            modifier["thumb_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));
-            //食指
-            modifier["index_proximal_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_intermediate_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_distal_phalange"] = glm::identity<glm::mat4>();
-            //中指
-            modifier["middle_proximal_phalange"] = glm::identity<glm::mat4>();  // 中指伸直
-            modifier["middle_intermediate_phalange"] = glm::identity<glm::mat4>();  // 中指伸直
-            //无名指
-            modifier["ring_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));    // 无名指弯曲90度
-            modifier["ring_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            //小指
-            modifier["pinky_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));   // 小指弯曲90度
-            modifier["pinky_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-
-        }
-        // ===== 比数字3 =====
-        if (current_action == 3) {
-            //拇指
-            modifier["thumb_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0));
-            modifier["thumb_distal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));  // 大拇指弯曲60度
-            modifier["thumb_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));
-            //食指
-            modifier["index_proximal_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_intermediate_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_distal_phalange"] = glm::identity<glm::mat4>();
-            //中指
-            modifier["middle_proximal_phalange"] = glm::identity<glm::mat4>();  // 中指伸直
-            modifier["middle_intermediate_phalange"] = glm::identity<glm::mat4>();  // 中指伸直
-            //无名指
-            modifier["ring_proximal_phalange"] = glm::identity<glm::mat4>();  // 无名指伸直
-            modifier["ring_intermediate_phalange"] = glm::identity<glm::mat4>();  // 无名指伸直
-            //小指
-            modifier["pinky_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));   // 小指弯曲90度
-            modifier["pinky_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-
-        }
-        // ===== 比数字4 =====
-        if (current_action == 4) {
-            //拇指
-            modifier["thumb_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0));
-            modifier["thumb_distal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));  // 大拇指弯曲60度
-            modifier["thumb_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));
-             //食指
-            modifier["index_proximal_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_intermediate_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_distal_phalange"] = glm::identity<glm::mat4>();
-            //中指
-            modifier["middle_proximal_phalange"] = glm::identity<glm::mat4>();  // 中指伸直
-            modifier["middle_intermediate_phalange"] = glm::identity<glm::mat4>();  // 中指伸直
-            //无名指
-            modifier["ring_proximal_phalange"] = glm::identity<glm::mat4>();  // 无名指伸直
-            modifier["ring_intermediate_phalange"] = glm::identity<glm::mat4>();  // 无名指伸直
-            //小指
-            modifier["pinky_proximal_phalange"] = glm::identity<glm::mat4>();  // 小指伸直
-            modifier["pinky_intermediate_phalange"] = glm::identity<glm::mat4>();  // 小指伸直
-
-        }
-        // ===== 比数字5 =====
-        if (current_action == 5) {
-            //拇指
-            modifier["thumb_proximal_phalange"] = glm::identity<glm::mat4>();  // 拇指伸直
-            modifier["thumb_intermediate_phalange"] = glm::identity<glm::mat4>();  // 拇指伸直
-            modifier["thumb_distal_phalange"] = glm::identity<glm::mat4>();  // 拇指伸直
-             //食指
-            modifier["index_proximal_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_intermediate_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_distal_phalange"] = glm::identity<glm::mat4>();
-            //中指
-            modifier["middle_proximal_phalange"] = glm::identity<glm::mat4>();  // 中指伸直
-            modifier["middle_intermediate_phalange"] = glm::identity<glm::mat4>();  // 中指伸直
-            //无名指
-            modifier["ring_proximal_phalange"] = glm::identity<glm::mat4>();  // 无名指伸直
-            modifier["ring_intermediate_phalange"] = glm::identity<glm::mat4>();  // 无名指伸直
-            //小指
-            modifier["pinky_proximal_phalange"] = glm::identity<glm::mat4>();  // 小指伸直
-            modifier["pinky_intermediate_phalange"] = glm::identity<glm::mat4>();  // 小指伸直
-
-        }
-        // ===== 比数字6 =====
-        if (current_action == 6) {
-            //拇指
-            modifier["thumb_proximal_phalange"] = glm::identity<glm::mat4>();  // 拇指伸直
-            modifier["thumb_intermediate_phalange"] = glm::identity<glm::mat4>();  // 拇指伸直
-            modifier["thumb_distal_phalange"] = glm::identity<glm::mat4>();  // 拇指伸直
-            //食指
-            modifier["index_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));  // 食指弯曲90度
-            modifier["index_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            modifier["index_distal_phalange"] = glm::identity<glm::mat4>();
-            //中指
-            modifier["middle_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));  // 中指弯曲90度
-            modifier["middle_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            //无名指
-            modifier["ring_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));    // 无名指弯曲90度
-            modifier["ring_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            //小指
-            modifier["pinky_proximal_phalange"] = glm::identity<glm::mat4>();  // 小指伸直
-            modifier["pinky_intermediate_phalange"] = glm::identity<glm::mat4>();  // 小指伸直
-        }
-        // ===== 比数字7 =====
-        if (current_action == 7) {
-            //拇指
-            modifier["thumb_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_10, glm::fvec3(0.0, 0.0, 1.0));
-            modifier["thumb_distal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));  // 大拇指弯曲60度
-            modifier["thumb_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));
-            //食指
-            modifier["index_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_72, glm::fvec3(0.0, 0.0, 1.0));  // 食指弯曲90度
-            modifier["index_intermediate_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_distal_phalange"] = glm::identity<glm::mat4>();
-            //中指
-            modifier["middle_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_72, glm::fvec3(0.0, 0.0, 1.0));  // 中指弯曲90度
-            modifier["middle_intermediate_phalange"] = glm::identity<glm::mat4>();
-            //无名指
-            modifier["ring_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));    // 无名指弯曲90度
-            modifier["ring_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            //小指
-            modifier["pinky_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));   // 小指弯曲90度
-            modifier["pinky_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-
-        }
-        // ===== 比数字8 =====
-        if (current_action == 8) {
-            //拇指
-            modifier["thumb_proximal_phalange"] = glm::identity<glm::mat4>();  // 拇指伸直
-            modifier["thumb_intermediate_phalange"] = glm::identity<glm::mat4>();  // 拇指伸直
-            modifier["thumb_distal_phalange"] = glm::identity<glm::mat4>();  // 拇指伸直
-            //食指
-            modifier["index_proximal_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_intermediate_phalange"] = glm::identity<glm::mat4>();  // 食指伸直
-            modifier["index_distal_phalange"] = glm::identity<glm::mat4>();
-            //中指
-            modifier["middle_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));  // 中指弯曲90度
-            modifier["middle_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            //无名指
-            modifier["ring_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));    // 无名指弯曲90度
-            modifier["ring_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            //小指
-            modifier["pinky_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));   // 小指弯曲90度
-            modifier["pinky_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-
-        }
-        // ===== 比数字9 =====
-        if (current_action == 9) {
-            //拇指
-            modifier["thumb_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0));
-            modifier["thumb_distal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));  // 大拇指弯曲60度
-            modifier["thumb_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));
-            //食指
-            modifier["index_proximal_phalange"] = glm::identity<glm::mat4>();
-            modifier["index_distal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));  // 食指弯曲60度
-            modifier["index_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_60, glm::fvec3(0.0, 0.0, 1.0));
-            //中指
-            modifier["middle_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));  // 中指弯曲90度
-            modifier["middle_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            //无名指
-            modifier["ring_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));    // 无名指弯曲90度
-            modifier["ring_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-            //小指
-            modifier["pinky_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));   // 小指弯曲90度
-            modifier["pinky_intermediate_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_90, glm::fvec3(0.0, 0.0, 1.0));
-
-        }
-
-        // ===== 挥手动作 =====
-        if (current_action == 11) {
-            // 使用时间让手挥动
-            float wave_time = passed_time * 2.0f;  // 挥手速度
-            float wave_angle = sin(wave_time) * M_PI / 3.0f;  // 左右摆动角度
-
-            // 整个手掌左右摆动，手掌面向屏幕朝外
-            modifier["metacarpals"] = glm::rotate(glm::identity<glm::mat4>(), wave_angle, glm::fvec3(0.0, 1.0, 0.0));
-
-            // 手指稍微弯曲，模拟自然挥手姿势
-            modifier["index_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));
-            modifier["middle_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));
-            modifier["ring_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));
-            modifier["pinky_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_30, glm::fvec3(0.0, 0.0, 1.0));
-            modifier["thumb_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), angle_45, glm::fvec3(0.0, 0.0, 1.0));
-        }
-        // --- You may edit above ---  // 以上是需要修改的地方。
-
         // ===== 渲染准备 =====
         float ratio;  // 窗口宽高比。
         int width, height;  // 窗口宽度和高度。
@@ -810,123 +1846,146 @@ int main(int argc, char *argv[]) {  // 主函数，程序入口。
 
         // ===== 渲染天空盒 =====
         // 禁用深度写入，渲染天空盒
-        glDepthMask(GL_FALSE);
+        GLState::depthMask(GL_FALSE);
         glm::mat4 view_matrix = glm::lookAt(camera_eye, camera_center, camera_up);  // 计算视图矩阵。
-        glm::mat4 projection_matrix = glm::perspective(glm::radians(45.0f), ratio, 0.1f, 100.0f);  // 计算投影矩阵。
+        glm::mat4 projection_matrix = glm::perspective(glm::radians(45.0f), ratio, 0.1f, far_plane);  // 计算投影矩阵。
         skyboxRenderer.render(view_matrix, projection_matrix);
-        glDepthMask(GL_TRUE);  // 重新启用深度写入
+        GLState::depthMask(GL_TRUE);  // 重新启用深度写入
 
         // ===== 设置着色器和矩阵 =====
-
-        glUseProgram(program);  // 使用着色器程序。
+        // 纹理0: mano-hand-cyborg，纹理1: hand-sculpture，纹理2: no texture；切换纹理即切换着色器版本。
+        bool textured = texture_mapping && (current_tex == 0 || current_tex == 1);
+        HandProgram *programs = textured ? texturedPrograms : plainPrograms;  // 绘制每个影响桶时再切换到对应版本。
         // glm::fmat4 mvp = glm::ortho(-12.5f * ratio, 12.5f * ratio, -5.f, 20.f, -20.f, 20.f)  // 设置正交投影矩阵。
         //                  *
         //                  glm::lookAt(glm::fvec3(.0f, .0f, -1.f), glm::fvec3(.0f, .0f, .0f), glm::fvec3(.0f, 1.f, .0f));  // 设置观察矩阵，从(0,0,-1)看向(0,0,0)，上方向Y轴。
         glm::fmat4 mvp = projection_matrix  // 设置透视投影矩阵。
                          *
-                         view_matrix;  // 使用之前计算的视图矩阵。
-        glUniformMatrix4fv(glGetUniformLocation(program, "u_mvp"), 1, GL_FALSE, (const GLfloat *) &mvp);  // 传递MVP矩阵到着色器。
+                         view_matrix;  // 使用之前计算的视图矩阵。MVP矩阵在绘制各影响桶时传递，与上一帧相同时跳过。
 
         // ===== 绑定纹理 =====
-        // 根据当前纹理选择绑定纹理
-        if (current_tex == 0) {  // 纹理0: mano-hand-cyborg
-            if (manoBaseColorTex.bind(0)) {
-                glUniform1i(glGetUniformLocation(program, "u_basecolor"), 0);
-            } else {
-                glUniform1i(glGetUniformLocation(program, "u_basecolor"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
-            }
-            if (manoNormalTex.bind(1)) {
-                glUniform1i(glGetUniformLocation(program, "u_normal"), 1);
-            } else {
-                glUniform1i(glGetUniformLocation(program, "u_normal"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
-            }
-            if (manoMetallicTex.bind(2)) {
-                glUniform1i(glGetUniformLocation(program, "u_metallic"), 2);
-            } else {
-                glUniform1i(glGetUniformLocation(program, "u_metallic"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
+        // 两组材质在同一套纹理数组中时，切换材质只改层号uniform，不重新绑定纹理。
+        GLint material_layer = 0;
+        if (textured) {
+            materials.bind(current_tex, MATERIAL_UNIT);
+            material_layer = materials.layer(current_tex);
+        }  // 不采样纹理的版本不需要解绑。
+
+        // ===== LOD选择 =====
+        // 简化误差投影到屏幕上不超过SCENE_LOD_PIXEL_ERROR像素时使用更粗的LOD。
+        float pixels_at_unit_distance = height / (2.0f * tan(glm::radians(45.0f) * 0.5f));
+        if (crowd_size > 0) {  // 多实例：所有手的骨骼矩阵直接写入映射的缓冲纹理，每个LOD的每个影响桶一次绘制。
+            select_crowd_lods(crowdModels, sr, camera_eye, pixels_at_unit_distance, crowdOrder, crowdLodFirst);
+            if (crowdOrder != uploadedOrder) {  // 分组变化时按新顺序重新上传模型矩阵。
+                std::vector<glm::fmat4> ordered(crowdOrder.size());
+                for (size_t k = 0; k < crowdOrder.size(); k++) ordered[k] = crowdModels[crowdOrder[k]];
+                crowdModelBuffer.upload(ordered.data(), ordered.size());
+                uploadedOrder = crowdOrder;
             }
-            if (manoRoughnessTex.bind(3)) {
-                glUniform1i(glGetUniformLocation(program, "u_roughness"), 3);
-            } else {
-                glUniform1i(glGetUniformLocation(program, "u_roughness"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
+            if (crowdOrder != paletteOrder || animation_time != crowd_palette_time) {  // 暂停且分组不变时保留上次的骨骼。
+                glm::fvec4 *palettes = crowdPalettes.map(crowd.size() * sr.boneNum() * BonePalette::vectorNum(palette_encoding));
+                if (palettes) {
+                    update_crowd(crowd, sr, hand, animation_time, palette_encoding, palettes, crowdOrder.data());
+                    crowdPalettes.unmap();
+                    paletteOrder = crowdOrder;
+                    crowd_palette_time = animation_time;
+                }
             }
-            if (manoAoTex.bind(4)) {
-                glUniform1i(glGetUniformLocation(program, "u_ao"), 4);
-            } else {
-                glUniform1i(glGetUniformLocation(program, "u_ao"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
+            for (size_t lod = 0; lod + 1 < crowdLodFirst.size(); lod++) {
+                GLsizei count = crowdLodFirst[lod + 1] - crowdLodFirst[lod];
+                if (count == 0) continue;
+                render_crowd_group(programs, sr, crowdPalettes, crowdModelBuffer, mvp, material_layer,
+                                   (unsigned int) lod, (GLint) crowdLodFirst[lod], count, crowdDraws);
             }
-            glUniform1i(glGetUniformLocation(program, "texture_mode"), 1);  // 设置为使用纹理
-        } else if (current_tex == 1) {  // 纹理1: hand-sculpture
-            if (handBaseColorTex.bind(0)) {
-                glUniform1i(glGetUniformLocation(program, "u_basecolor"), 0);
-            } else {
-                glUniform1i(glGetUniformLocation(program, "u_basecolor"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
-            }
-            if (handNormalTex.bind(1)) {
-                glUniform1i(glGetUniformLocation(program, "u_normal"), 1);
-            } else {
-                glUniform1i(glGetUniformLocation(program, "u_normal"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
+        } else {
+            // 动作和时间与上次上传时相同，骨骼就不变：不设置姿态、不计算也不编码，重新绑定上次上传的内容。
+            // 否则手指姿态只在切换动作时从缓存设置，每帧只转动手掌，只重算、编码和上传变化的骨骼区间。
+            size_t vector_num = BonePalette::vectorNum(palette_encoding);
+            if (!palette_uploaded || current_action != uploaded_action || animation_time != uploaded_time) {
+                if (fingersFollowTime(current_action)) {
+                    animateHand(pose, hand, current_action, animation_time);
+                } else {
+                    if (current_action != posed_action) gestureCache.apply(pose, sr, hand, current_action);
+                    rotateHand(pose, hand, current_action, animation_time);
+                }
+                posed_action = current_action;
+                sr.getSkeletonTransform(pose);  // 根据pose计算骨骼变换，只重算发生变化的子树。
+                const SkeletalMesh::Scene::SkeletonTransf &bonesTransf = pose.getPalette();  // 骨骼变换数组。
+                size_t first = 0, end = 0;  // 需要编码和上传的骨骼区间
+                pose.getChangedRange(first, end);
+                if (paletteVectors.size() != bonesTransf.size() * vector_num) {
+                    paletteVectors.resize(bonesTransf.size() * vector_num);
+                    first = 0;
+                    end = bonesTransf.size();
+                }
+                if (first < end)  // 对偶四元数编码在加载时已确认没有缩放。
+                    BonePalette::encode(palette_encoding, bonesTransf.data() + first, end - first,
+                                        paletteVectors.data() + first * vector_num);
+                if (!paletteVectors.empty())  // 如果有变换。
+                    upload_hand_palette(features, paletteRing, handPalette, paletteVectors,
+                                        first * vector_num, (end - first) * vector_num);
+                palette_uploaded = true;
+                uploaded_action = current_action;
+                uploaded_time = animation_time;
+            } else if (!paletteVectors.empty()) {
+                rebind_hand_palette(features, paletteRing, handPalette);
             }
-            if (handMetallicTex.bind(2)) {
-                glUniform1i(glGetUniformLocation(program, "u_metallic"), 2);
-            } else {
-                glUniform1i(glGetUniformLocation(program, "u_metallic"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
+            float distance = glm::max(glm::length(camera_eye - camera_center), 1e-3f);
+            unsigned int lod = sr.selectLod(pixels_at_unit_distance / distance);
+            if (lod != last_lod) {
+                std::cout << "LOD " << lod << " (" << sr.lodTriangleNum(lod) << " triangles)" << std::endl;
+                last_lod = lod;
             }
-            if (handRoughnessTex.bind(3)) {
-                glUniform1i(glGetUniformLocation(program, "u_roughness"), 3);
-            } else {
-                glUniform1i(glGetUniformLocation(program, "u_roughness"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
+            if (lod != listed_lod) {
+                for (unsigned int bucket = 0; bucket < SCENE_INFLUENCE_BUCKET_NUM; bucket++) {
+                    handDraws[bucket].clear();
+                    handDraws[bucket].add(sr, lod, 1, bucket);
+                }
+                skinnedDraws.clear();
+                if (skinFeedback.isValid()) skinnedDraws.addFrom(skinFeedback.vertexArray(), sr, lod);
+                listed_lod = lod;
             }
-            if (handAoTex.bind(4)) {
-                glUniform1i(glGetUniformLocation(program, "u_ao"), 4);
+            if (skinFeedback.isValid()) {  // 所有顶点蒙皮一次写入缓冲，再从缓冲绘制；之后增加的绘制遍都复用这次蒙皮。
+                use_hand_program(captureProgram, mvp, 0);
+                skinFeedback.beginCapture();
+                sr.renderPoints();
+                skinFeedback.endCapture();
+                use_hand_program(textured ? skinnedTexturedProgram : skinnedPlainProgram, mvp, material_layer);
+                skinnedDraws.submit();
             } else {
-                glUniform1i(glGetUniformLocation(program, "u_ao"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
+                for (unsigned int bucket = 0; bucket < SCENE_INFLUENCE_BUCKET_NUM; bucket++) {  // 每个非空的影响桶一次多重绘制。
+                    if (!handDraws[bucket].entryNum()) continue;
+                    use_hand_program(programs[bucket], mvp, material_layer);
+                    handDraws[bucket].submit();  // 按材质排好序的这个桶的三角形。
+                }
             }
-            glUniform1i(glGetUniformLocation(program, "texture_mode"), 1);  // 设置为使用纹理
-        } else if (current_tex == 2) {  // 纹理2: no texture
-            // 解绑所有纹理，使用默认的漫反射通道
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, 0);
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, 0);
-            glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, 0);
-            glActiveTexture(GL_TEXTURE3);
-            glBindTexture(GL_TEXTURE_2D, 0);
-            glActiveTexture(GL_TEXTURE4);
-            glBindTexture(GL_TEXTURE_2D, 0);
-            glUniform1i(glGetUniformLocation(program, "u_basecolor"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
-            glUniform1i(glGetUniformLocation(program, "u_normal"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
-            glUniform1i(glGetUniformLocation(program, "u_metallic"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
-            glUniform1i(glGetUniformLocation(program, "u_roughness"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
-            glUniform1i(glGetUniformLocation(program, "u_ao"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
-            glUniform1i(glGetUniformLocation(program, "texture_mode"), 0);  // 设置为使用漫反射通道
         }
-
-        SkeletalMesh::Scene::SkeletonTransf bonesTransf;  // 骨骼变换数组。
-        sr.getSkeletonTransform(bonesTransf, modifier);  // 根据modifier获取骨骼变换。
-        if (!bonesTransf.empty())  // 如果有变换。
-            glUniformMatrix4fv(glGetUniformLocation(program, "u_bone_transf"), bonesTransf.size(), GL_FALSE,  // 传递骨骼变换到着色器。
-                               (float *) bonesTransf.data());
-        sr.render();  // 渲染场景。
+        paletteRing.endFrame();  // 为当前切片插入fence。
 
         glfwSwapBuffers(window);  // 交换缓冲区。
         glfwPollEvents();  // 处理事件。
+        if (first_frame) {
+            first_frame = false;
+            std::cout << "First frame after " << glfwGetTime() * 1000.0 << " ms" << std::endl;
+        }
+        if (++frame_index == GL_STATS_FRAME) {
+            const GLState::Counters &counters = GLState::frameCounters();
+            std::cout << "GL state calls in frame " << frame_index << ": " << counters.issued << " issued, "
+                      << counters.filtered << " filtered" << std::endl;
+        }
     }  // 循环结束。
 
+    TextureImage::Texture::finishAsyncLoads();  // 等待仍在解码的任务，之后才能释放纹理。
+
     // ===== 清理资源 =====
     // SkeletalMesh::Scene::unloadScene("Hand");  // 卸载原始手部场景。
     SkeletalMesh::Scene::unloadScene("ManoHand");  // 卸载mano-hand-cyborg场景。
     TextureImage::Texture::unloadTexture("mano_basecolor");  // 卸载纹理。
     TextureImage::Texture::unloadTexture("mano_normal");
-    TextureImage::Texture::unloadTexture("mano_metallic");
-    TextureImage::Texture::unloadTexture("mano_roughness");
-    TextureImage::Texture::unloadTexture("mano_ao");
+    TextureImage::Texture::unloadTexture("mano_orm");
     TextureImage::Texture::unloadTexture("hand_basecolor");
     TextureImage::Texture::unloadTexture("hand_normal");
-    TextureImage::Texture::unloadTexture("hand_metallic");
-    TextureImage::Texture::unloadTexture("hand_roughness");
-    TextureImage::Texture::unloadTexture("hand_ao");
+    TextureImage::Texture::unloadTexture("hand_orm");
 
     glfwDestroyWindow(window);  // 销毁窗口。
 
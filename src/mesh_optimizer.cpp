@@ -0,0 +1,439 @@
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <unordered_map>
+
+
+namespace MeshOptimizer {
+    // Scoring constants from Forsyth, "Linear-Speed Vertex Cache Optimisation"
+    static const int FORSYTH_CACHE_SIZE = 32;
+    static const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+    static const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+    static const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+    static const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+    float computeACMR(const unsigned int *indices, size_t indexNum, size_t vertexNum, unsigned int cacheSize) {
+        if (indexNum < 3) return 0.0f;
+        // FIFO cache: a vertex is resident while fewer than cacheSize misses happened since it was loaded
+        std::vector<unsigned int> loadedAt(vertexNum, 0);
+        unsigned int time = cacheSize + 1;
+        size_t misses = 0;
+        for (size_t i = 0; i < indexNum; i++) {
+            unsigned int v = indices[i];
+            if (time - loadedAt[v] > cacheSize) {
+                loadedAt[v] = time++;
+                misses++;
+            }
+        }
+        return (float) misses / (float) (indexNum / 3);
+    }
+
+    static float vertexScore(int cachePosition, unsigned int remaining) {
+        if (remaining == 0) return -1.0f;  // no triangle left to help
+        float score = 0.0f;
+        if (cachePosition >= 0) {
+            // The last triangle's vertices get a fixed score so the next one does not simply reuse its edge
+            if (cachePosition < 3)
+                score = FORSYTH_LAST_TRIANGLE_SCORE;
+            else
+                score = powf(1.0f - (cachePosition - 3) * (1.0f / (FORSYTH_CACHE_SIZE - 3)),
+                             FORSYTH_CACHE_DECAY_POWER);
+        }
+        // Vertices with few triangles left are finished first, so they leave the working set early
+        return score + FORSYTH_VALENCE_BOOST_SCALE * powf((float) remaining, -FORSYTH_VALENCE_BOOST_POWER);
+    }
+
+    void optimizeVertexCache(unsigned int *indices, size_t indexNum, size_t vertexNum) {
+        size_t triangleNum = indexNum / 3;
+        if (triangleNum < 2) return;
+
+        // Triangles around each vertex, packed; the first remaining[v] entries are the ones not yet emitted
+        std::vector<unsigned int> adjacencyOffset(vertexNum + 1, 0);
+        for (size_t i = 0; i < triangleNum * 3; i++) adjacencyOffset[indices[i] + 1]++;
+        for (size_t v = 0; v < vertexNum; v++) adjacencyOffset[v + 1] += adjacencyOffset[v];
+        std::vector<unsigned int> adjacency(triangleNum * 3);
+        std::vector<unsigned int> remaining(vertexNum, 0);
+        for (size_t i = 0; i < triangleNum * 3; i++) {
+            unsigned int v = indices[i];
+            adjacency[adjacencyOffset[v] + remaining[v]++] = (unsigned int) (i / 3);
+        }
+
+        std::vector<int> cachePosition(vertexNum, -1);
+        std::vector<float> score(vertexNum);
+        for (size_t v = 0; v < vertexNum; v++) score[v] = vertexScore(-1, remaining[v]);
+        std::vector<float> triangleScore(triangleNum);
+        for (size_t t = 0; t < triangleNum; t++)
+            triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+        std::vector<unsigned char> emitted(triangleNum, 0);
+        std::vector<unsigned int> output;
+        output.reserve(triangleNum * 3);
+        unsigned int cache[FORSYTH_CACHE_SIZE + 3];
+        int cacheNum = 0;
+        size_t scanCursor = 0;
+        long best = 0;
+
+        while (output.size() < triangleNum * 3) {
+            if (best < 0) {
+                // Nothing in the cache touches a remaining triangle: continue with the next one in input order
+                while (emitted[scanCursor]) scanCursor++;
+                best = (long) scanCursor;
+            }
+            const unsigned int *triangle = indices + best * 3;
+            emitted[best] = 1;
+            for (int k = 0; k < 3; k++) output.push_back(triangle[k]);
+
+            unsigned int newCache[FORSYTH_CACHE_SIZE + 3];
+            int newNum = 0;
+            for (int k = 0; k < 3; k++) {
+                unsigned int v = triangle[k];
+                if (std::find(newCache, newCache + newNum, v) != newCache + newNum) continue;  // degenerate
+                newCache[newNum++] = v;
+                // Drop the triangle from the vertex's remaining list
+                unsigned int *first = &adjacency[adjacencyOffset[v]];
+                unsigned int *last = first + remaining[v];
+                unsigned int *found = std::find(first, last, (unsigned int) best);
+                if (found != last) {
+                    *found = *(last - 1);
+                    remaining[v]--;
+                }
+            }
+            for (int i = 0; i < cacheNum; i++)
+                if (std::find(newCache, newCache + newNum, cache[i]) == newCache + newNum)
+                    newCache[newNum++] = cache[i];
+
+            // Rescore everything that entered, moved within or fell out of the cache
+            for (int i = 0; i < newNum; i++) {
+                unsigned int v = newCache[i];
+                cachePosition[v] = i < FORSYTH_CACHE_SIZE ? i : -1;
+                float newScore = vertexScore(cachePosition[v], remaining[v]);
+                float delta = newScore - score[v];
+                score[v] = newScore;
+                for (unsigned int j = 0; j < remaining[v]; j++)
+                    triangleScore[adjacency[adjacencyOffset[v] + j]] += delta;
+            }
+            cacheNum = std::min(newNum, FORSYTH_CACHE_SIZE);
+            for (int i = 0; i < cacheNum; i++) cache[i] = newCache[i];
+
+            // Only triangles around cached vertices changed their score, so the best one is among them
+            best = -1;
+            float bestScore = -1.0f;
+            for (int i = 0; i < cacheNum; i++) {
+                unsigned int v = cache[i];
+                for (unsigned int j = 0; j < remaining[v]; j++) {
+                    unsigned int t = adjacency[adjacencyOffset[v] + j];
+                    if (triangleScore[t] > bestScore) {
+                        bestScore = triangleScore[t];
+                        best = t;
+                    }
+                }
+            }
+        }
+        std::copy(output.begin(), output.end(), indices);
+    }
+
+    struct Cluster {
+        size_t begin, end;  // triangle range
+        float sortKey;
+    };
+
+    static bool clusterFartherOut(const Cluster &a, const Cluster &b) {
+        return a.sortKey > b.sortKey;
+    }
+
+    // Splits the triangle sequence where the simulated cache restarts anyway (all three vertices miss) and,
+    // when soft is set, also where the cluster so far is within threshold of the mesh ACMR.
+    static void splitClusters(const unsigned int *indices, size_t triangleNum, size_t vertexNum, float meshACMR,
+                              float threshold, bool soft, std::vector<Cluster> &clusters) {
+        std::vector<unsigned int> loadedAt(vertexNum, 0);
+        unsigned int time = MESH_OPTIMIZER_CACHE_SIZE + 1;
+        size_t clusterMisses = 0;
+        clusters.clear();
+        for (size_t t = 0; t < triangleNum; t++) {
+            int misses = 0;
+            for (int k = 0; k < 3; k++) {
+                unsigned int v = indices[t * 3 + k];
+                if (time - loadedAt[v] > MESH_OPTIMIZER_CACHE_SIZE) {
+                    loadedAt[v] = time++;
+                    misses++;
+                }
+            }
+            size_t clusterSize = clusters.empty() ? 0 : t - clusters.back().begin;
+            bool split = clusters.empty() || misses == 3 ||
+                         (soft && misses >= 2 && clusterMisses <= meshACMR * threshold * clusterSize);
+            if (split) {
+                if (!clusters.empty()) clusters.back().end = t;
+                Cluster cluster = {t, triangleNum, 0.0f};
+                clusters.push_back(cluster);
+                clusterMisses = 0;
+            }
+            clusterMisses += misses;
+        }
+    }
+
+    void optimizeOverdraw(unsigned int *indices, size_t indexNum, const float *positions, size_t positionStride,
+                          size_t vertexNum, float threshold) {
+        size_t triangleNum = indexNum / 3;
+        if (triangleNum < 2) return;
+        const char *positionBytes = (const char *) positions;
+#define MESH_OPTIMIZER_POSITION(v) ((const float *) (positionBytes + (size_t) (v) * positionStride))
+
+        float meshCentroid[3] = {0.0f, 0.0f, 0.0f};
+        for (size_t v = 0; v < vertexNum; v++)
+            for (int k = 0; k < 3; k++) meshCentroid[k] += MESH_OPTIMIZER_POSITION(v)[k] / vertexNum;
+
+        float meshACMR = computeACMR(indices, indexNum, vertexNum);
+        std::vector<unsigned int> sorted(indices, indices + triangleNum * 3);
+        for (int pass = 0; pass < 2; pass++) {
+            std::vector<Cluster> clusters;
+            splitClusters(indices, triangleNum, vertexNum, meshACMR, threshold, pass == 0, clusters);
+            if (clusters.size() < 2) return;
+
+            // Clusters that face away from the center are likely to occlude the rest, so they are drawn first
+            for (size_t c = 0; c < clusters.size(); c++) {
+                float centroid[3] = {0.0f, 0.0f, 0.0f}, normal[3] = {0.0f, 0.0f, 0.0f}, area = 0.0f;
+                for (size_t t = clusters[c].begin; t < clusters[c].end; t++) {
+                    const float *p0 = MESH_OPTIMIZER_POSITION(indices[t * 3]);
+                    const float *p1 = MESH_OPTIMIZER_POSITION(indices[t * 3 + 1]);
+                    const float *p2 = MESH_OPTIMIZER_POSITION(indices[t * 3 + 2]);
+                    float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+                    float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+                    float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+                                  e1[0] * e2[1] - e1[1] * e2[0]};
+                    float a = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                    for (int k = 0; k < 3; k++) {
+                        centroid[k] += (p0[k] + p1[k] + p2[k]) * (a / 3.0f);
+                        normal[k] += n[k];
+                    }
+                    area += a;
+                }
+                float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+                float key = 0.0f;
+                if (area > 0.0f && length > 0.0f)
+                    for (int k = 0; k < 3; k++) key += (centroid[k] / area - meshCentroid[k]) * normal[k] / length;
+                clusters[c].sortKey = key;
+            }
+            std::stable_sort(clusters.begin(), clusters.end(), clusterFartherOut);
+
+            size_t write = 0;
+            for (size_t c = 0; c < clusters.size(); c++)
+                for (size_t i = clusters[c].begin * 3; i < clusters[c].end * 3; i++) sorted[write++] = indices[i];
+            // Soft boundaries cost extra misses; fall back to the free ones if they cost too many
+            if (computeACMR(sorted.data(), sorted.size(), vertexNum) <= meshACMR * threshold) break;
+            if (pass == 1) return;
+        }
+        std::copy(sorted.begin(), sorted.end(), indices);
+#undef MESH_OPTIMIZER_POSITION
+    }
+
+    // Sum of squared distances to planes, weighted by triangle area; weight keeps the total area so that
+    // evaluate() / weight is a mean squared distance in position units.
+    struct Quadric {
+        double a00, a01, a02, a11, a12, a22;
+        double b0, b1, b2;
+        double c;
+        double weight;
+
+        Quadric() : a00(0), a01(0), a02(0), a11(0), a12(0), a22(0), b0(0), b1(0), b2(0), c(0), weight(0) {}
+
+        void addPlane(const double n[3], double d, double w) {
+            a00 += w * n[0] * n[0];
+            a01 += w * n[0] * n[1];
+            a02 += w * n[0] * n[2];
+            a11 += w * n[1] * n[1];
+            a12 += w * n[1] * n[2];
+            a22 += w * n[2] * n[2];
+            b0 += w * n[0] * d;
+            b1 += w * n[1] * d;
+            b2 += w * n[2] * d;
+            c += w * d * d;
+            weight += w;
+        }
+
+        void add(const Quadric &q) {
+            a00 += q.a00;
+            a01 += q.a01;
+            a02 += q.a02;
+            a11 += q.a11;
+            a12 += q.a12;
+            a22 += q.a22;
+            b0 += q.b0;
+            b1 += q.b1;
+            b2 += q.b2;
+            c += q.c;
+            weight += q.weight;
+        }
+
+        double evaluate(const float p[3]) const {
+            double x = p[0], y = p[1], z = p[2];
+            double e = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                       2.0 * (b0 * x + b1 * y + b2 * z) + c;
+            return e > 0.0 ? e : 0.0;
+        }
+    };
+
+    struct Collapse {
+        float cost;  // mean squared distance
+        unsigned int from, to;
+        unsigned int fromVersion, toVersion;
+
+        bool operator<(const Collapse &other) const { return cost > other.cost; }  // min-heap
+    };
+
+    static void faceNormal(const float *p0, const float *p1, const float *p2, double n[3]) {
+        double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], (double) p1[2] - p0[2]};
+        double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], (double) p2[2] - p0[2]};
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    }
+
+    size_t simplify(unsigned int *destination, const unsigned int *indices, size_t indexNum,
+                    const float *positions, size_t positionStride, size_t vertexNum,
+                    const unsigned int *vertexGroups, size_t targetIndexNum, float maxError, float *resultError) {
+        size_t triangleNum = indexNum / 3;
+        const char *positionBytes = (const char *) positions;
+#define MESH_OPTIMIZER_POSITION(v) ((const float *) (positionBytes + (size_t) (v) * positionStride))
+        std::vector<unsigned int> triangles(indices, indices + triangleNum * 3);
+        std::vector<unsigned char> triangleAlive(triangleNum, 1);
+        std::vector<std::vector<unsigned int> > vertexTriangles(vertexNum);
+        std::vector<Quadric> quadrics(vertexNum);
+        std::vector<unsigned char> locked(vertexNum, 0);
+        std::vector<unsigned char> vertexAlive(vertexNum, 1);
+        std::vector<unsigned int> version(vertexNum, 0);
+
+        // Edges used by exactly one triangle are borders, more than two make the surface non-manifold
+        std::unordered_map<unsigned long long, unsigned int> edgeUse;
+        for (size_t t = 0; t < triangleNum; t++) {
+            const unsigned int *tri = &triangles[t * 3];
+            double n[3];
+            faceNormal(MESH_OPTIMIZER_POSITION(tri[0]), MESH_OPTIMIZER_POSITION(tri[1]),
+                       MESH_OPTIMIZER_POSITION(tri[2]), n);
+            double area = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (area > 0.0) {
+                for (int k = 0; k < 3; k++) n[k] /= area;
+                const float *p0 = MESH_OPTIMIZER_POSITION(tri[0]);
+                double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+                for (int k = 0; k < 3; k++) quadrics[tri[k]].addPlane(n, d, area);
+            }
+            for (int k = 0; k < 3; k++) {
+                vertexTriangles[tri[k]].push_back((unsigned int) t);
+                unsigned int u = tri[k], v = tri[(k + 1) % 3];
+                edgeUse[u < v ? ((unsigned long long) u << 32 | v) : ((unsigned long long) v << 32 | u)]++;
+            }
+        }
+        for (std::unordered_map<unsigned long long, unsigned int>::const_iterator it = edgeUse.begin();
+             it != edgeUse.end(); ++it) {
+            if (it->second == 2) continue;
+            locked[(unsigned int) (it->first >> 32)] = 1;
+            locked[(unsigned int) (it->first & 0xffffffffu)] = 1;
+        }
+
+        std::priority_queue<Collapse> heap;
+        // Queues from -> to when the move is allowed at all
+        auto push = [&](unsigned int from, unsigned int to) {
+            if (from == to || locked[from] || (vertexGroups && vertexGroups[from] != vertexGroups[to])) return;
+            Quadric q = quadrics[from];
+            q.add(quadrics[to]);
+            Collapse collapse;
+            collapse.cost = (float) (q.weight > 0.0 ? q.evaluate(MESH_OPTIMIZER_POSITION(to)) / q.weight : 0.0);
+            collapse.from = from;
+            collapse.to = to;
+            collapse.fromVersion = version[from];
+            collapse.toVersion = version[to];
+            heap.push(collapse);
+        };
+        for (size_t t = 0; t < triangleNum; t++)
+            for (int k = 0; k < 3; k++) {
+                push(triangles[t * 3 + k], triangles[t * 3 + (k + 1) % 3]);
+                push(triangles[t * 3 + (k + 1) % 3], triangles[t * 3 + k]);
+            }
+
+        size_t aliveNum = triangleNum;
+        float reached = 0.0f;
+        while (aliveNum * 3 > targetIndexNum && !heap.empty()) {
+            Collapse collapse = heap.top();
+            heap.pop();
+            unsigned int from = collapse.from, to = collapse.to;
+            if (!vertexAlive[from] || !vertexAlive[to] || version[from] != collapse.fromVersion ||
+                version[to] != collapse.toVersion)
+                continue;  // stale: one of the vertices moved on since this was queued
+            float error = sqrtf(collapse.cost);
+            if (error > maxError) break;
+
+            // Moving from onto to must not flip any remaining triangle around from
+            bool flips = false;
+            const float *target = MESH_OPTIMIZER_POSITION(to);
+            for (size_t i = 0; i < vertexTriangles[from].size() && !flips; i++) {
+                unsigned int t = vertexTriangles[from][i];
+                const unsigned int *tri = &triangles[t * 3];
+                if (!triangleAlive[t] || tri[0] == to || tri[1] == to || tri[2] == to) continue;
+                const float *p[3], *q[3];
+                for (int k = 0; k < 3; k++) {
+                    p[k] = MESH_OPTIMIZER_POSITION(tri[k]);
+                    q[k] = tri[k] == from ? target : p[k];
+                }
+                double before[3], after[3];
+                faceNormal(p[0], p[1], p[2], before);
+                faceNormal(q[0], q[1], q[2], after);
+                flips = before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0;
+            }
+            if (flips) continue;
+
+            reached = std::max(reached, error);
+            vertexAlive[from] = 0;
+            quadrics[to].add(quadrics[from]);
+            version[to]++;
+            for (size_t i = 0; i < vertexTriangles[from].size(); i++) {
+                unsigned int t = vertexTriangles[from][i];
+                if (!triangleAlive[t]) continue;
+                unsigned int *tri = &triangles[t * 3];
+                if (tri[0] == to || tri[1] == to || tri[2] == to) {
+                    triangleAlive[t] = 0;  // the collapsed edge degenerates
+                    aliveNum--;
+                    continue;
+                }
+                for (int k = 0; k < 3; k++)
+                    if (tri[k] == from) tri[k] = to;
+                vertexTriangles[to].push_back(t);
+            }
+            std::vector<unsigned int>().swap(vertexTriangles[from]);
+
+            // Costs around the merged vertex changed
+            for (size_t i = 0; i < vertexTriangles[to].size(); i++) {
+                unsigned int t = vertexTriangles[to][i];
+                if (!triangleAlive[t]) continue;
+                for (int k = 0; k < 3; k++) {
+                    unsigned int other = triangles[t * 3 + k];
+                    if (other == to) continue;
+                    push(to, other);
+                    push(other, to);
+                }
+            }
+        }
+
+        size_t written = 0;
+        for (size_t t = 0; t < triangleNum; t++) {
+            if (!triangleAlive[t]) continue;
+            for (int k = 0; k < 3; k++) destination[written++] = triangles[t * 3 + k];
+        }
+        if (resultError) *resultError = reached;
+        return written;
+#undef MESH_OPTIMIZER_POSITION
+    }
+
+    void optimizeVertexFetch(unsigned int *indices, size_t indexNum, size_t vertexNum,
+                             std::vector<unsigned int> &remap) {
+        const unsigned int unused = ~0u;
+        remap.assign(vertexNum, unused);
+        unsigned int next = 0;
+        for (size_t i = 0; i < indexNum; i++) {
+            unsigned int &target = remap[indices[i]];
+            if (target == unused) target = next++;
+            indices[i] = target;
+        }
+        for (size_t v = 0; v < vertexNum; v++)
+            if (remap[v] == unused) remap[v] = next++;
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Post-transform cache size the reports and the overdraw pass assume; a conservative value for current GPUs.
+#define MESH_OPTIMIZER_CACHE_SIZE 16
+// Overdraw ordering may worsen the ACMR of the cache-optimized order by at most this factor.
+#define MESH_OPTIMIZER_OVERDRAW_THRESHOLD 1.05f
+
+namespace MeshOptimizer {
+    // Average cache miss ratio: transformed vertices per triangle with a FIFO cache of cacheSize entries.
+    // 3.0 is the worst case, about 0.5-0.7 is typical of a well ordered closed mesh.
+    float computeACMR(const unsigned int *indices, size_t indexNum, size_t vertexNum,
+                      unsigned int cacheSize = MESH_OPTIMIZER_CACHE_SIZE);
+
+    // Reorders triangles in place for post-transform cache locality (Forsyth's linear-speed algorithm).
+    void optimizeVertexCache(unsigned int *indices, size_t indexNum, size_t vertexNum);
+
+    // Reorders clusters of a cache-optimized index buffer so that outward-facing clusters come first
+    // (Tipsify-style), keeping the ACMR within threshold of its current value. positions are float3,
+    // positionStride bytes apart.
+    void optimizeOverdraw(unsigned int *indices, size_t indexNum, const float *positions, size_t positionStride,
+                          size_t vertexNum, float threshold = MESH_OPTIMIZER_OVERDRAW_THRESHOLD);
+
+    // Quadric error edge collapse: collapses vertices into neighbours, cheapest first, until at most
+    // targetIndexNum indices remain or the next collapse would move the surface by more than maxError.
+    // Vertices on border edges never move; since seams in UVs or normals split vertices, this keeps those
+    // seams intact. With vertexGroups, a vertex only collapses into one of the same group, e.g. the same
+    // dominant bone, so skinning boundaries survive too. Writes the kept triangles to destination (room for
+    // indexNum indices) and returns their index count; resultError receives the largest error reached.
+    size_t simplify(unsigned int *destination, const unsigned int *indices, size_t indexNum,
+                    const float *positions, size_t positionStride, size_t vertexNum,
+                    const unsigned int *vertexGroups, size_t targetIndexNum, float maxError, float *resultError);
+
+    // Numbers vertices in order of first use and rewrites the indices accordingly; remap[old] is the new index.
+    // Vertices no triangle references keep their relative order after all referenced ones.
+    void optimizeVertexFetch(unsigned int *indices, size_t indexNum, size_t vertexNum,
+                             std::vector<unsigned int> &remap);
+}
@@ -0,0 +1,392 @@
+#include "shader_program.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <glm/gtc/type_ptr.hpp>
+
+namespace ShaderProgram {
+    namespace {
+        // Bytes of one element of a uniform; everything not listed (ints, bools, samplers) is one 32-bit word
+        size_t typeSize(GLenum type) {
+            switch (type) {
+                case GL_FLOAT_VEC2:
+                case GL_INT_VEC2:
+                case GL_BOOL_VEC2:
+                    return 2 * sizeof(GLfloat);
+                case GL_FLOAT_VEC3:
+                case GL_INT_VEC3:
+                case GL_BOOL_VEC3:
+                    return 3 * sizeof(GLfloat);
+                case GL_FLOAT_VEC4:
+                case GL_INT_VEC4:
+                case GL_BOOL_VEC4:
+                case GL_FLOAT_MAT2:
+                    return 4 * sizeof(GLfloat);
+                case GL_FLOAT_MAT3:
+                    return 9 * sizeof(GLfloat);
+                case GL_FLOAT_MAT4:
+                    return 16 * sizeof(GLfloat);
+                default:
+                    return sizeof(GLint);
+            }
+        }
+
+        bool isFloatType(GLenum type) {
+            switch (type) {
+                case GL_FLOAT:
+                case GL_FLOAT_VEC2:
+                case GL_FLOAT_VEC3:
+                case GL_FLOAT_VEC4:
+                case GL_FLOAT_MAT2:
+                case GL_FLOAT_MAT3:
+                case GL_FLOAT_MAT4:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        GLuint compile(GLenum stage, const char *source) {
+            GLuint shader = glCreateShader(stage);
+            glShaderSource(shader, 1, &source, NULL);
+            glCompileShader(shader);
+            GLint success;
+            glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+            if (!success) {
+                GLint length = 0;
+                glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+                std::vector<GLchar> infoLog(std::max(length, 1), 0);
+                glGetShaderInfoLog(shader, (GLsizei) infoLog.size(), NULL, infoLog.data());
+                std::cout << (stage == GL_VERTEX_SHADER ? "Vertex" : "Fragment")
+                          << " shader compilation failed: " << infoLog.data() << std::endl;
+                glDeleteShader(shader);
+                return 0;
+            }
+            return shader;
+        }
+
+        void printLinkLog(GLuint program) {
+            GLint length = 0;
+            glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+            std::vector<GLchar> infoLog(std::max(length, 1), 0);
+            glGetProgramInfoLog(program, (GLsizei) infoLog.size(), NULL, infoLog.data());
+            std::cout << "Shader program linking failed: " << infoLog.data() << std::endl;
+        }
+
+        // Inserts the defines right after the #version line; #line keeps error line numbers those of _source.
+        std::string specialize(const char *_source, const Defines &_defines) {
+            std::string source(_source);
+            size_t versionEnd = source.compare(0, 8, "#version") == 0 ? source.find('\n') : std::string::npos;
+            if (versionEnd == std::string::npos) return source;
+            std::string header;
+            for (size_t i = 0; i < _defines.size(); i++)
+                header += "#define " + _defines[i].first + " " + std::to_string(_defines[i].second) + "\n";
+            header += "#line 2\n";
+            return source.insert(versionEnd + 1, header);
+        }
+
+        // Identifies the driver that produced a program binary; binaries from another one are not reused.
+        FileCache::Hash driverHash() {
+            FileCache::Hash hash = FileCache::HASH_SEED;
+            const GLenum names[] = {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION};
+            for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+                const GLubyte *value = glGetString(names[i]);
+                if (value) hash = FileCache::hashString((const char *) value, hash);
+                hash = FileCache::hashBytes("\n", 1, hash);
+            }
+            return hash;
+        }
+
+        bool binarySupported() {
+            if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) return false;
+            GLint formatNum = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatNum);
+            return formatNum > 0;
+        }
+    }
+
+    std::string Program::cacheDirectory;
+
+    Program::Program()
+            : program(0), loadedBinary(false), uploads(0), skipped(0) {}
+
+    Program::~Program() { destroy(); }
+
+    bool Program::build(const char *vertexSource, const char *fragmentSource, const Defines &defines,
+                        const FeedbackVaryings &feedback) {
+        destroy();
+        std::string vertexText = specialize(vertexSource, defines);
+        std::string fragmentText = specialize(fragmentSource, defines);
+
+        bool useBinary = !cacheDirectory.empty() && binarySupported();
+        FileCache::Hash driver = 0, source = 0;
+        std::string binaryFilename;
+        if (useBinary) {
+            driver = driverHash();
+            source = FileCache::hashString(fragmentText, FileCache::hashString(vertexText));
+            for (size_t i = 0; i < feedback.size(); i++)  // linked into the binary, so part of its identity
+                source = FileCache::hashString(feedback[i] + ";", source);
+            binaryFilename = cacheDirectory + "/program-" + FileCache::hashToHex(source ^ driver) +
+                             SHADER_PROGRAM_BINARY_SUFFIX;
+            if (loadBinary(binaryFilename, driver, source)) {
+                reflect();
+                return true;
+            }
+        }
+
+        GLuint vertexShader = compile(GL_VERTEX_SHADER, vertexText.c_str());
+        GLuint fragmentShader = compile(GL_FRAGMENT_SHADER, fragmentText.c_str());
+        if (!vertexShader || !fragmentShader) {
+            glDeleteShader(vertexShader);
+            glDeleteShader(fragmentShader);
+            return false;
+        }
+
+        program = glCreateProgram();
+        glAttachShader(program, vertexShader);
+        glAttachShader(program, fragmentShader);
+        if (!feedback.empty()) {
+            std::vector<const GLchar *> names(feedback.size());
+            for (size_t i = 0; i < feedback.size(); i++) names[i] = feedback[i].c_str();
+            glTransformFeedbackVaryings(program, (GLsizei) names.size(), names.data(), GL_INTERLEAVED_ATTRIBS);
+        }
+        if (useBinary) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(program);
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+
+        GLint success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            printLinkLog(program);
+            destroy();
+            return false;
+        }
+
+        if (useBinary && !saveBinary(binaryFilename, driver, source))
+            std::cout << "Error writing program binary " << binaryFilename << std::endl;
+        reflect();
+        return true;
+    }
+
+    bool Program::loadBinary(const std::string &filename, FileCache::Hash driver, FileCache::Hash source) {
+        FileCache::MappedFile file;
+        if (!file.open(filename)) return false;
+        const BinaryHeader *header = file.view<BinaryHeader>(0);
+        if (!header || header->magic != SHADER_PROGRAM_BINARY_MAGIC || header->version != SHADER_PROGRAM_BINARY_VERSION ||
+            header->driverHash != driver || header->sourceHash != source)
+            return false;
+        const char *binary = file.view<char>(sizeof(BinaryHeader), header->size);
+        if (!binary) return false;
+
+        program = glCreateProgram();
+        glProgramBinary(program, header->format, binary, (GLsizei) header->size);
+        GLint success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {  // e.g. the driver changed its compiler without changing its version string
+            GLState::deleteProgram(program);
+            program = 0;
+            return false;
+        }
+        loadedBinary = true;
+        return true;
+    }
+
+    bool Program::saveBinary(const std::string &filename, FileCache::Hash driver, FileCache::Hash source) const {
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) return false;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(program, length, &length, &format, binary.data());
+
+        BinaryHeader header = {SHADER_PROGRAM_BINARY_MAGIC, SHADER_PROGRAM_BINARY_VERSION, driver, source,
+                               format, (unsigned int) length};
+        FileCache::BlobWriter writer;
+        writer.append(&header, sizeof(header));
+        writer.append(binary.data(), (size_t) length, 1);
+        return writer.save(filename);
+    }
+
+    void Program::destroy() {
+        GLState::deleteProgram(program);
+        program = 0;
+        loadedBinary = false;
+        uniformTable.clear();
+        blockTable.clear();
+        attributeTable.clear();
+        uniformIndex.clear();
+        cache.clear();
+        resetCounters();
+    }
+
+    void Program::reflect() {
+        GLint count = 0, maxLength = 0;
+        std::vector<GLchar> name;
+
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        name.resize(std::max(maxLength, 1));
+        for (GLint i = 0; i < count; i++) {
+            // Block members have no location and are written through their buffer instead
+            GLuint index = (GLuint) i;
+            GLint blockIndex;
+            glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &blockIndex);
+            if (blockIndex != -1) continue;
+
+            UniformInfo info;
+            GLsizei length = 0;
+            glGetActiveUniform(program, index, (GLsizei) name.size(), &length, &info.size, &info.type, name.data());
+            info.name.assign(name.data(), length);
+            if (info.name.size() > 3 && info.name.compare(info.name.size() - 3, 3, "[0]") == 0)
+                info.name.resize(info.name.size() - 3);
+            info.location = glGetUniformLocation(program, name.data());
+            info.cacheOffset = cache.size();
+            info.written = false;
+            cache.resize(cache.size() + typeSize(info.type) * info.size);
+            uniformIndex[info.name] = (Uniform) uniformTable.size();
+            uniformTable.push_back(info);
+        }
+
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+        name.resize(std::max(maxLength, 1));
+        for (GLint i = 0; i < count; i++) {
+            UniformBlockInfo info;
+            GLsizei length = 0;
+            info.index = (GLuint) i;
+            glGetActiveUniformBlockName(program, info.index, (GLsizei) name.size(), &length, name.data());
+            info.name.assign(name.data(), length);
+            glGetActiveUniformBlockiv(program, info.index, GL_UNIFORM_BLOCK_DATA_SIZE, &info.dataSize);
+            GLint binding = 0;
+            glGetActiveUniformBlockiv(program, info.index, GL_UNIFORM_BLOCK_BINDING, &binding);
+            info.binding = (GLuint) binding;
+            blockTable.push_back(info);
+        }
+
+        glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+        glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+        name.resize(std::max(maxLength, 1));
+        for (GLint i = 0; i < count; i++) {
+            AttributeInfo info;
+            GLsizei length = 0;
+            glGetActiveAttrib(program, (GLuint) i, (GLsizei) name.size(), &length, &info.size, &info.type,
+                              name.data());
+            info.name.assign(name.data(), length);
+            info.location = glGetAttribLocation(program, name.data());
+            attributeTable.push_back(info);
+        }
+    }
+
+    Program::Uniform Program::uniform(const std::string &name) const {
+        std::map<std::string, Uniform>::const_iterator it = uniformIndex.find(name);
+        return it == uniformIndex.end() ? -1 : it->second;
+    }
+
+    GLuint Program::uniformBlock(const std::string &name) const {
+        for (size_t i = 0; i < blockTable.size(); i++)
+            if (blockTable[i].name == name) return blockTable[i].index;
+        return GL_INVALID_INDEX;
+    }
+
+    bool Program::bindUniformBlock(const std::string &name, GLuint binding) {
+        for (size_t i = 0; i < blockTable.size(); i++) {
+            if (blockTable[i].name != name) continue;
+            if (blockTable[i].binding != binding) {
+                glUniformBlockBinding(program, blockTable[i].index, binding);
+                blockTable[i].binding = binding;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    GLint Program::attribute(const std::string &name) const {
+        for (size_t i = 0; i < attributeTable.size(); i++)
+            if (attributeTable[i].name == name) return attributeTable[i].location;
+        return -1;
+    }
+
+    bool Program::update(Uniform u, GLenum type, const void *value, size_t size) {
+        if (u < 0 || (size_t) u >= uniformTable.size()) return false;
+        UniformInfo &info = uniformTable[u];
+        if (size > typeSize(info.type) * info.size || (type == GL_INT) == isFloatType(info.type)) {
+            std::cout << "Uniform " << info.name << " does not take a value of type 0x" << std::hex << type
+                      << std::dec << std::endl;
+            return false;
+        }
+        unsigned char *cached = cache.data() + info.cacheOffset;
+        if (info.written && memcmp(cached, value, size) == 0) {
+            skipped++;
+            return false;
+        }
+        memcpy(cached, value, size);
+        info.written = true;
+        uploads++;
+        return true;
+    }
+
+    void Program::set(Uniform u, GLint value) {
+        if (update(u, GL_INT, &value, sizeof(value))) glUniform1i(uniformTable[u].location, value);
+    }
+
+    void Program::set(Uniform u, GLfloat value) {
+        if (update(u, GL_FLOAT, &value, sizeof(value))) glUniform1f(uniformTable[u].location, value);
+    }
+
+    void Program::set(Uniform u, const glm::fvec2 &value) {
+        if (update(u, GL_FLOAT_VEC2, glm::value_ptr(value), sizeof(value)))
+            glUniform2fv(uniformTable[u].location, 1, glm::value_ptr(value));
+    }
+
+    void Program::set(Uniform u, const glm::fvec3 &value) {
+        if (update(u, GL_FLOAT_VEC3, glm::value_ptr(value), sizeof(value)))
+            glUniform3fv(uniformTable[u].location, 1, glm::value_ptr(value));
+    }
+
+    void Program::set(Uniform u, const glm::fvec4 &value) {
+        if (update(u, GL_FLOAT_VEC4, glm::value_ptr(value), sizeof(value)))
+            glUniform4fv(uniformTable[u].location, 1, glm::value_ptr(value));
+    }
+
+    void Program::set(Uniform u, const glm::fmat4 &value) {
+        if (update(u, GL_FLOAT_MAT4, glm::value_ptr(value), sizeof(value)))
+            glUniformMatrix4fv(uniformTable[u].location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    void Program::set(Uniform u, const glm::fmat4 *values, GLsizei count) {
+        if (count > 0 && update(u, GL_FLOAT_MAT4, values, sizeof(glm::fmat4) * count))
+            glUniformMatrix4fv(uniformTable[u].location, count, GL_FALSE, (const GLfloat *) values);
+    }
+
+    Permutations::Permutations(const char *_vertexSource, const char *_fragmentSource)
+            : vertexSource(_vertexSource), fragmentSource(_fragmentSource) {}
+
+    Permutations::~Permutations() { clear(); }
+
+    Program *Permutations::get(const Defines &defines, const FeedbackVaryings &feedback) {
+        std::string key;
+        for (size_t i = 0; i < defines.size(); i++)
+            key += defines[i].first + "=" + std::to_string(defines[i].second) + ";";
+        for (size_t i = 0; i < feedback.size(); i++)
+            key += "feedback:" + feedback[i] + ";";
+        std::map<std::string, Program *>::iterator it = variants.find(key);
+        if (it != variants.end()) return it->second;
+
+        Program *program = new Program();
+        if (!program->build(vertexSource, fragmentSource, defines, feedback)) {
+            std::cout << "Failed to build shader variant " << key << std::endl;
+            delete program;
+            program = NULL;
+        }
+        variants[key] = program;
+        return program;
+    }
+
+    void Permutations::clear() {
+        for (std::map<std::string, Program *>::iterator it = variants.begin(); it != variants.end(); ++it)
+            delete it->second;
+        variants.clear();
+    }
+}
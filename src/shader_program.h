@@ -0,0 +1,157 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "file_cache.h"
+#include "gl_state.h"
+
+// Header of a cached program binary file, followed by the driver's binary itself.
+#define SHADER_PROGRAM_BINARY_MAGIC 0x4e494250u  // "PBIN"
+#define SHADER_PROGRAM_BINARY_VERSION 1
+#define SHADER_PROGRAM_BINARY_SUFFIX ".glbin"
+
+namespace ShaderProgram {
+    // Preprocessor defines a program is specialized with, emitted in this order after the #version line.
+    typedef std::vector<std::pair<std::string, int> > Defines;
+    // Vertex shader outputs captured by transform feedback, interleaved into one buffer in this order.
+    typedef std::vector<std::string> FeedbackVaryings;
+
+    struct UniformInfo {
+        std::string name;  // arrays without the trailing "[0]"
+        GLint location;
+        GLenum type;
+        GLint size;          // array length, 1 for plain uniforms
+        size_t cacheOffset;  // of the last written value in Program::cache
+        bool written;        // false until the first set(), so that one always reaches GL
+    };
+
+    struct UniformBlockInfo {
+        std::string name;
+        GLuint index;
+        GLint dataSize;
+        GLuint binding;
+    };
+
+    struct AttributeInfo {
+        std::string name;
+        GLint location;
+        GLenum type;
+        GLint size;
+    };
+
+    // A linked program with its active uniforms, uniform blocks and attributes reflected once at link time.
+    // Uniforms are addressed by handles, indices into the reflected table resolved once after linking, and
+    // set through typed setters that keep the last value written and skip uploads that would not change it.
+    // The cache assumes every write goes through the setters; setters apply to the program in use.
+    class Program {
+    public:
+        typedef int Uniform;  // -1 for names that are not active; setting it is a no-op
+
+        Program();
+        ~Program();
+
+        // Directory for linked program binaries; empty (the default) always compiles from source.
+        static std::string cacheDirectory;
+
+        // Specializes both sources with the defines, then compiles, links and reflects; errors go to std::cout
+        // with the info log. With a cache directory and driver support, a binary linked earlier from the same
+        // sources by the same driver is loaded instead, and a freshly linked one is saved for the next start.
+        // With feedback varyings, the program is linked for interleaved transform feedback of those outputs.
+        bool build(const char *vertexSource, const char *fragmentSource, const Defines &defines = Defines(),
+                   const FeedbackVaryings &feedback = FeedbackVaryings());
+        void destroy();
+
+        // Whether the last build() was served by a cached binary
+        bool fromCache() const { return loadedBinary; }
+
+        GLuint id() const { return program; }
+
+        bool isValid() const { return program != 0; }
+
+        void use() const { GLState::useProgram(program); }
+
+        Uniform uniform(const std::string &name) const;
+        // GL_INVALID_INDEX for blocks that are not active
+        GLuint uniformBlock(const std::string &name) const;
+        bool bindUniformBlock(const std::string &name, GLuint binding);
+        // -1 for attributes that are not active
+        GLint attribute(const std::string &name) const;
+
+        const std::vector<UniformInfo> &uniforms() const { return uniformTable; }
+
+        const std::vector<UniformBlockInfo> &uniformBlocks() const { return blockTable; }
+
+        const std::vector<AttributeInfo> &attributes() const { return attributeTable; }
+
+        // int, bool and sampler uniforms
+        void set(Uniform u, GLint value);
+        void set(Uniform u, GLfloat value);
+        void set(Uniform u, const glm::fvec2 &value);
+        void set(Uniform u, const glm::fvec3 &value);
+        void set(Uniform u, const glm::fvec4 &value);
+        void set(Uniform u, const glm::fmat4 &value);
+        void set(Uniform u, const glm::fmat4 *values, GLsizei count);
+
+        // Uploads made and skipped since the last resetCounters(), to measure the cache
+        size_t uploadNum() const { return uploads; }
+
+        size_t skippedNum() const { return skipped; }
+
+        void resetCounters() { uploads = skipped = 0; }
+
+    private:
+        struct BinaryHeader {
+            unsigned int magic;
+            unsigned int version;
+            FileCache::Hash driverHash;
+            FileCache::Hash sourceHash;
+            GLenum format;
+            unsigned int size;
+        };
+
+        GLuint program;
+        bool loadedBinary;
+        std::vector<UniformInfo> uniformTable;
+        std::vector<UniformBlockInfo> blockTable;
+        std::vector<AttributeInfo> attributeTable;
+        std::map<std::string, Uniform> uniformIndex;
+        std::vector<unsigned char> cache;
+        size_t uploads;
+        size_t skipped;
+
+        bool loadBinary(const std::string &filename, FileCache::Hash driver, FileCache::Hash source);
+        bool saveBinary(const std::string &filename, FileCache::Hash driver, FileCache::Hash source) const;
+        void reflect();
+        // Copies the value into the cache; false when it is unchanged or the handle does not fit
+        bool update(Uniform u, GLenum type, const void *value, size_t size);
+
+        Program(const Program &_copy);
+        Program &operator=(const Program &_copy);
+    };
+
+    // Specialized variants of one vertex/fragment source pair, built on first request and kept until clear().
+    // Features are resolved by the preprocessor, so a variant carries no branches on them.
+    class Permutations {
+    public:
+        Permutations(const char *_vertexSource, const char *_fragmentSource);
+        ~Permutations();
+
+        // The variant for the defines and feedback varyings, NULL when it fails to build; the failure is not retried.
+        Program *get(const Defines &defines, const FeedbackVaryings &feedback = FeedbackVaryings());
+        void clear();
+
+        size_t variantNum() const { return variants.size(); }
+
+    private:
+        const char *vertexSource;
+        const char *fragmentSource;
+        std::map<std::string, Program *> variants;
+
+        Permutations(const Permutations &_copy);
+        Permutations &operator=(const Permutations &_copy);
+    };
+}
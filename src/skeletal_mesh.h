@@ -8,22 +8,67 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cstring>
+#include <cfloat>
 
 #include "gl_env.h"
+#include "gl_state.h"
 
 #include "texture_image.h"
+#include "file_cache.h"
+#include "mesh_optimizer.h"
+#include "cpu_skinning.h"
+#include "bone_compose.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
 
 #define SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL 0
 
 #define SCENE_RESOURCE_BONE_PER_VERTEX 4
+// Weights below this are dropped at import, the rest renormalized to sum 1; unorm8 would round them away anyway
+#define SCENE_WEIGHT_MIN (1.0f / 255.0f)
+// Every level is split into influence buckets: bucket b holds the triangles whose vertices use at most b bone
+// weights, the last one those that need all SCENE_RESOURCE_BONE_PER_VERTEX. Each bucket can then be drawn with
+// a shader reading only that many weights; bucket 0 is not skinned at all.
+#define SCENE_INFLUENCE_BUCKET_NUM 4
+
+// Post-import optimization passes, applied per mesh entry before baking
+#define SCENE_OPTIMIZE_VERTEX_CACHE 1u  // triangle order for the post-transform cache
+#define SCENE_OPTIMIZE_OVERDRAW 2u      // then outward-facing triangle clusters first
+#define SCENE_OPTIMIZE_VERTEX_FETCH 4u  // vertex order of first use
+#define SCENE_OPTIMIZE_ALL (SCENE_OPTIMIZE_VERTEX_CACHE | SCENE_OPTIMIZE_OVERDRAW | SCENE_OPTIMIZE_VERTEX_FETCH)
+
+// Level of detail chain built at import: each level targets SCENE_LOD_RATIO of the previous level's triangles,
+// and the chain ends early once a level no longer gets below SCENE_LOD_MIN_REDUCTION (seams are locked).
+#define SCENE_LOD_MAX 4  // including the full mesh
+#define SCENE_LOD_RATIO 0.5f
+#define SCENE_LOD_MIN_REDUCTION 0.8f
+// A level is drawn once its simplification error projects to at most this many pixels
+#define SCENE_LOD_PIXEL_ERROR 1.0f
+
+// Bone ids of the quantized layout are 8-bit, so larger skeletons keep the full layout
+#define SCENE_QUANTIZED_MAX_BONES 256
+
+#define SCENE_RESOURCE_IMPORT_FLAGS \
+        (aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices)
+
+// Baked scene file: a BakeHeader followed by aligned sections, addressed by byte offsets from the file start.
+#define SCENE_BAKE_MAGIC 0x454b4248u  // "HBKE"
+#define SCENE_BAKE_VERSION 5
+#define SCENE_BAKE_SUFFIX ".hbake"
+#define SCENE_BAKE_NO_STRING 0xffffffffu
 
 namespace SkeletalMesh {
-    typedef std::map<std::string, glm::fmat4> SkeletonModifier;
+    // Index of a bone in a Scene's skeleton, resolved once with Scene::findBone()
+    typedef int BoneHandle;
+    const BoneHandle INVALID_BONE = -1;
 
     struct ParametricVertex {
         float position[3];
@@ -56,8 +101,101 @@ namespace SkeletalMesh {
             }
             return false;
         }
+
+        // Sorts the influences by decreasing weight, drops those below SCENE_WEIGHT_MIN and rescales the rest
+        // to sum 1. Returns how many are left; the slots past them are 0.
+        unsigned int normalizeWeights() {
+            for (int i = 1; i < SCENE_RESOURCE_BONE_PER_VERTEX; i++)
+                for (int j = i; j > 0 && boneWeight[j] > boneWeight[j - 1]; j--) {
+                    std::swap(boneWeight[j], boneWeight[j - 1]);
+                    std::swap(boneId[j], boneId[j - 1]);
+                }
+            unsigned int influences = 0;
+            float sum = 0.0f;
+            while (influences < SCENE_RESOURCE_BONE_PER_VERTEX && boneWeight[influences] >= SCENE_WEIGHT_MIN)
+                sum += boneWeight[influences++];
+            for (unsigned int i = 0; i < SCENE_RESOURCE_BONE_PER_VERTEX; i++) {
+                boneWeight[i] = i < influences ? boneWeight[i] / sum : 0.0f;
+                if (i >= influences) boneId[i] = 0;
+            }
+            return influences;
+        }
+    };
+
+    // Bucket of a vertex or triangle using that many bone weights
+    inline unsigned int influenceBucket(unsigned int influences) {
+        return std::min(influences, (unsigned int) SCENE_INFLUENCE_BUCKET_NUM - 1);
+    }
+
+    // Bone weights a shader has to read for a bucket
+    inline unsigned int bucketInfluenceNum(unsigned int bucket) {
+        return bucket + 1 < SCENE_INFLUENCE_BUCKET_NUM ? bucket : SCENE_RESOURCE_BONE_PER_VERTEX;
+    }
+
+    // Compact layout, 24 bytes instead of 64. Positions and texcoords are unorm16 within the scene bounds and
+    // are restored with the terms of Scene::getDequantize(); normals are octahedral snorm16, decoded as
+    //     n = vec3(e, 1 - |e.x| - |e.y|); n.xy -= sign(n.xy) * max(-n.z, 0); n = normalize(n)
+    // Bone ids are uint8 and the weights unorm8, renormalized so that they sum to exactly 255.
+    struct QuantizedVertex {
+        unsigned short position[4];  // the fourth component only pads the attribute to 8 bytes
+        unsigned short texcoord[2];
+        short normal[2];
+        unsigned char boneId[SCENE_RESOURCE_BONE_PER_VERTEX];
+        unsigned char boneWeight[SCENE_RESOURCE_BONE_PER_VERTEX];
+    };
+
+    enum VertexFormat {
+        VERTEX_FORMAT_FULL,      // ParametricVertex
+        VERTEX_FORMAT_QUANTIZED  // QuantizedVertex
+    };
+
+    struct Dequantize {
+        glm::fvec3 positionScale, positionBias;
+        glm::fvec4 texcoordTransf;  // xy scale, zw bias
     };
 
+    inline unsigned short quantizeUnorm16(float _v) {
+        return (unsigned short) (std::min(std::max(_v, 0.0f), 1.0f) * 65535.0f + 0.5f);
+    }
+
+    inline short quantizeSnorm16(float _v) {
+        float v = std::min(std::max(_v, -1.0f), 1.0f) * 32767.0f;
+        return (short) (v < 0.0f ? v - 0.5f : v + 0.5f);
+    }
+
+    // Projects the unit sphere onto an octahedron and unfolds the lower half, so two components suffice
+    inline void encodeOctahedral(const float _n[3], short _e[2]) {
+        float l1 = std::fabs(_n[0]) + std::fabs(_n[1]) + std::fabs(_n[2]);
+        float x = l1 > 0.0f ? _n[0] / l1 : 0.0f;
+        float y = l1 > 0.0f ? _n[1] / l1 : 0.0f;
+        if (l1 > 0.0f && _n[2] < 0.0f) {
+            float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+            float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+            x = fx;
+            y = fy;
+        }
+        _e[0] = quantizeSnorm16(x);
+        _e[1] = quantizeSnorm16(y);
+    }
+
+    // Rounds the weights to unorm8 and hands the rounding error to the largest one, so the sum stays 255
+    inline void quantizeWeights(const float _w[SCENE_RESOURCE_BONE_PER_VERTEX],
+                                unsigned char _q[SCENE_RESOURCE_BONE_PER_VERTEX]) {
+        float sum = 0.0f;
+        for (int i = 0; i < SCENE_RESOURCE_BONE_PER_VERTEX; i++) sum += _w[i];
+        if (sum <= 0.0f) {
+            memset(_q, 0, SCENE_RESOURCE_BONE_PER_VERTEX);
+            return;
+        }
+        int total = 0, largest = 0;
+        for (int i = 0; i < SCENE_RESOURCE_BONE_PER_VERTEX; i++) {
+            _q[i] = (unsigned char) (_w[i] / sum * 255.0f + 0.5f);
+            total += _q[i];
+            if (_w[i] > _w[largest]) largest = i;
+        }
+        _q[largest] = (unsigned char) (_q[largest] + 255 - total);
+    }
+
     struct MeshEntry {
         unsigned int facetCornerNum;
         unsigned int indexOffset;
@@ -67,24 +205,218 @@ namespace SkeletalMesh {
 
     struct Material {
         const TextureImage::Texture *diffuse;
+        std::string diffuseName;
+        std::string diffuseFilename;
 
         Material()
                 : diffuse(&TextureImage::Texture::error) {}
 
         bool setDiffuse(std::string _name, std::string _filename = std::string()) {
+            diffuseName = _name;
+            diffuseFilename = _filename;
             return (diffuse = &TextureImage::Texture::loadTexture(_name, _filename))
                    != &TextureImage::Texture::error;
         }
     };
 
+    // aiMatrix4x4 is row-major while glm (and GLSL) is column-major
+    inline glm::fmat4 convertMatrix(const aiMatrix4x4 &_m) {
+        return glm::transpose(glm::make_mat4(&_m.a1));
+    }
+
     struct Bone {
-        aiMatrix4x4 localTransf;
+        glm::fmat4 localTransf;
 
         //Bone() : localTransf() {}
-        Bone(const aiMatrix4x4 &_m) : localTransf(_m) {}
+        Bone(const glm::fmat4 &_m) : localTransf(_m) {}
+    };
+
+    // Dense per-instance pose: local modifiers indexed by BoneHandle, per-bone dirty bits
+    // and the cached result of the last evaluation.
+    class SkeletonPose {
+        friend class Scene;
+
+    private:
+        std::vector<glm::fmat4> boneModifier;
+        std::vector<glm::fmat4> evaluatedModifier;
+        std::vector<unsigned char> boneDirty;
+        std::vector<glm::fmat4> nodeGlobalTransf;
+        std::vector<unsigned char> nodeChanged;
+        std::vector<glm::fmat4> palette;
+        size_t changedFirst, changedEnd;
+        bool evaluated;
+
+    public:
+        SkeletonPose() : changedFirst(0), changedEnd(0), evaluated(false) {}
+
+        // Only flags the bone; the evaluator compares flagged bones against the modifier it used last
+        // time, so resetting and re-applying an unchanged gesture every frame costs no re-evaluation.
+        void set(BoneHandle _bone, const glm::fmat4 &_m) {
+            if (_bone < 0 || _bone >= (BoneHandle) boneModifier.size()) return;
+            boneModifier[_bone] = _m;
+            boneDirty[_bone] = 1;
+        }
+
+        const glm::fmat4 &get(BoneHandle _bone) const { return boneModifier[_bone]; }
+
+        bool isDirty(BoneHandle _bone) const { return boneDirty[_bone] != 0; }
+
+        void reset() {
+            for (size_t i = 0; i < boneModifier.size(); i++)
+                set(i, glm::fmat4(1.0f));
+        }
+
+        size_t boneNum() const { return boneModifier.size(); }
+
+        // Final bone transforms of the last Scene::getSkeletonTransform() call, ready for the shader
+        const std::vector<glm::fmat4> &getPalette() const { return palette; }
+
+        // Bones [first, end) enclose every palette entry the last evaluation recomputed; empty when none was.
+        void getChangedRange(size_t &first, size_t &end) const {
+            first = changedFirst;
+            end = changedEnd;
+        }
     };
 
+    struct BakeHeader {
+        unsigned int magic;
+        unsigned int version;
+        FileCache::Hash sourceHash;
+        unsigned int importFlags;
+        unsigned int optimizeFlags;
+        unsigned int vertexStride;
+        unsigned int fileSize;
+        unsigned int vertexNum, vertexOffset;
+        unsigned int indexNum, indexOffset;
+        unsigned int meshNum, meshOffset;  // lodNum levels of meshNum / lodNum entries each
+        unsigned int lodNum, lodErrorOffset;
+        unsigned int boneNum, boneOffset;
+        unsigned int nodeNum, nodeOffset;
+        unsigned int materialNum, materialOffset;
+        unsigned int stringSize, stringOffset;
+    };
+
+    // Nodes are stored in pre-order, so a parent always precedes its children.
+    struct BakeNode {
+        int parent;
+        unsigned int nameOffset;
+        glm::fmat4 localTransf;
+    };
+
+    struct BakeBone {
+        unsigned int nameOffset;
+        glm::fmat4 offsetTransf;
+    };
+
+    struct BakeMaterial {
+        unsigned int diffuseNameOffset;
+        unsigned int diffuseFilenameOffset;
+    };
+
+    // Vertex and index storage shared by every scene of one vertex format and index type, behind one vertex
+    // array, so that a DrawList can merge the mesh entries of several scenes into one multi-draw. Scenes append
+    // their geometry when loaded; the buffers grow in place, keeping their names and with them the vertex
+    // array's bindings. The pool is deleted with its last scene; ranges of scenes unloaded before are not reused.
+    class GeometryPool {
+    public:
+        static GeometryPool *acquire(VertexFormat format, GLenum indexType, size_t vertexStride) {
+            GeometryPool *&pool = allPool[std::make_pair((int) format, indexType)];
+            if (!pool) pool = new GeometryPool(format, indexType, vertexStride);
+            pool->sceneNum++;
+            return pool;
+        }
+
+        static void release(GeometryPool *pool) {
+            if (!pool || --pool->sceneNum > 0) return;
+            allPool.erase(std::make_pair((int) pool->format, pool->indexType));
+            delete pool;
+        }
+
+        // Copies the vertices to the end of the pool and returns the index of the first one
+        size_t appendVertices(const void *data, size_t num) {
+            return append(vbo, vertexNum, vertexCapacity, vertexStride, data, num);
+        }
+
+        // Copies the indices to the end of the pool and returns the position of the first one, in indices
+        size_t appendIndices(const void *data, size_t num) {
+            return append(ebo, indexNum, indexCapacity, indexStride, data, num);
+        }
+
+        GLuint vertexArray() const { return vao; }
+
+        GLuint vertexBuffer() const { return vbo; }
+
+        GLuint indexBuffer() const { return ebo; }
+
+    private:
+        typedef std::map<std::pair<int, GLenum>, GeometryPool *> Key2Pool;
+        static Key2Pool allPool;
+
+        VertexFormat format;
+        GLenum indexType;
+        size_t vertexStride, indexStride;
+        GLuint vao, vbo, ebo;
+        size_t vertexNum, vertexCapacity;
+        size_t indexNum, indexCapacity;
+        int sceneNum;
+
+        GeometryPool(VertexFormat _format, GLenum _indexType, size_t _vertexStride)
+                : format(_format), indexType(_indexType), vertexStride(_vertexStride),
+                  indexStride(_indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int)),
+                  vertexNum(0), vertexCapacity(0), indexNum(0), indexCapacity(0), sceneNum(0) {
+            glGenVertexArrays(1, &vao);
+            glGenBuffers(1, &vbo);
+            glGenBuffers(1, &ebo);
+            GLState::bindVertexArray(vao);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);  // recorded in the vertex array
+            GLState::bindVertexArray(0);
+        }
+
+        ~GeometryPool() {
+            GLState::deleteVertexArray(vao);
+            glDeleteBuffers(1, &vbo);
+            glDeleteBuffers(1, &ebo);
+        }
+
+        // Growing goes through a temporary copy so the buffer keeps its name; a single scene's pool is exact.
+        static size_t append(GLuint buffer, size_t &used, size_t &capacity, size_t stride, const void *data,
+                             size_t num) {
+            if (used + num > capacity) {
+                size_t newCapacity = std::max(capacity * 2, used + num);
+                GLuint temporary = 0;
+                if (used) {
+                    glGenBuffers(1, &temporary);
+                    glBindBuffer(GL_COPY_WRITE_BUFFER, temporary);
+                    glBufferData(GL_COPY_WRITE_BUFFER, stride * used, NULL, GL_STATIC_COPY);
+                    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+                    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, stride * used);
+                }
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+                glBufferData(GL_COPY_WRITE_BUFFER, stride * newCapacity, NULL, GL_STATIC_DRAW);
+                if (used) {
+                    glBindBuffer(GL_COPY_READ_BUFFER, temporary);
+                    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, stride * used);
+                    glDeleteBuffers(1, &temporary);
+                }
+                capacity = newCapacity;
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, stride * used, stride * num, data);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            size_t first = used;
+            used += num;
+            return first;
+        }
+
+        GeometryPool(const GeometryPool &_copy);
+        GeometryPool &operator=(const GeometryPool &_copy);
+    };
+
+    class DrawList;
+
     class Scene {
+        friend class DrawList;
 
     public:
         typedef std::map<std::string, Scene *> Name2Scene;
@@ -92,6 +424,14 @@ namespace SkeletalMesh {
         typedef std::map<std::string, unsigned int> Name2Bone;
         static Name2Scene allScene;
         static Scene error;
+        // Where baked scenes are written and looked up; baking is disabled while empty.
+        static std::string cacheDirectory;
+        // Layout used by scenes loaded from now on; the baked file always keeps the full vertices.
+        static VertexFormat preferredVertexFormat;
+        // SCENE_OPTIMIZE_* passes run on imported geometry; the result is what gets baked.
+        static unsigned int optimizeFlags;
+        // Whether scenes loaded from now on keep a CpuSkinning copy of their vertices, as the shaders read them.
+        static bool keepSkinningMesh;
 
     private:
         bool available;
@@ -99,44 +439,106 @@ namespace SkeletalMesh {
         std::string filename;
         Assimp::Importer importer;
         const aiScene *scene;
+        // Geometry lives in the pool of the scene's vertex format and index type, from firstVertex and
+        // firstIndex on; vao, vbo and ebo are the pool's.
+        GeometryPool *pool;
         GLuint vao;
         GLuint vbo;
         GLuint ebo;
+        GLenum indexType;  // GL_UNSIGNED_SHORT when every mesh entry has at most 65536 vertices
+        size_t vertexCount;  // in the shared vertex buffer
+        size_t firstVertex, firstIndex;
+        CpuSkinning::Mesh skinningMesh;  // empty unless keepSkinningMesh
+        unsigned int influenceNum;  // most bones any vertex is bound to; addBone() fills the slots in order
+        VertexFormat vertexFormat;
+        // Dequantization: attribute * scale + bias, identity for the full layout
+        glm::fvec3 positionScale, positionBias;
+        glm::fvec2 texcoordScale, texcoordBias;
+        // Level l uses meshEntry[l * lodMeshNum, (l + 1) * lodMeshNum); all levels share the vertex buffer.
+        // Once imported, each level holds SCENE_INFLUENCE_BUCKET_NUM runs of bucketMeshNum() entries, one run per
+        // influence bucket, entry i of every run covering part of the triangles of source mesh i.
         std::vector<MeshEntry> meshEntry;
+        size_t lodMeshNum;
+        std::vector<float> lodError;  // object-space error of each level, 0 for the full mesh
+        // glMultiDrawElementsBaseVertex arguments of each mesh entry in the pool, filled by uploadGeometry()
+        std::vector<GLsizei> drawCount;
+        std::vector<const GLvoid *> drawIndexOffset;
+        std::vector<GLint> drawBaseVertex;
+        std::vector<GLint> localBaseVertex;  // relative to firstVertex, for vertex arrays of this scene alone
         std::vector<Material> material;
         std::vector<Bone> skeleton;
         Name2Bone nameBoneMap;
 
+        // Compiled skeleton, nodes in pre-order so that nodeParent[i] < i (the root has -1)
+        std::vector<int> nodeParent;
+        std::vector<glm::fmat4> nodeLocalTransf;
+        std::vector<int> nodeBone;  // -1 for nodes that no vertex is bound to
+        std::vector<std::string> nodeName;
+        glm::fmat4 invRootTransf;
+        BoneCompose::Plan composePlan;  // the node table flattened for getSkeletonTransforms()
+
         // Forbid calling any constructor outside
         Scene(const Scene &_copy)
                 : Scene() {}
 
         Scene() {
             available = false;
+            scene = NULL;
+            pool = NULL;
             vao = 0;
             vbo = 0;
             ebo = 0;
+            indexType = GL_UNSIGNED_INT;
+            vertexCount = 0;
+            firstVertex = firstIndex = 0;
+            influenceNum = 0;
+            lodMeshNum = 0;
+            resetDequantize();
         }
 
         virtual ~Scene() { clear(); }
 
+        void resetDequantize() {
+            vertexFormat = VERTEX_FORMAT_FULL;
+            positionScale = glm::fvec3(1.0f);
+            positionBias = glm::fvec3(0.0f);
+            texcoordScale = glm::fvec2(1.0f);
+            texcoordBias = glm::fvec2(0.0f);
+        }
+
     public:
         void clear() {
             available = false;
             name = std::string();
             filename = std::string();
-            // importer..
+            importer.FreeScene();
             scene = NULL;
-            glDeleteVertexArrays(1, &vao);
+            GeometryPool::release(pool);
+            pool = NULL;
             vao = 0;
-            glDeleteBuffers(1, &vbo);
             vbo = 0;
-            glDeleteBuffers(1, &ebo);
             ebo = 0;
+            indexType = GL_UNSIGNED_INT;
+            vertexCount = 0;
+            firstVertex = firstIndex = 0;
+            skinningMesh = CpuSkinning::Mesh();
+            influenceNum = 0;
+            resetDequantize();
             meshEntry.clear();
+            lodMeshNum = 0;
+            lodError.clear();
+            drawCount.clear();
+            drawIndexOffset.clear();
+            drawBaseVertex.clear();
+            localBaseVertex.clear();
             material.clear();
             skeleton.clear();
             nameBoneMap.clear();
+            nodeParent.clear();
+            nodeLocalTransf.clear();
+            nodeBone.clear();
+            nodeName.clear();
+            composePlan.clear();
         }
 
         static std::string testAllSuffix(std::string no_suffix_name) {
@@ -181,9 +583,18 @@ namespace SkeletalMesh {
             target.name = _name;
             target.filename = _filename;
 
-            target.scene = target.importer.ReadFile(_filename,
-                                                    aiProcess_Triangulate | aiProcess_GenSmoothNormals |
-                                                    aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+            // Warm start: a baked file matching the source content skips Assimp entirely
+            std::string bakeFilename;
+            FileCache::Hash sourceHash = 0;
+            if (!cacheDirectory.empty() && FileCache::hashFile(_filename, sourceHash)) {
+                bakeFilename = FileCache::cacheFilename(cacheDirectory, _filename, SCENE_BAKE_SUFFIX);
+                if (target.loadBaked(bakeFilename, sourceHash)) {
+                    target.available = true;
+                    return target;
+                }
+            }
+
+            target.scene = target.importer.ReadFile(_filename, SCENE_RESOURCE_IMPORT_FLAGS);
             if (!target.scene) return error;
 
             std::vector<ParametricVertex> vertexAssembly;
@@ -219,7 +630,7 @@ namespace SkeletalMesh {
                     std::pair<std::map<std::string, unsigned int>::iterator, bool> insertResult;
                     insertResult = target.nameBoneMap.insert(std::make_pair(boneName, target.skeleton.size()));
                     if (insertResult.second) {
-                        target.skeleton.emplace_back(curMesh->mBones[j]->mOffsetMatrix);
+                        target.skeleton.emplace_back(convertMatrix(curMesh->mBones[j]->mOffsetMatrix));
                         int nBoneVertexWeight = curMesh->mBones[j]->mNumWeights;
                         for (int k = 0; k < nBoneVertexWeight; k++) {
                             int vertexId = target.meshEntry[i].vertexOffset + curMesh->mBones[j]->mWeights[k].mVertexId;
@@ -283,25 +694,460 @@ namespace SkeletalMesh {
                 }
             }
 
-            glGenVertexArrays(1, &target.vao);
-            glBindVertexArray(target.vao);
+            target.compileSkeleton(target.scene->mRootNode, -1);
+            target.linkSkeleton();
+
+            for (size_t i = 0; i < vertexAssembly.size(); i++)
+                vertexAssembly[i].normalizeWeights();
 
-            glGenBuffers(1, &target.vbo);
-            glBindBuffer(GL_ARRAY_BUFFER, target.vbo);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(ParametricVertex) * vertexAssembly.size(), vertexAssembly.data(),
-                         GL_STATIC_DRAW);
+            target.optimizeGeometry(vertexAssembly, indexAssembly);
+            target.buildLods(vertexAssembly, indexAssembly);
+            target.bucketInfluences(vertexAssembly, indexAssembly);
 
-            glGenBuffers(1, &target.ebo);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, target.ebo);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indexAssembly.size(), indexAssembly.data(),
-                         GL_STATIC_DRAW);
+            target.uploadGeometry(vertexAssembly.data(), vertexAssembly.size(),
+                                  indexAssembly.data(), indexAssembly.size());
 
-            glBindVertexArray(0);
+            if (!bakeFilename.empty() && !target.writeBaked(bakeFilename, sourceHash, vertexAssembly, indexAssembly))
+                std::cout << "Error writing baked scene " << bakeFilename << std::endl;
 
             target.available = true;
             return target;
         }
 
+    private:
+        // One multi-draw of meshEntry[first, first + num) from the vertex array; empty entries draw nothing
+        void drawEntries(GLuint vertexArray, size_t first, size_t num, const GLint *baseVertex) const {
+            GLState::bindVertexArray(vertexArray);  // stays bound, the next draw of this scene skips the bind
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, &drawCount[first], indexType, &drawIndexOffset[first],
+                                          (GLsizei) num, &baseVertex[first]);
+        }
+
+        void uploadGeometry(const ParametricVertex *vertices, size_t vertexNum,
+                            const unsigned int *indices, size_t indexNum) {
+            std::vector<QuantizedVertex> quantized;
+            if (preferredVertexFormat == VERTEX_FORMAT_QUANTIZED && skeleton.size() <= SCENE_QUANTIZED_MAX_BONES) {
+                quantizeGeometry(vertices, vertexNum, quantized);
+            } else if (preferredVertexFormat == VERTEX_FORMAT_QUANTIZED) {
+                std::cout << "Scene " << name << " has " << skeleton.size()
+                          << " bones, too many for 8-bit bone ids; keeping full vertices" << std::endl;
+            }
+
+            // Indices are relative to each mesh entry's base vertex, so 16 bits suffice for all but huge meshes
+            unsigned int maxIndex = 0;
+            for (size_t i = 0; i < indexNum; i++) maxIndex = std::max(maxIndex, indices[i]);
+            indexType = maxIndex <= 0xffff ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+            bool isQuantized = vertexFormat == VERTEX_FORMAT_QUANTIZED;
+            pool = GeometryPool::acquire(vertexFormat, indexType,
+                                         isQuantized ? sizeof(QuantizedVertex) : sizeof(ParametricVertex));
+            vao = pool->vertexArray();
+            vbo = pool->vertexBuffer();
+            ebo = pool->indexBuffer();
+            if (isQuantized)
+                firstVertex = pool->appendVertices(quantized.data(), vertexNum);
+            else
+                firstVertex = pool->appendVertices(vertices, vertexNum);
+            if (indexType == GL_UNSIGNED_SHORT) {
+                std::vector<unsigned short> shortIndices(indices, indices + indexNum);
+                firstIndex = pool->appendIndices(shortIndices.data(), indexNum);
+            } else {
+                firstIndex = pool->appendIndices(indices, indexNum);
+            }
+
+            vertexCount = vertexNum;
+            influenceNum = 0;
+            for (size_t v = 0; v < vertexNum; v++) {
+                unsigned int influences = 0;
+                while (influences < SCENE_RESOURCE_BONE_PER_VERTEX && vertices[v].boneWeight[influences] > 0.0f)
+                    influences++;
+                influenceNum = std::max(influenceNum, influences);
+            }
+            if (keepSkinningMesh) buildSkinningMesh(vertices, quantized.empty() ? NULL : quantized.data(), vertexNum);
+
+            drawCount.resize(meshEntry.size());
+            drawIndexOffset.resize(meshEntry.size());
+            drawBaseVertex.resize(meshEntry.size());
+            localBaseVertex.resize(meshEntry.size());
+            for (size_t i = 0; i < meshEntry.size(); i++) {
+                drawCount[i] = meshEntry[i].facetCornerNum;
+                drawIndexOffset[i] = (const GLvoid *) (indexSize() * (firstIndex + meshEntry[i].indexOffset));
+                drawBaseVertex[i] = (GLint) (firstVertex + meshEntry[i].vertexOffset);
+                localBaseVertex[i] = (GLint) meshEntry[i].vertexOffset;
+            }
+        }
+
+        // Reorders each mesh entry in place; entries keep their index and vertex ranges, so meshEntry stays valid
+        void optimizeGeometry(std::vector<ParametricVertex> &vertices, std::vector<unsigned int> &indices) const {
+            if (!(optimizeFlags & SCENE_OPTIMIZE_ALL)) return;
+            double missesBefore = 0.0, missesAfter = 0.0;
+            size_t triangleNum = 0;
+            std::vector<unsigned int> remap;
+            std::vector<ParametricVertex> reordered;
+            for (size_t i = 0; i < meshEntry.size(); i++) {
+                const MeshEntry &entry = meshEntry[i];
+                size_t vertexEnd = i + 1 < meshEntry.size() ? meshEntry[i + 1].vertexOffset : vertices.size();
+                size_t vertexNum = vertexEnd - entry.vertexOffset;
+                unsigned int *meshIndices = indices.data() + entry.indexOffset;
+                size_t indexNum = entry.facetCornerNum;
+                if (vertexNum == 0 || indexNum < 3) continue;
+
+                missesBefore += MeshOptimizer::computeACMR(meshIndices, indexNum, vertexNum) * (indexNum / 3);
+                if (optimizeFlags & SCENE_OPTIMIZE_VERTEX_CACHE)
+                    MeshOptimizer::optimizeVertexCache(meshIndices, indexNum, vertexNum);
+                if (optimizeFlags & SCENE_OPTIMIZE_OVERDRAW)
+                    MeshOptimizer::optimizeOverdraw(meshIndices, indexNum, vertices[entry.vertexOffset].position,
+                                                    sizeof(ParametricVertex), vertexNum);
+                if (optimizeFlags & SCENE_OPTIMIZE_VERTEX_FETCH) {
+                    MeshOptimizer::optimizeVertexFetch(meshIndices, indexNum, vertexNum, remap);
+                    reordered.resize(vertexNum);
+                    for (size_t v = 0; v < vertexNum; v++) reordered[remap[v]] = vertices[entry.vertexOffset + v];
+                    std::copy(reordered.begin(), reordered.end(), vertices.begin() + entry.vertexOffset);
+                }
+                missesAfter += MeshOptimizer::computeACMR(meshIndices, indexNum, vertexNum) * (indexNum / 3);
+                triangleNum += indexNum / 3;
+            }
+            if (triangleNum)
+                std::cout << "Optimized " << name << ": ACMR " << missesBefore / triangleNum << " -> "
+                          << missesAfter / triangleNum << " (FIFO cache of " << MESH_OPTIMIZER_CACHE_SIZE
+                          << ", " << triangleNum << " triangles)" << std::endl;
+        }
+
+        // Appends simplified copies of every mesh entry to indices, each level simplified from the previous one
+        void buildLods(const std::vector<ParametricVertex> &vertices, std::vector<unsigned int> &indices) {
+            lodMeshNum = meshEntry.size();
+            lodError.assign(1, 0.0f);
+            if (vertices.empty()) return;
+
+            // A vertex only merges into one driven by the same dominant bone
+            std::vector<unsigned int> dominantBone(vertices.size());
+            for (size_t v = 0; v < vertices.size(); v++) {
+                int strongest = 0;
+                for (int k = 1; k < SCENE_RESOURCE_BONE_PER_VERTEX; k++)
+                    if (vertices[v].boneWeight[k] > vertices[v].boneWeight[strongest]) strongest = k;
+                dominantBone[v] = vertices[v].boneWeight[strongest] > 0.0f ? vertices[v].boneId[strongest] : ~0u;
+            }
+
+            std::vector<unsigned int> simplified;
+            for (int lod = 1; lod < SCENE_LOD_MAX; lod++) {
+                const MeshEntry *previous = &meshEntry[(lod - 1) * lodMeshNum];
+                std::vector<MeshEntry> level(previous, previous + lodMeshNum);
+                std::vector<unsigned int> levelIndices;
+                size_t previousIndexNum = 0;
+                float levelError = 0.0f;
+                for (size_t i = 0; i < lodMeshNum; i++) {
+                    size_t vertexEnd = i + 1 < lodMeshNum ? meshEntry[i + 1].vertexOffset : vertices.size();
+                    size_t vertexNum = vertexEnd - previous[i].vertexOffset;
+                    previousIndexNum += previous[i].facetCornerNum;
+                    if (vertexNum == 0 || previous[i].facetCornerNum < 3) continue;  // keeps the previous range
+                    const unsigned int *source = indices.data() + previous[i].indexOffset;
+                    simplified.resize(previous[i].facetCornerNum);
+                    float error = 0.0f;
+                    size_t indexNum = MeshOptimizer::simplify(simplified.data(), source, previous[i].facetCornerNum,
+                                                              vertices[previous[i].vertexOffset].position,
+                                                              sizeof(ParametricVertex), vertexNum,
+                                                              dominantBone.data() + previous[i].vertexOffset,
+                                                              (size_t) (previous[i].facetCornerNum * SCENE_LOD_RATIO),
+                                                              FLT_MAX, &error);
+                    MeshOptimizer::optimizeVertexCache(simplified.data(), indexNum, vertexNum);
+                    level[i].facetCornerNum = indexNum;
+                    level[i].indexOffset = indices.size() + levelIndices.size();
+                    levelIndices.insert(levelIndices.end(), simplified.begin(), simplified.begin() + indexNum);
+                    levelError = std::max(levelError, error);
+                }
+                if (levelIndices.size() > previousIndexNum * SCENE_LOD_MIN_REDUCTION) break;
+                indices.insert(indices.end(), levelIndices.begin(), levelIndices.end());
+                meshEntry.insert(meshEntry.end(), level.begin(), level.end());
+                // Errors of successive levels add up, since each one starts from the previous one
+                lodError.push_back(lodError.back() + levelError);
+                std::cout << "LOD " << lod << " of " << name << ": " << levelIndices.size() / 3 << " triangles, error "
+                          << lodError.back() << std::endl;
+            }
+        }
+
+        // Splits every mesh entry of every level into SCENE_INFLUENCE_BUCKET_NUM entries by the most weights any
+        // vertex of a triangle uses. Triangles are partitioned in place, keeping their optimized order within
+        // each bucket; entries of empty buckets stay, with no triangles, so that the layout remains regular.
+        void bucketInfluences(const std::vector<ParametricVertex> &vertices, std::vector<unsigned int> &indices) {
+            std::vector<unsigned char> vertexBucket(vertices.size());
+            for (size_t v = 0; v < vertices.size(); v++) {
+                unsigned int influences = 0;
+                while (influences < SCENE_RESOURCE_BONE_PER_VERTEX && vertices[v].boneWeight[influences] > 0.0f)
+                    influences++;
+                vertexBucket[v] = (unsigned char) influenceBucket(influences);
+            }
+
+            size_t meshNum = lodMeshNum;
+            std::vector<MeshEntry> bucketed;
+            bucketed.reserve(meshEntry.size() * SCENE_INFLUENCE_BUCKET_NUM);
+            std::vector<unsigned int> triangles[SCENE_INFLUENCE_BUCKET_NUM];
+            size_t bucketTriangles[SCENE_INFLUENCE_BUCKET_NUM] = {};
+            for (size_t lod = 0; lod < lodNum(); lod++) {
+                size_t levelBegin = bucketed.size();
+                bucketed.resize(levelBegin + meshNum * SCENE_INFLUENCE_BUCKET_NUM);
+                for (size_t i = 0; i < meshNum; i++) {
+                    const MeshEntry &entry = meshEntry[lod * meshNum + i];
+                    unsigned int *entryIndices = indices.data() + entry.indexOffset;
+                    for (unsigned int b = 0; b < SCENE_INFLUENCE_BUCKET_NUM; b++) triangles[b].clear();
+                    for (unsigned int t = 0; t + 3 <= entry.facetCornerNum; t += 3) {
+                        unsigned char bucket = 0;
+                        for (int k = 0; k < 3; k++)
+                            bucket = std::max(bucket, vertexBucket[entry.vertexOffset + entryIndices[t + k]]);
+                        triangles[bucket].insert(triangles[bucket].end(), entryIndices + t, entryIndices + t + 3);
+                    }
+                    unsigned int offset = entry.indexOffset;
+                    for (unsigned int b = 0; b < SCENE_INFLUENCE_BUCKET_NUM; b++) {
+                        MeshEntry &part = bucketed[levelBegin + b * meshNum + i];
+                        part = entry;
+                        part.facetCornerNum = triangles[b].size();
+                        part.indexOffset = offset;
+                        std::copy(triangles[b].begin(), triangles[b].end(), indices.begin() + offset);
+                        offset += triangles[b].size();
+                        if (lod == 0) bucketTriangles[b] += triangles[b].size() / 3;
+                    }
+                }
+            }
+            meshEntry.swap(bucketed);
+            lodMeshNum = meshNum * SCENE_INFLUENCE_BUCKET_NUM;
+
+            std::cout << "Influence buckets of " << name << ", triangles by weights read:";
+            for (unsigned int b = 0; b < SCENE_INFLUENCE_BUCKET_NUM; b++)
+                std::cout << " " << bucketInfluenceNum(b) << ": " << bucketTriangles[b];
+            std::cout << std::endl;
+        }
+
+        // Copies the vertices as uploaded, dequantized the way the shaders do, so CPU and GPU skin the same data
+        void buildSkinningMesh(const ParametricVertex *vertices, const QuantizedVertex *quantized, size_t vertexNum) {
+            skinningMesh.resize(vertexNum, influenceNum);
+            for (size_t v = 0; v < vertexNum; v++) {
+                if (!quantized) {
+                    skinningMesh.set(v, vertices[v].position, vertices[v].normal, vertices[v].boneId,
+                                     vertices[v].boneWeight);
+                    continue;
+                }
+                const QuantizedVertex &q = quantized[v];
+                float position[3], normal[3], weight[SCENE_RESOURCE_BONE_PER_VERTEX];
+                unsigned int boneId[SCENE_RESOURCE_BONE_PER_VERTEX];
+                for (int k = 0; k < 3; k++)
+                    position[k] = q.position[k] / 65535.0f * positionScale[k] + positionBias[k];
+                normal[0] = std::max(q.normal[0] / 32767.0f, -1.0f);
+                normal[1] = std::max(q.normal[1] / 32767.0f, -1.0f);
+                normal[2] = 1.0f - std::fabs(normal[0]) - std::fabs(normal[1]);
+                for (int k = 0; k < 2; k++) {
+                    float sign = normal[k] > 0.0f ? 1.0f : normal[k] < 0.0f ? -1.0f : 0.0f;
+                    normal[k] -= sign * std::max(-normal[2], 0.0f);
+                }
+                for (int k = 0; k < SCENE_RESOURCE_BONE_PER_VERTEX; k++) {
+                    boneId[k] = q.boneId[k];
+                    weight[k] = q.boneWeight[k] / 255.0f;
+                }
+                skinningMesh.set(v, position, normal, boneId, weight);
+            }
+        }
+
+        void quantizeGeometry(const ParametricVertex *vertices, size_t vertexNum,
+                              std::vector<QuantizedVertex> &quantized) {
+            glm::fvec3 posMin(0.0f), posMax(0.0f);
+            glm::fvec2 texMin(0.0f), texMax(0.0f);
+            for (size_t i = 0; i < vertexNum; i++) {
+                glm::fvec3 p = glm::make_vec3(vertices[i].position);
+                glm::fvec2 t = glm::make_vec2(vertices[i].texcoord);
+                posMin = i ? glm::min(posMin, p) : p;
+                posMax = i ? glm::max(posMax, p) : p;
+                texMin = i ? glm::min(texMin, t) : t;
+                texMax = i ? glm::max(texMax, t) : t;
+            }
+            vertexFormat = VERTEX_FORMAT_QUANTIZED;
+            positionBias = posMin;
+            positionScale = glm::max(posMax - posMin, glm::fvec3(1e-6f));
+            texcoordBias = texMin;
+            texcoordScale = glm::max(texMax - texMin, glm::fvec2(1e-6f));
+
+            quantized.resize(vertexNum);
+            for (size_t i = 0; i < vertexNum; i++) {
+                const ParametricVertex &v = vertices[i];
+                QuantizedVertex &q = quantized[i];
+                for (int k = 0; k < 3; k++)
+                    q.position[k] = quantizeUnorm16((v.position[k] - positionBias[k]) / positionScale[k]);
+                q.position[3] = 0;
+                for (int k = 0; k < 2; k++)
+                    q.texcoord[k] = quantizeUnorm16((v.texcoord[k] - texcoordBias[k]) / texcoordScale[k]);
+                encodeOctahedral(v.normal, q.normal);
+                for (int k = 0; k < SCENE_RESOURCE_BONE_PER_VERTEX; k++)
+                    q.boneId[k] = (unsigned char) v.boneId[k];
+                quantizeWeights(v.boneWeight, q.boneWeight);
+            }
+        }
+
+        static unsigned int appendBakeString(std::vector<char> &strings, const std::string &str) {
+            unsigned int offset = strings.size();
+            strings.insert(strings.end(), str.begin(), str.end());
+            strings.push_back('\0');
+            return offset;
+        }
+
+        void compileSkeleton(const aiNode *node, int parent) {
+            int index = nodeParent.size();
+            nodeParent.push_back(parent);
+            nodeLocalTransf.push_back(convertMatrix(node->mTransformation));
+            nodeName.push_back(node->mName.data);
+            for (unsigned int i = 0; i < node->mNumChildren; i++)
+                compileSkeleton(node->mChildren[i], index);
+        }
+
+        // Resolves names to indices once, so that evaluation never touches a string
+        void linkSkeleton() {
+            size_t nodeNum = nodeParent.size();
+            nodeBone.assign(nodeNum, -1);
+            for (size_t i = 0; i < nodeNum; i++) {
+                Name2Bone::const_iterator boneFound = nameBoneMap.find(nodeName[i]);
+                if (boneFound != nameBoneMap.end())
+                    nodeBone[i] = boneFound->second;
+            }
+            invRootTransf = nodeNum ? glm::inverse(nodeLocalTransf[0]) : glm::fmat4(1.0f);
+
+            std::vector<glm::fmat4> boneOffset(skeleton.size());
+            for (size_t i = 0; i < skeleton.size(); i++) boneOffset[i] = skeleton[i].localTransf;
+            composePlan.build(nodeParent, nodeLocalTransf, nodeBone, boneOffset, invRootTransf);
+        }
+
+        bool writeBaked(const std::string &bakeFilename, FileCache::Hash sourceHash,
+                        const std::vector<ParametricVertex> &vertices,
+                        const std::vector<unsigned int> &indices) const {
+            std::vector<char> strings;
+
+            std::vector<BakeBone> bones(skeleton.size());
+            for (Name2Bone::const_iterator it = nameBoneMap.begin(); it != nameBoneMap.end(); ++it) {
+                bones[it->second].nameOffset = appendBakeString(strings, it->first);
+                bones[it->second].offsetTransf = skeleton[it->second].localTransf;
+            }
+
+            std::vector<BakeNode> nodes(nodeParent.size());
+            for (size_t i = 0; i < nodes.size(); i++) {
+                nodes[i].parent = nodeParent[i];
+                nodes[i].nameOffset = appendBakeString(strings, nodeName[i]);
+                nodes[i].localTransf = nodeLocalTransf[i];
+            }
+
+            std::vector<BakeMaterial> materials(material.size());
+            for (size_t i = 0; i < material.size(); i++) {
+                bool hasDiffuse = !material[i].diffuseName.empty();
+                materials[i].diffuseNameOffset = hasDiffuse ?
+                                                 appendBakeString(strings, material[i].diffuseName) :
+                                                 SCENE_BAKE_NO_STRING;
+                materials[i].diffuseFilenameOffset = hasDiffuse ?
+                                                     appendBakeString(strings, material[i].diffuseFilename) :
+                                                     SCENE_BAKE_NO_STRING;
+            }
+
+            BakeHeader header;
+            memset(&header, 0, sizeof(header));
+            FileCache::BlobWriter blob;
+            blob.append(&header, sizeof(header));
+
+            header.magic = SCENE_BAKE_MAGIC;
+            header.version = SCENE_BAKE_VERSION;
+            header.sourceHash = sourceHash;
+            header.importFlags = SCENE_RESOURCE_IMPORT_FLAGS;
+            header.optimizeFlags = optimizeFlags;
+            header.vertexStride = sizeof(ParametricVertex);
+            header.vertexNum = vertices.size();
+            header.vertexOffset = blob.appendArray(vertices);
+            header.indexNum = indices.size();
+            header.indexOffset = blob.appendArray(indices);
+            header.meshNum = meshEntry.size();
+            header.meshOffset = blob.appendArray(meshEntry);
+            header.lodNum = lodError.size();
+            header.lodErrorOffset = blob.appendArray(lodError);
+            header.boneNum = bones.size();
+            header.boneOffset = blob.appendArray(bones);
+            header.nodeNum = nodes.size();
+            header.nodeOffset = blob.appendArray(nodes);
+            header.materialNum = materials.size();
+            header.materialOffset = blob.appendArray(materials);
+            header.stringSize = strings.size();
+            header.stringOffset = blob.appendArray(strings);
+            header.fileSize = blob.bytes.size();
+            blob.overwrite(0, &header, sizeof(header));
+
+            return blob.save(bakeFilename);
+        }
+
+        bool loadBaked(const std::string &bakeFilename, FileCache::Hash sourceHash) {
+            FileCache::MappedFile file;
+            if (!file.open(bakeFilename)) return false;
+
+            const BakeHeader *header = file.view<BakeHeader>(0);
+            if (!header || header->magic != SCENE_BAKE_MAGIC || header->version != SCENE_BAKE_VERSION ||
+                header->sourceHash != sourceHash || header->importFlags != SCENE_RESOURCE_IMPORT_FLAGS ||
+                header->optimizeFlags != optimizeFlags ||
+                header->vertexStride != sizeof(ParametricVertex) || header->fileSize != file.size())
+                return false;
+
+            const ParametricVertex *vertices = file.view<ParametricVertex>(header->vertexOffset, header->vertexNum);
+            const unsigned int *indices = file.view<unsigned int>(header->indexOffset, header->indexNum);
+            const MeshEntry *meshes = file.view<MeshEntry>(header->meshOffset, header->meshNum);
+            const float *lodErrors = file.view<float>(header->lodErrorOffset, header->lodNum);
+            const BakeBone *bones = file.view<BakeBone>(header->boneOffset, header->boneNum);
+            const BakeNode *nodes = file.view<BakeNode>(header->nodeOffset, header->nodeNum);
+            const BakeMaterial *materials = file.view<BakeMaterial>(header->materialOffset, header->materialNum);
+            const char *strings = file.view<char>(header->stringOffset, header->stringSize);
+            if (!vertices || !indices || !meshes || !lodErrors || !bones || !nodes || !materials || !strings ||
+                header->lodNum == 0 || header->meshNum % (header->lodNum * SCENE_INFLUENCE_BUCKET_NUM) != 0 ||
+                header->nodeNum == 0 || header->stringSize == 0 || strings[header->stringSize - 1] != '\0')
+                return false;
+
+            // Validate every cross reference before touching the scene, so a damaged file just falls back to import
+            for (unsigned int i = 0; i < header->boneNum; i++)
+                if (bones[i].nameOffset >= header->stringSize) return false;
+            for (unsigned int i = 0; i < header->nodeNum; i++)
+                if (nodes[i].nameOffset >= header->stringSize || nodes[i].parent >= (int) i ||
+                    (nodes[i].parent < 0) != (i == 0))
+                    return false;
+            for (unsigned int i = 0; i < header->materialNum; i++)
+                if ((materials[i].diffuseNameOffset != SCENE_BAKE_NO_STRING &&
+                     materials[i].diffuseNameOffset >= header->stringSize) ||
+                    (materials[i].diffuseFilenameOffset != SCENE_BAKE_NO_STRING &&
+                     materials[i].diffuseFilenameOffset >= header->stringSize))
+                    return false;
+            for (unsigned int i = 0; i < header->meshNum; i++)
+                if ((unsigned long long) meshes[i].indexOffset + meshes[i].facetCornerNum > header->indexNum ||
+                    meshes[i].vertexOffset > header->vertexNum)
+                    return false;
+            // Weighted bone ids index the palette; the shaders do not check them
+            for (unsigned int i = 0; i < header->vertexNum; i++)
+                for (int k = 0; k < SCENE_RESOURCE_BONE_PER_VERTEX; k++)
+                    if (vertices[i].boneWeight[k] > 0.0f && vertices[i].boneId[k] >= header->boneNum) return false;
+
+            meshEntry.assign(meshes, meshes + header->meshNum);
+            lodMeshNum = header->meshNum / header->lodNum;
+            lodError.assign(lodErrors, lodErrors + header->lodNum);
+
+            for (unsigned int i = 0; i < header->boneNum; i++) {
+                nameBoneMap.insert(std::make_pair(std::string(strings + bones[i].nameOffset), i));
+                skeleton.emplace_back(bones[i].offsetTransf);
+            }
+
+            for (unsigned int i = 0; i < header->nodeNum; i++) {
+                nodeParent.push_back(nodes[i].parent);
+                nodeLocalTransf.push_back(nodes[i].localTransf);
+                nodeName.push_back(strings + nodes[i].nameOffset);
+            }
+            linkSkeleton();
+
+            material.resize(header->materialNum);
+            for (unsigned int i = 0; i < header->materialNum; i++) {
+                if (materials[i].diffuseNameOffset == SCENE_BAKE_NO_STRING) continue;
+                std::string diffuseFilename(strings + materials[i].diffuseFilenameOffset);
+                if (!material[i].setDiffuse(strings + materials[i].diffuseNameOffset, diffuseFilename))
+                    std::cout << "Error loading diffuse " << diffuseFilename << std::endl;
+            }
+
+            uploadGeometry(vertices, header->vertexNum, indices, header->indexNum);
+            return true;
+        }
+
+    public:
+
         static bool unloadScene(std::string _name) {
             return allScene.erase(_name) != 0;
         }
@@ -312,35 +1158,88 @@ namespace SkeletalMesh {
             return *(find_result->second);
         }
 
-        void recursivelyGetTransf(SkeletonTransf &skTransf, SkeletonModifier &modifier, aiNode *node,
-                                  aiMatrix4x4 parentTransf, const aiMatrix4x4 &invTransf) const {
-            aiMatrix4x4 globalTransf = parentTransf * node->mTransformation;
-            Name2Bone::const_iterator boneFound = nameBoneMap.find(std::string(node->mName.data));
-            if (boneFound != nameBoneMap.end()) {
-                SkeletonModifier::const_iterator boneModFound = modifier.find(std::string(node->mName.data));
-                aiMatrix4x4 boneMod;
-                if (boneModFound != modifier.end()) {
-                    auto trans = glm::transpose(boneModFound->second);
-                    memcpy(&boneMod, &trans, 16 * sizeof(float));
-                    globalTransf *= boneMod;
+        BoneHandle findBone(const std::string &_name) const {
+            Name2Bone::const_iterator boneFound = nameBoneMap.find(_name);
+            return boneFound == nameBoneMap.end() ? INVALID_BONE : (BoneHandle) boneFound->second;
+        }
+
+        void initPose(SkeletonPose &pose) const {
+            pose.boneModifier.assign(skeleton.size(), glm::fmat4(1.0f));
+            pose.evaluatedModifier.assign(skeleton.size(), glm::fmat4(1.0f));
+            pose.boneDirty.assign(skeleton.size(), 0);
+            pose.nodeGlobalTransf.resize(nodeParent.size());
+            pose.nodeChanged.assign(nodeParent.size(), 0);
+            pose.palette.assign(skeleton.size(), glm::fmat4(1.0f));
+            pose.changedFirst = pose.changedEnd = 0;
+            pose.evaluated = false;
+        }
+
+        // Pose evaluation is one pass over the pre-ordered node table: every parent is final before its
+        // children. Nodes whose own bone and ancestors are all clean keep their cached transforms.
+        bool getSkeletonTransform(SkeletonPose &pose) const {
+            if (!available) return false;
+
+            if (pose.boneModifier.size() != skeleton.size() || pose.nodeGlobalTransf.size() != nodeParent.size())
+                initPose(pose);
+
+            for (size_t i = 0; i < skeleton.size(); i++) {
+                if (!pose.boneDirty[i]) continue;
+                if (memcmp(&pose.boneModifier[i], &pose.evaluatedModifier[i], sizeof(glm::fmat4)) == 0) {
+                    pose.boneDirty[i] = 0;
+                } else {
+                    pose.evaluatedModifier[i] = pose.boneModifier[i];
                 }
-                aiMatrix4x4 finalMtrx = invTransf * globalTransf * skeleton[boneFound->second].localTransf;
-                memcpy(&skTransf[boneFound->second], &finalMtrx.Transpose(), sizeof(skTransf[boneFound->second]));
             }
-            for (int i = 0; i < node->mNumChildren; i++) {
-                recursivelyGetTransf(skTransf, modifier, node->mChildren[i], globalTransf, invTransf);
+
+            pose.changedFirst = skeleton.size();
+            pose.changedEnd = 0;
+            for (size_t i = 0; i < nodeParent.size(); i++) {
+                int parent = nodeParent[i];
+                int bone = nodeBone[i];
+                bool changed = !pose.evaluated || (parent >= 0 && pose.nodeChanged[parent]) ||
+                               (bone >= 0 && pose.boneDirty[bone]);
+                pose.nodeChanged[i] = changed;
+                if (!changed) continue;
+
+                glm::fmat4 &globalTransf = pose.nodeGlobalTransf[i];
+                if (parent < 0)
+                    globalTransf = nodeLocalTransf[i];
+                else
+                    globalTransf = pose.nodeGlobalTransf[parent] * nodeLocalTransf[i];
+                if (bone >= 0) {
+                    globalTransf *= pose.boneModifier[bone];
+                    pose.palette[bone] = invRootTransf * globalTransf * skeleton[bone].localTransf;
+                    pose.changedFirst = std::min(pose.changedFirst, (size_t) bone);
+                    pose.changedEnd = std::max(pose.changedEnd, (size_t) bone + 1);
+                }
             }
+            if (pose.changedFirst >= pose.changedEnd) pose.changedFirst = pose.changedEnd = 0;
+            std::fill(pose.boneDirty.begin(), pose.boneDirty.end(), 0);
+            pose.evaluated = true;
+            return !pose.palette.empty();
         }
 
-        bool getSkeletonTransform(SkeletonTransf &transf, SkeletonModifier &modifier) const {
+        // Evaluates many poses at once with the vectorized BoneCompose kernel. Every bone of every pose is
+        // recomputed, which beats the incremental path above once most poses change every frame, as in crowds.
+        // The poses' cached node transforms are dropped, so getSkeletonTransform() on them starts over.
+        bool getSkeletonTransforms(SkeletonPose *const *poses, size_t count) const {
             if (!available) return false;
-
-            transf.resize(skeleton.size());
-
-            aiMatrix4x4 identityMtrx, invTransf = scene->mRootNode->mTransformation;
-            invTransf.Inverse();
-            recursivelyGetTransf(transf, modifier, scene->mRootNode, identityMtrx, invTransf);
-            return !transf.empty();
+            std::vector<const glm::fmat4 *> modifiers(count);
+            std::vector<glm::fmat4 *> palettes(count);
+            for (size_t i = 0; i < count; i++) {
+                SkeletonPose &pose = *poses[i];
+                if (pose.boneModifier.size() != skeleton.size() || pose.nodeGlobalTransf.size() != nodeParent.size())
+                    initPose(pose);
+                pose.evaluatedModifier = pose.boneModifier;
+                std::fill(pose.boneDirty.begin(), pose.boneDirty.end(), 0);
+                pose.changedFirst = 0;
+                pose.changedEnd = skeleton.size();
+                pose.evaluated = false;
+                modifiers[i] = pose.boneModifier.data();
+                palettes[i] = pose.palette.data();
+            }
+            if (!skeleton.empty()) BoneCompose::compose(composePlan, modifiers.data(), palettes.data(), count);
+            return !skeleton.empty();
         }
 
         bool setShaderInput(GLuint program,
@@ -348,76 +1247,165 @@ namespace SkeletalMesh {
                             std::string bnidName, std::string bnwtName) {
             if (!available) return false;
 
-            ParametricVertex example;
-
-            glBindVertexArray(vao);
+            GLState::bindVertexArray(vao);
             glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
+            bool quantized = vertexFormat == VERTEX_FORMAT_QUANTIZED;
+            ParametricVertex example;
+            QuantizedVertex quantizedExample;
+            GLsizei stride = quantized ? sizeof(QuantizedVertex) : sizeof(ParametricVertex);
+#define SCENE_ATTRIBUTE_OFFSET(member) \
+            (const void *) (quantized ? (char *) quantizedExample.member - (char *) &quantizedExample \
+                                      : (char *) example.member - (char *) &example)
+
             {
                 GLint posiLoc = glGetAttribLocation(program, posiName.c_str());
                 if (posiLoc >= 0) {
                     glEnableVertexAttribArray(posiLoc);
-                    glVertexAttribPointer(posiLoc, 3, GL_FLOAT, GL_FALSE, sizeof(ParametricVertex),
-                                          (const void *) ((char *) example.position - (char *) &example));
+                    glVertexAttribPointer(posiLoc, 3, quantized ? GL_UNSIGNED_SHORT : GL_FLOAT, quantized, stride,
+                                          SCENE_ATTRIBUTE_OFFSET(position));
                 }
             }
             {
                 GLint texcLoc = glGetAttribLocation(program, texcName.c_str());
                 if (texcLoc >= 0) {
                     glEnableVertexAttribArray(texcLoc);
-                    glVertexAttribPointer(texcLoc, 2, GL_FLOAT, GL_FALSE, sizeof(ParametricVertex),
-                                          (const void *) ((char *) example.texcoord - (char *) &example));
+                    glVertexAttribPointer(texcLoc, 2, quantized ? GL_UNSIGNED_SHORT : GL_FLOAT, quantized, stride,
+                                          SCENE_ATTRIBUTE_OFFSET(texcoord));
                 }
             }
             {
+                // The quantized layout feeds the two octahedral components; z reads as 0 in a vec3 input
                 GLint normLoc = glGetAttribLocation(program, normName.c_str());
                 if (normLoc >= 0) {
                     glEnableVertexAttribArray(normLoc);
-                    glVertexAttribPointer(normLoc, 3, GL_FLOAT, GL_FALSE, sizeof(ParametricVertex),
-                                          (const void *) ((char *) example.normal - (char *) &example));
+                    glVertexAttribPointer(normLoc, quantized ? 2 : 3, quantized ? GL_SHORT : GL_FLOAT, quantized,
+                                          stride, SCENE_ATTRIBUTE_OFFSET(normal));
                 }
             }
             {
                 GLint bnidLoc = glGetAttribLocation(program, bnidName.c_str());
                 if (bnidLoc >= 0) {
                     glEnableVertexAttribArray(bnidLoc);
-                    glVertexAttribIPointer(bnidLoc, SCENE_RESOURCE_BONE_PER_VERTEX, GL_INT, sizeof(ParametricVertex),
-                                           (const void *) ((char *) example.boneId - (char *) &example));
+                    glVertexAttribIPointer(bnidLoc, SCENE_RESOURCE_BONE_PER_VERTEX,
+                                           quantized ? GL_UNSIGNED_BYTE : GL_INT, stride,
+                                           SCENE_ATTRIBUTE_OFFSET(boneId));
                 }
             }
             {
                 GLint bnwtLoc = glGetAttribLocation(program, bnwtName.c_str());
                 if (bnwtLoc >= 0) {
                     glEnableVertexAttribArray(bnwtLoc);
-                    glVertexAttribPointer(bnwtLoc, SCENE_RESOURCE_BONE_PER_VERTEX, GL_FLOAT, GL_FALSE,
-                                          sizeof(ParametricVertex),
-                                          (const void *) ((char *) example.boneWeight - (char *) &example));
+                    glVertexAttribPointer(bnwtLoc, SCENE_RESOURCE_BONE_PER_VERTEX,
+                                          quantized ? GL_UNSIGNED_BYTE : GL_FLOAT, quantized, stride,
+                                          SCENE_ATTRIBUTE_OFFSET(boneWeight));
                 }
             }
+#undef SCENE_ATTRIBUTE_OFFSET
 
-            glBindVertexArray(0);
+            GLState::bindVertexArray(0);
 
             return true;
         }
 
-        void render() const {
-            if (!available) return;
-            glBindVertexArray(vao);
-            for (int i = 0; i < meshEntry.size(); i++) {
-                // Comment out material texture binding to allow custom texture binding in main.cpp
-                // if (!material[meshEntry[i].materialIndex].diffuse->bind(
-                //         SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL))
-                //     glBindTexture(GL_TEXTURE_2D, 0);
+        // Dequantization terms for the shader: position = attribute * scale + bias, likewise for texcoords
+        // (xy scale, zw bias); the identity for the full layout.
+        Dequantize getDequantize() const {
+            Dequantize terms;
+            terms.positionScale = positionScale;
+            terms.positionBias = positionBias;
+            terms.texcoordTransf = glm::fvec4(texcoordScale, texcoordBias);
+            return terms;
+        }
+
+        VertexFormat getVertexFormat() const { return vertexFormat; }
 
-                glDrawElementsBaseVertex(GL_TRIANGLES,
-                                         meshEntry[i].facetCornerNum,
-                                         GL_UNSIGNED_INT,
-                                         (void *) (sizeof(unsigned int) * meshEntry[i].indexOffset),
-                                         meshEntry[i].vertexOffset);
-            }
-            glBindVertexArray(0);
+        GLenum getIndexType() const { return indexType; }
+
+        size_t indexSize() const {
+            return indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+        }
+
+        size_t getVertexNum() const { return vertexCount; }
+
+        GLuint indexBuffer() const { return ebo; }
+
+        // Empty unless the scene was loaded with keepSkinningMesh
+        const CpuSkinning::Mesh &getSkinningMesh() const { return skinningMesh; }
+
+        // This scene's part of the pool's vertex buffer, in bytes
+        size_t vertexBufferSize() const {
+            return vertexCount * (vertexFormat == VERTEX_FORMAT_QUANTIZED ? sizeof(QuantizedVertex)
+                                                                          : sizeof(ParametricVertex));
         }
 
+        size_t lodNum() const { return lodError.size(); }
+
+        // Coarsest level whose error, at pixelsPerUnit screen pixels per object-space unit, stays within
+        // SCENE_LOD_PIXEL_ERROR pixels. For a perspective camera at distance d with vertical field of view
+        // fovy, pixelsPerUnit = viewportHeight / (2 * d * tan(fovy / 2)).
+        unsigned int selectLod(float pixelsPerUnit) const {
+            for (size_t lod = lodError.size(); lod-- > 1;)
+                if (lodError[lod] * pixelsPerUnit <= SCENE_LOD_PIXEL_ERROR) return (unsigned int) lod;
+            return 0;
+        }
+
+        size_t lodTriangleNum(unsigned int lod) const {
+            size_t num = 0;
+            for (size_t i = lod * lodMeshNum; i < (lod + 1) * lodMeshNum && i < meshEntry.size(); i++)
+                num += meshEntry[i].facetCornerNum / 3;
+            return num;
+        }
+
+        size_t bucketMeshNum() const { return lodMeshNum / SCENE_INFLUENCE_BUCKET_NUM; }
+
+        size_t bucketTriangleNum(unsigned int lod, unsigned int bucket) const {
+            size_t num = 0;
+            if (lod >= lodNum() || bucket >= SCENE_INFLUENCE_BUCKET_NUM) return 0;
+            size_t first = lod * lodMeshNum + bucket * bucketMeshNum();
+            for (size_t i = first; i < first + bucketMeshNum(); i++)
+                num += meshEntry[i].facetCornerNum / 3;
+            return num;
+        }
+
+        // Draws every mesh entry of the level with a single multi-draw, for a shader that reads all
+        // boneInfluenceNum() weights. Material textures are not bound, to allow custom texture binding in
+        // main.cpp; DrawList::submit(true) binds them, one run per material.
+        void render(unsigned int lod = 0) const {
+            if (!available || !lodMeshNum) return;
+            if (lod >= lodNum()) lod = lodNum() - 1;
+            drawEntries(vao, lod * lodMeshNum, lodMeshNum, drawBaseVertex.data());
+        }
+
+        // Draws the level from another vertex array that shares this scene's index buffer and vertex numbering,
+        // such as post-skinned vertices captured by renderPoints(); one draw covers every influence bucket.
+        void renderFrom(GLuint vertexArray, unsigned int lod = 0) const {
+            if (!available || !lodMeshNum) return;
+            if (lod >= lodNum()) lod = lodNum() - 1;
+            drawEntries(vertexArray, lod * lodMeshNum, lodMeshNum, localBaseVertex.data());
+        }
+
+        // Draws every vertex of the shared buffer once as a point, for skinning into a transform feedback
+        // buffer: captured vertex i is vertex i, so renderFrom() can draw any level from the capture.
+        void renderPoints() const {
+            if (!available || !vertexCount) return;
+            GLState::bindVertexArray(vao);
+            glDrawArrays(GL_POINTS, (GLint) firstVertex, (GLsizei) vertexCount);
+        }
+
+        // Draws the level's triangles of one influence bucket, for a shader that reads bucketInfluenceNum(bucket)
+        // weights; drawing every bucket of a level draws the whole level.
+        void renderBucket(unsigned int lod, unsigned int bucket) const {
+            if (!available || !lodMeshNum || bucket >= SCENE_INFLUENCE_BUCKET_NUM) return;
+            if (lod >= lodNum()) lod = lodNum() - 1;
+            drawEntries(vao, lod * lodMeshNum + bucket * bucketMeshNum(), bucketMeshNum(), drawBaseVertex.data());
+        }
+
+        size_t boneNum() const { return skeleton.size(); }
+
+        // Bone weights a shader has to read per vertex; the slots past it are 0 for every vertex.
+        unsigned int boneInfluenceNum() const { return influenceNum; }
+
         void printBoneNames() const {  // Debug function to print all bone names in the scene.
             std::cout << "Bone names in the model:" << std::endl;
             for (const auto& pair : nameBoneMap) {
@@ -427,6 +1415,226 @@ namespace SkeletalMesh {
         }
     };
 
+    // Collects the mesh entries of any number of scenes and submits them sorted by state: entries that share
+    // vertex array, index type, diffuse texture and instance count form a run, and each run is one
+    // glMultiDrawElementsBaseVertex, or one glMultiDrawElementsIndirect when ARB_multi_draw_indirect is
+    // available. Submission thus costs one draw call per state change instead of one per mesh entry. Scenes of
+    // one vertex format and index type share a GeometryPool, so their entries merge into the same runs; only
+    // quantized scenes stay apart, as each has its own dequantization uniforms, which the caller sets.
+    //     DrawList list;
+    //     list.add(hand, hand.selectLod(pixelsPerUnit));
+    //     list.add(prop);
+    //     list.submit(true);
+    class DrawList {
+    public:
+        struct Item {
+            GLuint vao;
+            GLenum indexType;
+            const Scene *quantized;  // the scene of quantized entries, NULL for full vertices
+            const TextureImage::Texture *diffuse;
+            GLsizei count;
+            const GLvoid *indexOffset;  // in bytes
+            GLint baseVertex;
+            GLsizei instanceCount;
+        };
+
+        // Layout of GL_DRAW_INDIRECT_BUFFER records for glMultiDrawElementsIndirect
+        struct IndirectCommand {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint firstIndex;  // in indices
+            GLint baseVertex;
+            GLuint baseInstance;
+        };
+
+        // Indirect submission is used when supported unless disabled here, e.g. to compare both paths
+        static bool allowIndirect;
+
+        DrawList()
+                : indirectBuffer(0), sortedFor(-1), lastDrawCallNum(0) {}
+
+        ~DrawList() { glDeleteBuffers(1, &indirectBuffer); }
+
+        void clear() {
+            items.clear();
+            sortedFor = -1;
+        }
+
+        // Queues the mesh entries of the scene's level; nothing is drawn before submit(). Without a bucket, all
+        // influence buckets together, so the shader in use at submit() reads all boneInfluenceNum() weights;
+        // with a bucket below SCENE_INFLUENCE_BUCKET_NUM, only that bucket's entries, as Scene::renderBucket().
+        // Instanced entries take per-instance data from gl_InstanceID in the shader.
+        void add(const Scene &scene, unsigned int lod = 0, GLsizei instanceCount = 1,
+                 unsigned int bucket = SCENE_INFLUENCE_BUCKET_NUM) {
+            addEntries(scene, scene.vao, scene.drawBaseVertex, lod, instanceCount, bucket);
+        }
+
+        // Queues the level's entries drawn from another vertex array holding this scene's vertices alone, in
+        // its numbering, as Scene::renderFrom(); every influence bucket, since such vertices are skinned.
+        void addFrom(GLuint vertexArray, const Scene &scene, unsigned int lod = 0) {
+            addEntries(scene, vertexArray, scene.localBaseVertex, lod, 1, SCENE_INFLUENCE_BUCKET_NUM);
+        }
+
+        // Sorts the queued entries and draws them; the list keeps them for the next submit() until clear(), and
+        // a list submitted again unchanged is neither sorted nor uploaded again, only drawn.
+        // With bindMaterials, each run binds its diffuse texture to SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL.
+        void submit(bool bindMaterials = false) {
+            lastDrawCallNum = 0;
+            if (items.empty()) return;
+
+            // Indirect commands carry their own instance count, the plain multi-draw needs runs of equal ones
+            bool indirect = allowIndirect && GLEW_ARB_multi_draw_indirect;
+            RunOrder less(items, !indirect);
+            bool resort = sortedFor != (indirect ? 1 : 0);
+            if (resort) {
+                order.resize(items.size());
+                for (size_t i = 0; i < order.size(); i++) order[i] = i;
+                std::stable_sort(order.begin(), order.end(), less);
+                sortedFor = indirect ? 1 : 0;
+            }
+
+            if (indirect && !resort) {
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            } else if (indirect) {
+                commands.resize(items.size());
+                for (size_t i = 0; i < order.size(); i++) {
+                    const Item &item = items[order[i]];
+                    commands[i].count = item.count;
+                    commands[i].instanceCount = item.instanceCount;
+                    commands[i].firstIndex = (GLuint) ((size_t) item.indexOffset / indexSize(item.indexType));
+                    commands[i].baseVertex = item.baseVertex;
+                    commands[i].baseInstance = 0;
+                }
+                if (!indirectBuffer) glGenBuffers(1, &indirectBuffer);
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+                glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(IndirectCommand) * commands.size(), commands.data(),
+                             GL_STREAM_DRAW);
+            }
+
+            const TextureImage::Texture *boundDiffuse = NULL;
+            for (size_t begin = 0, end; begin < order.size(); begin = end) {
+                const Item &first = items[order[begin]];
+                for (end = begin + 1; end < order.size(); end++)
+                    if (less(first, items[order[end]])) break;  // sorted, so the run ends at the first greater
+
+                GLState::bindVertexArray(first.vao);
+                if (bindMaterials && first.diffuse != boundDiffuse) {
+                    boundDiffuse = first.diffuse;
+                    if (!boundDiffuse->bind(SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL))
+                        GLState::bindTexture(SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL, GL_TEXTURE_2D, 0);
+                }
+
+                GLsizei runSize = (GLsizei) (end - begin);
+                if (indirect) {
+                    glMultiDrawElementsIndirect(GL_TRIANGLES, first.indexType,
+                                                (const GLvoid *) (sizeof(IndirectCommand) * begin), runSize, 0);
+                    lastDrawCallNum++;
+                } else if (first.instanceCount == 1) {
+                    counts.resize(runSize);
+                    offsets.resize(runSize);
+                    baseVertices.resize(runSize);
+                    for (GLsizei i = 0; i < runSize; i++) {
+                        const Item &item = items[order[begin + i]];
+                        counts[i] = item.count;
+                        offsets[i] = item.indexOffset;
+                        baseVertices[i] = item.baseVertex;
+                    }
+                    glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), first.indexType, offsets.data(),
+                                                  runSize, baseVertices.data());
+                    lastDrawCallNum++;
+                } else {
+                    // GL 3.3 has no instanced multi-draw without the indirect extension
+                    for (size_t i = begin; i < end; i++) {
+                        const Item &item = items[order[i]];
+                        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, item.count, item.indexType,
+                                                          item.indexOffset, item.instanceCount, item.baseVertex);
+                        lastDrawCallNum++;
+                    }
+                }
+            }
+
+            if (indirect) glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+
+        size_t entryNum() const { return items.size(); }
+
+        // Draw calls issued by the last submit()
+        size_t drawCallNum() const { return lastDrawCallNum; }
+
+    private:
+        // Orders by the state an entry needs, most expensive change first; entries that compare equal share a run.
+        // Runs are always material-coherent, whether submit() binds the textures or the caller's shader ignores them.
+        struct RunOrder {
+            const std::vector<Item> &items;
+            bool byInstanceCount;
+
+            RunOrder(const std::vector<Item> &_items, bool _byInstanceCount)
+                    : items(_items), byInstanceCount(_byInstanceCount) {}
+
+            bool operator()(size_t a, size_t b) const { return (*this)(items[a], items[b]); }
+
+            bool operator()(const Item &a, const Item &b) const {
+                if (a.vao != b.vao) return a.vao < b.vao;
+                if (a.indexType != b.indexType) return a.indexType < b.indexType;
+                if (a.quantized != b.quantized) return std::less<const void *>()(a.quantized, b.quantized);
+                if (a.diffuse != b.diffuse) return std::less<const void *>()(a.diffuse, b.diffuse);
+                if (byInstanceCount && a.instanceCount != b.instanceCount) return a.instanceCount < b.instanceCount;
+                return false;
+            }
+        };
+
+        static size_t indexSize(GLenum indexType) {
+            return indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+        }
+
+        void addEntries(const Scene &scene, GLuint vertexArray, const std::vector<GLint> &baseVertex,
+                        unsigned int lod, GLsizei instanceCount, unsigned int bucket) {
+            if (!scene.available || !scene.lodMeshNum || instanceCount <= 0) return;
+            if (lod >= scene.lodNum()) lod = scene.lodNum() - 1;
+            size_t first = lod * scene.lodMeshNum, end = first + scene.lodMeshNum;
+            if (bucket < SCENE_INFLUENCE_BUCKET_NUM) {
+                first += bucket * scene.bucketMeshNum();
+                end = first + scene.bucketMeshNum();
+            }
+            for (size_t i = first; i < end; i++) {
+                if (!scene.drawCount[i]) continue;  // empty influence bucket
+                Item item;
+                item.vao = vertexArray;
+                item.indexType = scene.indexType;
+                item.quantized = scene.vertexFormat == VERTEX_FORMAT_QUANTIZED ? &scene : NULL;
+                item.diffuse = scene.meshEntry[i].materialIndex < scene.material.size()
+                               ? scene.material[scene.meshEntry[i].materialIndex].diffuse
+                               : &TextureImage::Texture::error;
+                item.count = scene.drawCount[i];
+                item.indexOffset = scene.drawIndexOffset[i];
+                item.baseVertex = baseVertex[i];
+                item.instanceCount = instanceCount;
+                items.push_back(item);
+                sortedFor = -1;
+            }
+        }
+
+        std::vector<Item> items;
+        std::vector<size_t> order;
+        // Per-submit scratch, kept to avoid reallocating every frame
+        std::vector<IndirectCommand> commands;
+        std::vector<GLsizei> counts;
+        std::vector<const GLvoid *> offsets;
+        std::vector<GLint> baseVertices;
+        GLuint indirectBuffer;
+        int sortedFor;  // 1 when order and the indirect buffer match items, 0 when order does, -1 otherwise
+        size_t lastDrawCallNum;
+
+        DrawList(const DrawList &);
+        DrawList &operator=(const DrawList &);
+    };
+
     Scene::Name2Scene Scene::allScene;
+    std::string Scene::cacheDirectory;
+    VertexFormat Scene::preferredVertexFormat = VERTEX_FORMAT_FULL;
+    unsigned int Scene::optimizeFlags = SCENE_OPTIMIZE_ALL;
+    bool Scene::keepSkinningMesh = false;
     Scene Scene::error;
+    bool DrawList::allowIndirect = true;
+    GeometryPool::Key2Pool GeometryPool::allPool;
 }
\ No newline at end of file
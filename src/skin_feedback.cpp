@@ -0,0 +1,72 @@
+#include "skin_feedback.h"
+#include "gl_state.h"
+#include <iostream>
+
+
+namespace SkinFeedback {
+    SkinnedBuffer::SkinnedBuffer()
+        : buffer(0), vao(0), vertexNum(0) {
+    }
+
+    SkinnedBuffer::~SkinnedBuffer() {
+        destroy();
+    }
+
+    bool SkinnedBuffer::initialize(size_t _vertexNum, GLuint indexBuffer) {
+        destroy();
+        if (_vertexNum == 0 || !indexBuffer) {
+            std::cout << "Skinned buffer needs vertices and an index buffer" << std::endl;
+            return false;
+        }
+        vertexNum = _vertexNum;
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(SkinnedVertex) * vertexNum, nullptr, GL_DYNAMIC_COPY);
+
+        glGenVertexArrays(1, &vao);
+        GLState::bindVertexArray(vao);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex),
+                              (const void *) offsetof(SkinnedVertex, position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex),
+                              (const void *) offsetof(SkinnedVertex, texcoord));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex),
+                              (const void *) offsetof(SkinnedVertex, normal));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        GLState::bindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return true;
+    }
+
+    void SkinnedBuffer::destroy() {
+        GLState::deleteVertexArray(vao);
+        if (buffer) glDeleteBuffers(1, &buffer);
+        vao = 0;
+        buffer = 0;
+        vertexNum = 0;
+    }
+
+    bool SkinnedBuffer::read(std::vector<SkinnedVertex> &vertices) const {
+        if (!buffer) return false;
+        vertices.resize(vertexNum);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(SkinnedVertex) * vertexNum, vertices.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return true;
+    }
+
+    void SkinnedBuffer::beginCapture() {
+        glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer, 0, sizeof(SkinnedVertex) * vertexNum);
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBeginTransformFeedback(GL_POINTS);
+    }
+
+    void SkinnedBuffer::endCapture() {
+        glEndTransformFeedback();
+        glDisable(GL_RASTERIZER_DISCARD);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <vector>
+
+namespace SkinFeedback {
+    // One post-skinned vertex as captured from the skinning shader's feedback varyings, which must be
+    // declared in this order; the draw vertex array reads it as attributes 0 (position), 1 (texcoord)
+    // and 2 (normal), the locations the skinning shader takes its inputs from.
+    struct SkinnedVertex {
+        float position[3];
+        float texcoord[2];
+        float normal[3];
+    };
+
+    // Skinned vertices of one mesh, written once per frame by a transform feedback pass and then drawn by
+    // any number of passes with a vertex shader that only transforms them, so extra passes do not skin again.
+    // The capture keeps the source's vertex numbering, so the source's index buffer and draw ranges apply.
+    class SkinnedBuffer {
+    public:
+        SkinnedBuffer();
+        ~SkinnedBuffer();
+
+        // Room for vertexNum vertices; the draw vertex array uses the source mesh's index buffer.
+        bool initialize(size_t vertexNum, GLuint indexBuffer);
+        void destroy();
+
+        // Between these, draw every source vertex once as GL_POINTS with the skinning program in use.
+        // Rasterization is discarded meanwhile.
+        void beginCapture();
+        void endCapture();
+
+        // Draws from it read the last capture.
+        GLuint vertexArray() const { return vao; }
+
+        // Copies the last capture back, waiting for the GPU; for validation, not per frame.
+        bool read(std::vector<SkinnedVertex> &vertices) const;
+
+        size_t getVertexNum() const { return vertexNum; }
+
+        bool isValid() const { return vao != 0; }
+
+    private:
+        GLuint buffer;
+        GLuint vao;
+        size_t vertexNum;
+
+        SkinnedBuffer(const SkinnedBuffer &_copy);
+        SkinnedBuffer &operator=(const SkinnedBuffer &_copy);
+    };
+}
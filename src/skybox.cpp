@@ -1,18 +1,16 @@
 #include "skybox.h"
+#include "gl_state.h"
 #include <iostream>
 
 
 namespace Skybox {
     SkyboxRenderer::SkyboxRenderer()
-        : shaderProgram(0), VAO(0), VBO(0), EBO(0), hdrTexture(nullptr) {
+        : viewUniform(-1), projectionUniform(-1), hdrTextureUniform(-1), VAO(0), VBO(0), EBO(0), hdrTexture(nullptr) {
     }
 
     SkyboxRenderer::~SkyboxRenderer() {
-        if (shaderProgram) {
-            glDeleteProgram(shaderProgram);
-        }
         if (VAO) {
-            glDeleteVertexArrays(1, &VAO);
+            GLState::deleteVertexArray(VAO);
         }
         if (VBO) {
             glDeleteBuffers(1, &VBO);
@@ -23,62 +21,27 @@ namespace Skybox {
     }
 
     bool SkyboxRenderer::initialize(const std::string& hdrTexturePath) {
-        // Load HDR texture
-        hdrTexture = &TextureImage::Texture::loadHDRTexture("skybox_hdr", hdrTexturePath);
+        // Load HDR texture; decoding runs in the background and a black placeholder is bound until it is done
+        hdrTexture = &TextureImage::Texture::loadHDRTextureAsync("skybox_hdr", hdrTexturePath);
         if (!hdrTexture->bind(0)) {
             std::cout << "Failed to load HDR texture for skybox" << std::endl;
             return false;
         }
 
-        // Create and compile shaders
-        GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
-        glCompileShader(vertexShader);
-
-        GLint success;
-        glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-        if (!success) {
-            char infoLog[512];
-            glGetShaderInfoLog(vertexShader, 512, nullptr, infoLog);
-            std::cout << "Vertex shader compilation failed: " << infoLog << std::endl;
-            return false;
-        }
-
-        GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
-        glCompileShader(fragmentShader);
-
-        glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-        if (!success) {
-            char infoLog[512];
-            glGetShaderInfoLog(fragmentShader, 512, nullptr, infoLog);
-            std::cout << "Fragment shader compilation failed: " << infoLog << std::endl;
+        // Compile, link and reflect the uniforms once
+        if (!shaderProgram.build(vertexShaderSource, fragmentShaderSource)) {
             return false;
         }
-
-        // Link shaders
-        shaderProgram = glCreateProgram();
-        glAttachShader(shaderProgram, vertexShader);
-        glAttachShader(shaderProgram, fragmentShader);
-        glLinkProgram(shaderProgram);
-
-        glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-        if (!success) {
-            char infoLog[512];
-            glGetProgramInfoLog(shaderProgram, 512, nullptr, infoLog);
-            std::cout << "Shader program linking failed: " << infoLog << std::endl;
-            return false;
-        }
-
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+        viewUniform = shaderProgram.uniform("u_view");
+        projectionUniform = shaderProgram.uniform("u_projection");
+        hdrTextureUniform = shaderProgram.uniform("u_hdrTexture");
 
         // Set up VAO, VBO, EBO
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
+        GLState::bindVertexArray(VAO);
 
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
@@ -89,7 +52,7 @@ namespace Skybox {
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (void*)0);
         glEnableVertexAttribArray(0);
 
-        glBindVertexArray(0);
+        GLState::bindVertexArray(0);
 
         return true;
     }
@@ -120,33 +83,27 @@ namespace Skybox {
 // }
 
     void SkyboxRenderer::render(const glm::mat4& view, const glm::mat4& projection) {
-        if (!shaderProgram) return;
+        if (!shaderProgram.isValid()) return;
+
+        // 设置深度测试为GL_LEQUAL，天空盒深度为1.0。之后绘制的场景也用GL_LEQUAL，不再恢复为GL_LESS，每帧不必来回切换。
+        GLState::depthFunc(GL_LEQUAL);
 
-        // 设置深度测试为GL_LEQUAL
-        glDepthFunc(GL_LEQUAL);
-        
         // Remove translation from view matrix for skybox
         glm::mat4 viewNoTranslation = glm::mat4(glm::mat3(view));
 
-        glUseProgram(shaderProgram);
+        shaderProgram.use();
 
-        // Set uniforms
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "u_view"), 1, GL_FALSE, glm::value_ptr(viewNoTranslation));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "u_projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        // Set uniforms; unchanged values (a still camera) are not uploaded again
+        shaderProgram.set(viewUniform, glm::fmat4(viewNoTranslation));
+        shaderProgram.set(projectionUniform, glm::fmat4(projection));
 
         // 绑定纹理 - 使用正确的纹理名称
         TextureImage::Texture::getTexture("skybox_hdr").bind(0);
-        glUniform1i(glGetUniformLocation(shaderProgram, "u_hdrTexture"), 0);
+        shaderProgram.set(hdrTextureUniform, 0);
 
-        // Render skybox
-        glBindVertexArray(VAO);
+        // Render skybox; program and VAO stay bound, the state cache skips rebinding them next frame
+        GLState::bindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        glUseProgram(0);
-        
-        // 恢复深度测试
-        glDepthFunc(GL_LESS);
     }
 
 }
\ No newline at end of file
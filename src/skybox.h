@@ -8,6 +8,7 @@
 #include <string>
 
 #include "texture_image.h"
+#include "shader_program.h"
 
 namespace Skybox {
     class SkyboxRenderer {
@@ -19,7 +20,8 @@ namespace Skybox {
         void render(const glm::mat4& view, const glm::mat4& projection);
 
     private:
-        GLuint shaderProgram;
+        ShaderProgram::Program shaderProgram;
+        ShaderProgram::Program::Uniform viewUniform, projectionUniform, hdrTextureUniform;
         GLuint VAO, VBO, EBO;
         TextureImage::Texture* hdrTexture;
 
@@ -0,0 +1,342 @@
+#include "texture_cook.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef TEXTURE_COOK_USE_MINIZ
+#include <miniz.h>
+#endif
+
+
+namespace TextureCook {
+    typedef unsigned char Texel[4];
+
+    GLenum formatOf(Usage usage) {
+        switch (usage) {
+            case USAGE_COLOR:
+            case USAGE_ORM:
+                return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            case USAGE_NORMAL:
+                return GL_COMPRESSED_RG_RGTC2;
+            default:
+                return GL_COMPRESSED_RED_RGTC1;
+        }
+    }
+
+    bool isSupported(Usage usage) {
+        // RGTC is core since 3.0, S3TC is not core in any desktop version
+        return formatOf(usage) != GL_COMPRESSED_RGB_S3TC_DXT1_EXT || GLEW_EXT_texture_compression_s3tc;
+    }
+
+    static size_t blockSize(GLenum format) {
+        return format == GL_COMPRESSED_RG_RGTC2 ? 16 : 8;
+    }
+
+    // Gathers a 4x4 block, clamping at the edges of levels smaller than a block.
+    static void fetchBlock(const std::vector<unsigned char> &level, int width, int height, int bx, int by,
+                           Texel block[16]) {
+        for (int y = 0; y < 4; y++) {
+            int sy = std::min(by * 4 + y, height - 1);
+            for (int x = 0; x < 4; x++) {
+                int sx = std::min(bx * 4 + x, width - 1);
+                memcpy(block[y * 4 + x], &level[((size_t) sy * width + sx) * 4], 4);
+            }
+        }
+    }
+
+    static unsigned short to565(const float color[3]) {
+        int r = (int) (std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+        int g = (int) (std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+        int b = (int) (std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+        return (unsigned short) ((r << 11) | (g << 5) | b);
+    }
+
+    static void from565(unsigned short c, int color[3]) {
+        int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // BC1: endpoints are the extremes of the block along its principal axis, four-colour mode only.
+    static void encodeBC1(const Texel block[16], unsigned char *out) {
+        float mean[3] = {0, 0, 0};
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++) mean[c] += block[i][c] / 16.0f;
+
+        float cov[6] = {0, 0, 0, 0, 0, 0};  // xx xy xz yy yz zz
+        for (int i = 0; i < 16; i++) {
+            float d[3] = {block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2]};
+            cov[0] += d[0] * d[0];
+            cov[1] += d[0] * d[1];
+            cov[2] += d[0] * d[2];
+            cov[3] += d[1] * d[1];
+            cov[4] += d[1] * d[2];
+            cov[5] += d[2] * d[2];
+        }
+        float axis[3] = {1, 1, 1};
+        for (int iter = 0; iter < 8; iter++) {  // power iteration
+            float next[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                             cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                             cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+            float length = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+            if (length < 1e-6f) break;
+            for (int c = 0; c < 3; c++) axis[c] = next[c] / length;
+        }
+
+        float tmin = 0, tmax = 0;
+        for (int i = 0; i < 16; i++) {
+            float t = 0;
+            for (int c = 0; c < 3; c++) t += (block[i][c] - mean[c]) * axis[c];
+            tmin = std::min(tmin, t);
+            tmax = std::max(tmax, t);
+        }
+        float high[3], low[3];
+        for (int c = 0; c < 3; c++) {
+            high[c] = mean[c] + axis[c] * tmax;
+            low[c] = mean[c] + axis[c] * tmin;
+        }
+        unsigned short c0 = to565(high), c1 = to565(low);
+        if (c0 < c1) std::swap(c0, c1);  // c0 > c1 selects the four-colour mode
+
+        unsigned int indices = 0;
+        if (c0 != c1) {
+            int palette[4][3];
+            from565(c0, palette[0]);
+            from565(c1, palette[1]);
+            for (int c = 0; c < 3; c++) {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            for (int i = 0; i < 16; i++) {
+                int best = 0, bestError = 1 << 30;
+                for (int p = 0; p < 4; p++) {
+                    int error = 0;
+                    for (int c = 0; c < 3; c++) {
+                        int d = block[i][c] - palette[p][c];
+                        error += d * d;
+                    }
+                    if (error < bestError) {
+                        bestError = error;
+                        best = p;
+                    }
+                }
+                indices |= (unsigned int) best << (i * 2);
+            }
+        }
+        out[0] = c0 & 0xff;
+        out[1] = c0 >> 8;
+        out[2] = c1 & 0xff;
+        out[3] = c1 >> 8;
+        for (int i = 0; i < 4; i++) out[4 + i] = (indices >> (i * 8)) & 0xff;
+    }
+
+    // BC4: eight-value mode between the block's min and max of one channel.
+    static void encodeBC4(const Texel block[16], int channel, unsigned char *out) {
+        int high = 0, low = 255;
+        for (int i = 0; i < 16; i++) {
+            high = std::max(high, (int) block[i][channel]);
+            low = std::min(low, (int) block[i][channel]);
+        }
+        unsigned long long indices = 0;
+        if (high != low) {
+            int palette[8];
+            palette[0] = high;
+            palette[1] = low;
+            for (int p = 1; p < 7; p++) palette[p + 1] = ((7 - p) * high + p * low + 3) / 7;
+            for (int i = 0; i < 16; i++) {
+                int best = 0, bestError = 256;
+                for (int p = 0; p < 8; p++) {
+                    int error = abs(block[i][channel] - palette[p]);
+                    if (error < bestError) {
+                        bestError = error;
+                        best = p;
+                    }
+                }
+                indices |= (unsigned long long) best << (i * 3);
+            }
+        }
+        out[0] = (unsigned char) high;
+        out[1] = (unsigned char) low;
+        for (int i = 0; i < 6; i++) out[2 + i] = (indices >> (i * 8)) & 0xff;
+    }
+
+    static void encodeLevel(const std::vector<unsigned char> &level, int width, int height, GLenum format,
+                            unsigned char *out) {
+        int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        Texel block[16];
+        for (int by = 0; by < blocksY; by++) {
+            for (int bx = 0; bx < blocksX; bx++) {
+                fetchBlock(level, width, height, bx, by, block);
+                if (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) {
+                    encodeBC1(block, out);
+                } else if (format == GL_COMPRESSED_RG_RGTC2) {
+                    encodeBC4(block, 0, out);
+                    encodeBC4(block, 1, out + 8);
+                } else {
+                    encodeBC4(block, 0, out);
+                }
+                out += blockSize(format);
+            }
+        }
+    }
+
+    // 2x2 box filter; normals are averaged as vectors and renormalized so deep mips do not flatten.
+    static void downsample(const std::vector<unsigned char> &source, int width, int height, bool normal,
+                           std::vector<unsigned char> &target, int &targetWidth, int &targetHeight) {
+        targetWidth = std::max(1, width / 2);
+        targetHeight = std::max(1, height / 2);
+        target.resize((size_t) targetWidth * targetHeight * 4);
+        for (int y = 0; y < targetHeight; y++) {
+            for (int x = 0; x < targetWidth; x++) {
+                float sum[4] = {0, 0, 0, 0};
+                for (int dy = 0; dy < 2; dy++) {
+                    for (int dx = 0; dx < 2; dx++) {
+                        int sx = std::min(x * 2 + dx, width - 1), sy = std::min(y * 2 + dy, height - 1);
+                        const unsigned char *texel = &source[((size_t) sy * width + sx) * 4];
+                        for (int c = 0; c < 4; c++)
+                            sum[c] += normal && c < 3 ? texel[c] / 127.5f - 1.0f : (float) texel[c];
+                    }
+                }
+                unsigned char *texel = &target[((size_t) y * targetWidth + x) * 4];
+                if (normal) {
+                    float length = sqrtf(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+                    if (length < 1e-6f) {
+                        sum[0] = sum[1] = 0.0f;
+                        sum[2] = length = 1.0f;
+                    }
+                    for (int c = 0; c < 3; c++)
+                        texel[c] = (unsigned char) std::min(255.0f, (sum[c] / length + 1.0f) * 127.5f + 0.5f);
+                    texel[3] = (unsigned char) (sum[3] / 4.0f + 0.5f);
+                } else {
+                    for (int c = 0; c < 4; c++) texel[c] = (unsigned char) (sum[c] / 4.0f + 0.5f);
+                }
+            }
+        }
+    }
+
+    bool cook(const unsigned char *pixels, int width, int height, int channels, Usage usage, CookedImage &image) {
+        if (!pixels || width <= 0 || height <= 0 || channels < 1 || channels > 4) return false;
+
+        // Expand to RGBA8 so the encoders and the filter only deal with one layout
+        std::vector<unsigned char> level((size_t) width * height * 4);
+        for (size_t i = 0; i < (size_t) width * height; i++) {
+            const unsigned char *source = pixels + i * channels;
+            unsigned char *texel = &level[i * 4];
+            texel[0] = source[0];
+            texel[1] = channels >= 2 ? source[1] : source[0];
+            texel[2] = channels >= 3 ? source[2] : source[0];
+            texel[3] = channels == 4 ? source[3] : 255;
+        }
+
+        image.format = formatOf(usage);
+        image.width = width;
+        image.height = height;
+        image.mips.clear();
+        image.payload.clear();
+        image.file.close();
+
+        std::vector<unsigned char> next;
+        int levelWidth = width, levelHeight = height;
+        while (true) {
+            CookedMip mip;
+            mip.width = levelWidth;
+            mip.height = levelHeight;
+            mip.offset = (unsigned int) image.payload.size();
+            mip.size = (unsigned int) (((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * blockSize(image.format));
+            image.payload.resize(mip.offset + mip.size);
+            encodeLevel(level, levelWidth, levelHeight, image.format, &image.payload[mip.offset]);
+            image.mips.push_back(mip);
+
+            if (levelWidth == 1 && levelHeight == 1) break;
+            downsample(level, levelWidth, levelHeight, usage == USAGE_NORMAL, next, levelWidth, levelHeight);
+            level.swap(next);
+        }
+        return true;
+    }
+
+    bool loadCooked(const std::string &filename, FileCache::Hash sourceHash, Usage usage, CookedImage &image) {
+        image.file.close();
+        image.payload.clear();
+        if (!image.file.open(filename)) return false;
+
+        const CookHeader *header = image.file.view<CookHeader>(0);
+        bool valid = header && header->magic == TEXTURE_COOK_MAGIC && header->version == TEXTURE_COOK_VERSION &&
+                     header->sourceHash == sourceHash && header->usage == (unsigned int) usage &&
+                     header->format == formatOf(usage) && header->mipNum > 0 && header->mipNum <= 32;
+        const CookedMip *mips = valid ? image.file.view<CookedMip>(header->mipOffset, header->mipNum) : NULL;
+        const char *stored = valid ? image.file.view<char>(header->payloadOffset, header->storedSize) : NULL;
+        if (!mips || !stored) {
+            image.file.close();
+            return false;
+        }
+        for (unsigned int i = 0; i < header->mipNum; i++) {
+            if (mips[i].offset > header->payloadSize || mips[i].size > header->payloadSize - mips[i].offset) {
+                image.file.close();
+                return false;
+            }
+        }
+
+        image.format = header->format;
+        image.width = header->width;
+        image.height = header->height;
+        image.mips.assign(mips, mips + header->mipNum);
+        image.payloadOffset = header->payloadOffset;
+        image.payloadSize = header->payloadSize;
+
+        if (header->flags & TEXTURE_COOK_FLAG_DEFLATE) {
+#ifdef TEXTURE_COOK_USE_MINIZ
+            image.payload.resize(header->payloadSize);
+            mz_ulong inflatedSize = header->payloadSize;
+            bool ok = mz_uncompress(image.payload.data(), &inflatedSize, (const unsigned char *) stored,
+                                    header->storedSize) == MZ_OK && inflatedSize == header->payloadSize;
+            image.file.close();
+            if (!ok) image.payload.clear();
+            return ok;
+#else
+            image.file.close();  // written by a build with miniz; cook again
+            return false;
+#endif
+        }
+        if (header->storedSize != header->payloadSize) {
+            image.file.close();
+            return false;
+        }
+        return true;
+    }
+
+    bool saveCooked(const std::string &filename, FileCache::Hash sourceHash, Usage usage, const CookedImage &image) {
+        CookHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = TEXTURE_COOK_MAGIC;
+        header.version = TEXTURE_COOK_VERSION;
+        header.sourceHash = sourceHash;
+        header.usage = usage;
+        header.format = image.format;
+        header.width = image.width;
+        header.height = image.height;
+        header.mipNum = (unsigned int) image.mips.size();
+        header.payloadSize = (unsigned int) image.size();
+
+        FileCache::BlobWriter blob;
+        blob.append(&header, sizeof(header));
+        header.mipOffset = (unsigned int) blob.appendArray(image.mips);
+
+        const unsigned char *stored = image.data();
+        size_t storedSize = image.size();
+#ifdef TEXTURE_COOK_USE_MINIZ
+        std::vector<unsigned char> deflated(mz_compressBound(storedSize));
+        mz_ulong deflatedSize = deflated.size();
+        if (mz_compress2(deflated.data(), &deflatedSize, stored, storedSize, MZ_DEFAULT_LEVEL) == MZ_OK &&
+            deflatedSize < storedSize) {
+            stored = deflated.data();
+            storedSize = deflatedSize;
+            header.flags |= TEXTURE_COOK_FLAG_DEFLATE;
+        }
+#endif
+        header.payloadOffset = (unsigned int) blob.append(stored, storedSize);
+        header.storedSize = (unsigned int) storedSize;
+        blob.overwrite(0, &header, sizeof(header));
+        return blob.save(filename);
+    }
+}
@@ -0,0 +1,88 @@
+// Texture cooking: block compression (S3TC/RGTC) with a precomputed mip chain, stored in a small
+// container next to the other caches so later runs skip image decoding and mip generation.
+
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+#include "file_cache.h"
+
+#define TEXTURE_COOK_MAGIC 0x58455448u  // "HTEX"
+#define TEXTURE_COOK_VERSION 1
+#define TEXTURE_COOK_SUFFIX ".htex"
+#define TEXTURE_COOK_FLAG_DEFLATE 1u
+
+namespace TextureCook {
+    // What a texture is used for decides its compressed format and its placeholder while loading.
+    enum Usage {
+        USAGE_COLOR,      // BC1 (DXT1), RGB
+        USAGE_NORMAL,     // BC5 (RGTC2), tangent-space XY; the shader rebuilds Z = sqrt(1 - x^2 - y^2)
+        USAGE_METALLIC,   // BC4 (RGTC1), red channel
+        USAGE_ROUGHNESS,  // BC4 (RGTC1), red channel
+        USAGE_OCCLUSION,  // BC4 (RGTC1), red channel
+        USAGE_ORM         // BC1 (DXT1), occlusion / roughness / metallic packed into R / G / B
+    };
+
+    struct CookedMip {
+        unsigned int width;
+        unsigned int height;
+        unsigned int offset;  // into the uncompressed payload
+        unsigned int size;
+    };
+
+    struct CookHeader {
+        unsigned int magic;
+        unsigned int version;
+        FileCache::Hash sourceHash;
+        unsigned int usage;
+        unsigned int format;  // GL compressed internal format
+        unsigned int width;
+        unsigned int height;
+        unsigned int mipNum;
+        unsigned int flags;
+        unsigned int mipOffset;
+        unsigned int payloadOffset;
+        unsigned int payloadSize;  // uncompressed
+        unsigned int storedSize;   // as written at payloadOffset
+    };
+
+    // A cooked texture ready for glCompressedTexImage2D, either mapped from the cache file or just encoded.
+    class CookedImage {
+    public:
+        GLenum format;
+        unsigned int width;
+        unsigned int height;
+        std::vector<CookedMip> mips;
+
+        CookedImage() : format(0), width(0), height(0), payloadOffset(0), payloadSize(0) {}
+
+        const unsigned char *data() const {
+            return file.isOpen() ? (const unsigned char *) file.data() + payloadOffset : payload.data();
+        }
+
+        size_t size() const { return file.isOpen() ? payloadSize : payload.size(); }
+
+    private:
+        friend bool cook(const unsigned char *, int, int, int, Usage, CookedImage &);
+        friend bool loadCooked(const std::string &, FileCache::Hash, Usage, CookedImage &);
+        std::vector<unsigned char> payload;
+        FileCache::MappedFile file;  // uncompressed payloads are used in place
+        size_t payloadOffset;
+        size_t payloadSize;
+    };
+
+    GLenum formatOf(Usage usage);
+
+    // False when the driver lacks the format (S3TC is an extension even on GL 3.3 core).
+    bool isSupported(Usage usage);
+
+    // Encodes a full mip chain from 8-bit pixels with _channels components per pixel.
+    bool cook(const unsigned char *pixels, int width, int height, int channels, Usage usage, CookedImage &image);
+
+    // Maps a container written by saveCooked(); fails if it is stale, from another usage or corrupt.
+    bool loadCooked(const std::string &filename, FileCache::Hash sourceHash, Usage usage, CookedImage &image);
+    // Deflates the payload with miniz when built with TEXTURE_COOK_USE_MINIZ.
+    bool saveCooked(const std::string &filename, FileCache::Hash sourceHash, Usage usage, const CookedImage &image);
+}
@@ -1,6 +1,855 @@
 #include "tinyexr.h"
 #include "texture_image.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
 
 // ===== 静态成员初始化 =====
 TextureImage::Texture::Name2Texture TextureImage::Texture::allTexture;  // 全局纹理映射初始化。
+TextureImage::Texture::Hash2Image TextureImage::Texture::allImage;  // 共享图像映射初始化。
 TextureImage::Texture TextureImage::Texture::error;  // 错误纹理对象初始化。
+std::string TextureImage::Texture::cacheDirectory;  // 默认不使用压缩纹理缓存。
+
+namespace TextureImage {
+    // ===== 内容去重 =====
+    FileCache::Hash Texture::contentKey(FileCache::Hash _contentHash, unsigned int _variant) {
+        return FileCache::hashBytes(&_variant, sizeof(_variant), _contentHash);
+    }
+
+    bool Texture::acquireImage(FileCache::Hash _key) {
+        Hash2Image::iterator found = allImage.find(_key);
+        if (found == allImage.end() || !found->second.ready) return false;
+        SharedImage &image = found->second;
+        image.refs++;  // 先加引用，自己原来就引用同一图像时不会被释放。
+        releaseImage();
+        tex = image.tex;
+        imageKey = _key;
+        shared = true;
+        width = image.width;
+        height = image.height;
+        channels = image.channels;
+        available = true;
+        loaded = true;
+        return true;
+    }
+
+    void Texture::registerImage(FileCache::Hash _key) {
+        if (shared || tex == 0) return;
+        // 同一内容正由异步请求上传时不抢占，这份纹理保持独占。
+        if (allImage.find(_key) != allImage.end()) return;
+        SharedImage image = {tex, 1, 0, true, width, height, channels};
+        allImage[_key] = image;
+        imageKey = _key;
+        shared = true;
+    }
+
+    void Texture::releaseImage() {
+        if (shared) {
+            Hash2Image::iterator found = allImage.find(imageKey);
+            if (found != allImage.end() && --found->second.refs <= 0 && found->second.waiting == 0) {
+                GLState::deleteTexture(found->second.tex);
+                allImage.erase(found);
+            }
+        } else {
+            GLState::deleteTexture(tex);
+        }
+        tex = 0;
+        imageKey = 0;
+        shared = false;
+    }
+
+    // ===== 异步加载 =====
+    // 每个请求依次经过：哈希（工作线程）-> 查找共享图像（GL线程）-> 解码（工作线程）-> 映射PBO（GL线程）
+    // -> 拷贝到PBO（工作线程）-> 上传（GL线程）。
+    // 耗时的解码和拷贝都不在GL线程上，GL线程只做映射、glTexImage2D和glGenerateMipmap。
+    // 压缩路径下“解码”是读取（或首次生成）块压缩缓存，上传时逐级调用glCompressedTexImage2D。
+    // 内容相同的请求只有第一个解码上传，其余的停在ASYNC_ALIASED，等它完成后直接引用同一个GL纹理。
+    enum AsyncStage {
+        ASYNC_HASHING,   // 工作线程正在计算源文件内容的哈希。
+        ASYNC_HASHED,    // 哈希完成，等待GL线程查找共享图像。
+        ASYNC_ALIASED,   // 同一内容已在加载，等待它上传完成。
+        ASYNC_DECODING,  // 工作线程正在解码。
+        ASYNC_DECODED,   // 解码完成，等待GL线程映射PBO。
+        ASYNC_COPYING,   // 工作线程正在把像素拷贝到映射的PBO。
+        ASYNC_COPIED,    // 拷贝完成，等待GL线程上传。
+        ASYNC_FAILED     // 解码失败。
+    };
+
+    struct AsyncRequest {
+        Texture *target;  // 取消后为nullptr，结果被丢弃。
+        std::string name;
+        std::string filename;
+        bool hdr;
+        TextureCook::Usage usage;
+        std::string cookFilename;  // 压缩缓存文件，为空时走未压缩路径。
+        std::vector<std::string> packSources;  // ORM打包的三张源贴图，为空时filename是唯一的源。
+        std::atomic<int> stage;
+        FileCache::Hash sourceHash;  // 源文件内容的哈希，也用于校验压缩缓存。
+        FileCache::Hash imageKey;    // 共享键，哈希失败时为0，此时不参与去重。
+        bool primary;  // 是否负责解码上传allImage中imageKey对应的图像。
+        bool joined;   // 是否计入了共享图像的waiting。
+        int width, height, channels;
+        void *pixels;  // 解码结果（stbi或tinyexr分配）。
+        TextureCook::CookedImage *cooked;  // 压缩路径的结果，代替pixels。
+        std::vector<unsigned char> packed;  // 未压缩的ORM打包结果，代替pixels。
+        size_t size;
+        GLuint pbo;
+        void *mapped;
+        double startTime;
+    };
+
+    static std::vector<AsyncRequest *> asyncRequests;  // 只在GL线程上访问。
+    static JobSystem::Counter asyncCounter;
+
+    static double asyncClock() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static unsigned int placeholderOf(TextureCook::Usage usage) {
+        switch (usage) {
+            case TextureCook::USAGE_NORMAL:
+                return TEXTURE_PLACEHOLDER_NORMAL;
+            case TextureCook::USAGE_METALLIC:
+                return TEXTURE_PLACEHOLDER_BLACK;
+            case TextureCook::USAGE_OCCLUSION:
+                return TEXTURE_PLACEHOLDER_WHITE;
+            case TextureCook::USAGE_ORM:
+                return TEXTURE_PLACEHOLDER_ORM;
+            default:
+                return TEXTURE_PLACEHOLDER_GREY;
+        }
+    }
+
+    // 工作线程：把三张标量贴图的红色通道打包到RGB的三个通道。尺寸不同时按最大的尺寸最近邻采样，
+    // 缺失的贴图填充ORM占位值。
+    static bool packRequest(AsyncRequest *request, std::vector<unsigned char> &packed, int &width, int &height) {
+        const unsigned char fallback[3] = {TEXTURE_PLACEHOLDER_ORM & 0xff, (TEXTURE_PLACEHOLDER_ORM >> 8) & 0xff,
+                                           (TEXTURE_PLACEHOLDER_ORM >> 16) & 0xff};
+        unsigned char *data[3] = {nullptr, nullptr, nullptr};
+        int sizes[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+        width = height = 0;
+        for (int i = 0; i < 3; i++) {
+            if (request->packSources[i].empty()) continue;
+            data[i] = stbi_load(request->packSources[i].c_str(), &sizes[i][0], &sizes[i][1], &sizes[i][2], 0);
+            if (!data[i]) continue;
+            width = std::max(width, sizes[i][0]);
+            height = std::max(height, sizes[i][1]);
+        }
+        if (width > 0) {
+            packed.resize((size_t) width * height * 3);
+            for (int i = 0; i < 3; i++) {
+                for (int y = 0; y < height; y++) {
+                    int sy = data[i] ? y * sizes[i][1] / height : 0;
+                    for (int x = 0; x < width; x++) {
+                        unsigned char value = fallback[i];
+                        if (data[i]) value = data[i][((size_t) sy * sizes[i][0] + x * sizes[i][0] / width) * sizes[i][2]];
+                        packed[((size_t) y * width + x) * 3 + i] = value;
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < 3; i++)
+            if (data[i]) stbi_image_free(data[i]);
+        return width > 0;
+    }
+
+    // 源文件内容的哈希，只看内容不看路径，这样不同路径下的相同文件得到同一个值；
+    // 打包纹理按槽位依次计入每个源，缺失的源记为0，换了槽位也会改变结果。
+    static bool hashSources(const AsyncRequest *request, FileCache::Hash &hash) {
+        if (request->packSources.empty()) return FileCache::hashFile(request->filename, hash);
+        hash = FileCache::HASH_SEED;
+        for (size_t i = 0; i < request->packSources.size(); i++) {
+            FileCache::Hash fileHash = 0;
+            if (!request->packSources[i].empty() && !FileCache::hashFile(request->packSources[i], fileHash))
+                fileHash = 0;
+            hash = FileCache::hashBytes(&fileHash, sizeof(fileHash), hash);
+        }
+        return true;
+    }
+
+    // 决定解码和上传方式的参数，和TEXTURE_VARIANT_*对应。
+    static unsigned int variantOf(const AsyncRequest *request) {
+        if (!request->cookFilename.empty()) return TEXTURE_VARIANT_COOKED + request->usage;
+        if (request->hdr) return TEXTURE_VARIANT_HDR;
+        return request->packSources.empty() ? TEXTURE_VARIANT_LDR : TEXTURE_VARIANT_PACKED;
+    }
+
+    // 工作线程：计算共享键。读文件比解码快得多，但仍不放在GL线程上。
+    static void hashRequest(AsyncRequest *request) {
+        request->imageKey = 0;
+        if (hashSources(request, request->sourceHash)) {
+            request->imageKey = Texture::contentKey(request->sourceHash, variantOf(request));
+        }
+        request->stage.store(ASYNC_HASHED, std::memory_order_release);
+    }
+
+    // 工作线程：映射源文件对应的压缩缓存，缓存缺失或过期时解码源文件并重新烘焙。
+    static bool cookRequest(AsyncRequest *request) {
+        if (request->imageKey == 0) return false;  // 源文件读取失败，sourceHash无效。
+        FileCache::Hash sourceHash = request->sourceHash;
+        TextureCook::CookedImage *cooked = new TextureCook::CookedImage;
+        if (!TextureCook::loadCooked(request->cookFilename, sourceHash, request->usage, *cooked)) {
+            int width, height, channels;
+            bool ok;
+            if (request->packSources.empty()) {
+                unsigned char *data = stbi_load(request->filename.c_str(), &width, &height, &channels, 0);
+                ok = data && TextureCook::cook(data, width, height, channels, request->usage, *cooked);
+                if (data) stbi_image_free(data);
+            } else {
+                std::vector<unsigned char> packed;
+                ok = packRequest(request, packed, width, height) &&
+                     TextureCook::cook(packed.data(), width, height, 3, request->usage, *cooked);
+            }
+            if (!ok) {
+                delete cooked;
+                return false;
+            }
+            if (!TextureCook::saveCooked(request->cookFilename, sourceHash, request->usage, *cooked))
+                std::cout << "Failed to write texture cache " << request->cookFilename << std::endl;
+        }
+        request->cooked = cooked;
+        request->width = cooked->width;
+        request->height = cooked->height;
+        request->channels = request->usage == TextureCook::USAGE_COLOR || request->usage == TextureCook::USAGE_ORM ? 3 :
+                            request->usage == TextureCook::USAGE_NORMAL ? 2 : 1;
+        request->size = cooked->size();
+        return true;
+    }
+
+    // 工作线程：解码图像文件，和同步版本使用相同的加载函数与格式。
+    static void decodeRequest(AsyncRequest *request) {
+        request->pixels = nullptr;
+        if (!request->cookFilename.empty()) {
+            request->stage.store(cookRequest(request) ? ASYNC_DECODED : ASYNC_FAILED, std::memory_order_release);
+            return;
+        }
+        if (!request->packSources.empty()) {
+            bool ok = packRequest(request, request->packed, request->width, request->height);
+            request->channels = 3;
+            request->size = request->packed.size();
+            request->stage.store(ok ? ASYNC_DECODED : ASYNC_FAILED, std::memory_order_release);
+            return;
+        }
+        if (request->hdr && request->filename.substr(request->filename.find_last_of(".") + 1) == "exr") {
+            float *data = nullptr;
+            const char *err = nullptr;
+            if (LoadEXR(&data, &request->width, &request->height, request->filename.c_str(), &err) == TINYEXR_SUCCESS) {
+                request->pixels = data;
+                request->channels = 4;
+            } else if (err) {
+                FreeEXRErrorMessage(err);
+            }
+        } else if (request->hdr) {
+            request->pixels = stbi_loadf(request->filename.c_str(), &request->width, &request->height,
+                                         &request->channels, 0);
+        } else {
+            request->pixels = stbi_load(request->filename.c_str(), &request->width, &request->height,
+                                        &request->channels, 0);
+        }
+        if (request->pixels) {
+            size_t componentSize = request->hdr ? sizeof(float) : sizeof(unsigned char);
+            request->size = (size_t) request->width * request->height * request->channels * componentSize;
+        }
+        request->stage.store(request->pixels ? ASYNC_DECODED : ASYNC_FAILED, std::memory_order_release);
+    }
+
+    static void freePixels(AsyncRequest *request) {
+        delete request->cooked;
+        request->cooked = nullptr;
+        std::vector<unsigned char>().swap(request->packed);
+        if (!request->pixels) return;
+        if (request->hdr && request->filename.substr(request->filename.find_last_of(".") + 1) == "exr")
+            free(request->pixels);  // tinyexr使用malloc分配。
+        else
+            stbi_image_free(request->pixels);
+        request->pixels = nullptr;
+    }
+
+    // 工作线程：把解码结果拷贝到映射的PBO，然后释放CPU端的图像。
+    static void copyRequest(AsyncRequest *request) {
+        const void *source = request->pixels;
+        if (request->cooked) source = request->cooked->data();
+        else if (!request->packed.empty()) source = request->packed.data();
+        memcpy(request->mapped, source, request->size);
+        freePixels(request);
+        request->stage.store(ASYNC_COPIED, std::memory_order_release);
+    }
+
+    // GL线程：为解码完成的请求创建并映射PBO。
+    static bool mapRequest(AsyncRequest *request) {
+        glGenBuffers(1, &request->pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, request->pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, request->size, nullptr, GL_STREAM_DRAW);
+        request->mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, request->size,
+                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return request->mapped != nullptr;
+    }
+
+    static void releaseRequest(AsyncRequest *request) {
+        if (request->pbo) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, request->pbo);
+            if (request->mapped) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &request->pbo);
+        }
+        freePixels(request);
+        delete request;
+    }
+
+    // GL线程：从PBO逐级上传烘焙好的压缩mip链。
+    static void uploadCompressed(const TextureCook::CookedImage &cooked, GLuint &tex) {
+        glGenTextures(1, &tex);
+        GLState::bindTexture(GL_TEXTURE_2D, tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) cooked.mips.size() - 1);
+        for (size_t level = 0; level < cooked.mips.size(); level++) {
+            const TextureCook::CookedMip &mip = cooked.mips[level];
+            glCompressedTexImage2D(GL_TEXTURE_2D, (GLint) level, cooked.format, mip.width, mip.height, 0, mip.size,
+                                   (const void *) (size_t) mip.offset);  // 数据来自PBO。
+        }
+        GLState::bindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // GL线程：从PBO上传纹理，成功后替换占位纹理。
+    static bool uploadRequest(AsyncRequest *request, GLuint &tex) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, request->pbo);
+        bool ok = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;  // 映射期间显存被破坏时返回false。
+        request->mapped = nullptr;
+        if (ok && request->cooked) {
+            uploadCompressed(*request->cooked, tex);
+        } else if (ok) {
+            GLenum format = GL_RGBA;
+            GLenum internalFormat = request->hdr ? GL_RGBA32F : GL_RGBA;
+            if (request->channels == 1) {
+                format = GL_RED;
+                internalFormat = request->hdr ? GL_R32F : GL_RED;
+            }
+            if (request->channels == 2) {
+                format = GL_RG;
+                internalFormat = request->hdr ? GL_RG32F : GL_RG;
+            }
+            if (request->channels == 3) {
+                format = GL_RGB;
+                internalFormat = request->hdr ? GL_RGB32F : GL_RGB;
+            }
+            GLenum wrap = request->hdr ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+
+            glGenTextures(1, &tex);
+            GLState::bindTexture(GL_TEXTURE_2D, tex);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // 三通道图像的行不一定按4字节对齐。
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, request->width, request->height, 0, format,
+                         request->hdr ? GL_FLOAT : GL_UNSIGNED_BYTE, (const void *) 0);  // 数据来自PBO，偏移0。
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            if (!request->hdr) glGenerateMipmap(GL_TEXTURE_2D);
+            GLState::bindTexture(GL_TEXTURE_2D, 0);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &request->pbo);
+        request->pbo = 0;
+        return ok;
+    }
+
+    Texture &Texture::loadTextureAsync(std::string _name, std::string _filename, TextureCook::Usage _usage) {
+        if (_filename.empty()) {  // 如果文件名为空，尝试添加扩展名。
+            _filename = testAllSuffix(_name);
+            if (_filename.empty()) return error;
+        }
+        return beginAsyncLoad(_name, _filename, false, _usage);
+    }
+
+    Texture &Texture::loadHDRTextureAsync(std::string _name, std::string _filename) {
+        return beginAsyncLoad(_name, _filename, true, TextureCook::USAGE_METALLIC);  // 只用于黑色占位，HDR不压缩。
+    }
+
+    Texture &Texture::loadPackedTextureAsync(std::string _name, std::string _occlusionFile,
+                                             std::string _roughnessFile, std::string _metallicFile) {
+        std::vector<std::string> sources;
+        sources.push_back(_occlusionFile);
+        sources.push_back(_roughnessFile);
+        sources.push_back(_metallicFile);
+        bool found = false;
+        for (size_t i = 0; i < sources.size(); i++) {
+            FILE *fi = fopen(sources[i].c_str(), "r");
+            if (fi == NULL) {
+                std::cout << "Missing " << sources[i] << " for " << _name << ", using the default value" << std::endl;
+                sources[i].clear();
+                continue;
+            }
+            fclose(fi);
+            found = true;
+        }
+        if (!found) return error;
+        // filename记录三个源，用于判断重复加载；缓存文件名按纹理名称生成。
+        return beginAsyncLoad(_name, sources[0] + "|" + sources[1] + "|" + sources[2], false, TextureCook::USAGE_ORM,
+                              sources);
+    }
+
+    Texture &Texture::beginAsyncLoad(const std::string &_name, const std::string &_filename, bool _hdr,
+                                     TextureCook::Usage _usage, const std::vector<std::string> &_packSources) {
+        std::cout << "Attempting to load texture asynchronously from: " << _filename << std::endl;
+        if (_packSources.empty()) {
+            FILE *fi = fopen(_filename.c_str(), "r");  // 文件不存在时和同步版本一样立即返回错误纹理。
+            if (fi == NULL) return error;
+            fclose(fi);
+        }
+
+        std::pair<Name2Texture::iterator, bool> insertion =
+                allTexture.insert(Name2Texture::value_type(_name, new Texture()));
+        Texture &target = *(insertion.first->second);
+        if (!insertion.second) {
+            if (target.filename == _filename && target.available) {  // 已加载或正在加载同一个文件。
+                return target;
+            } else {
+                target.clear();
+            }
+        }
+        target.name = _name;
+        target.filename = _filename;
+
+        // 1x1占位纹理，第一帧就能正常绑定。
+        glGenTextures(1, &target.tex);
+        GLState::bindTexture(GL_TEXTURE_2D, target.tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        unsigned int placeholder = placeholderOf(_usage);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV, &placeholder);
+        GLState::bindTexture(GL_TEXTURE_2D, 0);
+        target.width = 1;
+        target.height = 1;
+        target.channels = 4;
+        target.available = true;
+        target.loaded = false;
+
+        AsyncRequest *request = new AsyncRequest;
+        request->target = &target;
+        request->name = _name;
+        request->filename = _filename;
+        request->hdr = _hdr;
+        request->usage = _usage;
+        request->packSources = _packSources;
+        // HDR没有合适的块压缩格式（BC6H需要GL 4.2），驱动不支持S3TC时颜色贴图也走未压缩路径。
+        if (!_hdr && !cacheDirectory.empty() && TextureCook::isSupported(_usage))
+            request->cookFilename = FileCache::cacheFilename(cacheDirectory,
+                                                             _packSources.empty() ? _filename : _name + TEXTURE_ORM_SUFFIX,
+                                                             TEXTURE_COOK_SUFFIX);
+        request->stage.store(ASYNC_HASHING);
+        request->sourceHash = 0;
+        request->imageKey = 0;
+        request->primary = false;
+        request->joined = false;
+        request->width = request->height = request->channels = 0;
+        request->pixels = nullptr;
+        request->cooked = nullptr;
+        request->size = 0;
+        request->pbo = 0;
+        request->mapped = nullptr;
+        request->startTime = asyncClock();
+        target.pending = request;
+        asyncRequests.push_back(request);
+
+        // stb_image的翻转开关是全局的，在提交任务前由GL线程设置，工作线程只读取。
+        stbi_set_flip_vertically_on_load(true);
+        JobSystem::submitBackground([request] { hashRequest(request); }, asyncCounter);
+        return target;
+    }
+
+    void Texture::cancelAsync() {
+        if (pending) pending->target = nullptr;
+        pending = nullptr;
+    }
+
+    // GL线程：负责上传的请求被取消后，如果还有其他请求在等同一图像，仍要把它上传完。
+    static bool awaited(const AsyncRequest *request) {
+        if (!request->primary) return false;
+        Texture::Hash2Image::const_iterator found = Texture::allImage.find(request->imageKey);
+        return found != Texture::allImage.end() && found->second.waiting > 1;
+    }
+
+    // GL线程：请求结束时退出共享图像的等待。负责上传的请求没能完成时删除未就绪的条目，
+    // 等待它的请求一并失败；已就绪但不再被引用的图像在这里释放。
+    static void leaveImage(AsyncRequest *request) {
+        if (!request->joined) return;
+        request->joined = false;
+        Texture::Hash2Image::iterator found = Texture::allImage.find(request->imageKey);
+        if (found == Texture::allImage.end()) return;
+        SharedImage &image = found->second;
+        image.waiting--;
+        if (!image.ready) {
+            if (!request->primary) return;
+            for (size_t i = 0; i < asyncRequests.size(); i++) {
+                AsyncRequest *alias = asyncRequests[i];
+                if (alias == request || !alias->joined || alias->imageKey != request->imageKey) continue;
+                alias->joined = false;
+                alias->stage.store(ASYNC_FAILED, std::memory_order_relaxed);  // 只在GL线程上等待，可以直接改。
+            }
+            Texture::allImage.erase(found);
+        } else if (image.refs <= 0 && image.waiting == 0) {
+            GLState::deleteTexture(image.tex);
+            Texture::allImage.erase(found);
+        }
+    }
+
+    size_t Texture::pumpUploads() {
+        int staging = 0;
+        for (size_t i = 0; i < asyncRequests.size(); i++) {
+            int stage = asyncRequests[i]->stage.load(std::memory_order_acquire);
+            if (stage == ASYNC_COPYING || stage == ASYNC_COPIED) staging++;
+        }
+
+        int uploads = 0;
+        for (size_t i = 0; i < asyncRequests.size();) {
+            AsyncRequest *request = asyncRequests[i];
+            Texture *target = request->target;
+            int stage = request->stage.load(std::memory_order_acquire);
+            bool done = false;
+
+            if (target == nullptr && !awaited(request) && stage != ASYNC_HASHING && stage != ASYNC_DECODING &&
+                stage != ASYNC_COPYING) {
+                done = true;  // 已取消，等工作线程不再访问后释放。
+            } else if (stage == ASYNC_FAILED) {
+                std::cout << "Failed to load image data for " << request->name << std::endl;
+                if (target) {
+                    target->available = false;  // bind()返回false，调用方回退到默认通道，和同步版本一致。
+                    target->pending = nullptr;
+                }
+                done = true;
+            } else if (stage == ASYNC_HASHED) {
+                Hash2Image::iterator found = request->imageKey ? allImage.find(request->imageKey) : allImage.end();
+                request->joined = request->imageKey != 0;
+                if (found != allImage.end()) {  // 同一内容已加载或正在加载，不再解码。
+                    found->second.waiting++;
+                    request->stage.store(ASYNC_ALIASED, std::memory_order_relaxed);
+                } else {
+                    if (request->joined) {
+                        SharedImage image = {0, 0, 1, false, 0, 0, 0};
+                        allImage[request->imageKey] = image;
+                        request->primary = true;
+                    }
+                    request->stage.store(ASYNC_DECODING, std::memory_order_relaxed);
+                    JobSystem::submitBackground([request] { decodeRequest(request); }, asyncCounter);
+                }
+            } else if (stage == ASYNC_ALIASED) {
+                Hash2Image::iterator found = allImage.find(request->imageKey);
+                if (found != allImage.end() && found->second.ready) {
+                    target->acquireImage(request->imageKey);  // 删除占位纹理，引用共享图像。
+                    target->pending = nullptr;
+                    std::cout << "Texture " << request->name << " shares an identical image, size "
+                              << target->width << "x" << target->height << std::endl;
+                    done = true;
+                }
+            } else if (stage == ASYNC_DECODED && staging < TEXTURE_ASYNC_MAX_STAGING) {
+                if (mapRequest(request)) {
+                    request->stage.store(ASYNC_COPYING, std::memory_order_relaxed);
+                    staging++;
+                    JobSystem::submitBackground([request] { copyRequest(request); }, asyncCounter);
+                } else {
+                    std::cout << "Failed to map pixel buffer for " << request->name << std::endl;
+                    if (target) {
+                        target->available = false;
+                        target->pending = nullptr;
+                    }
+                    done = true;
+                }
+            } else if (stage == ASYNC_COPIED && uploads < TEXTURE_ASYNC_UPLOADS_PER_PUMP) {
+                GLuint tex = 0;
+                if (uploadRequest(request, tex)) {
+                    if (request->primary) {  // 登记共享图像，等待它的请求在之后的pumpUploads()中引用。
+                        SharedImage &image = allImage[request->imageKey];
+                        image.tex = tex;
+                        image.ready = true;
+                        image.width = request->width;
+                        image.height = request->height;
+                        image.channels = request->channels;
+                        if (target) target->acquireImage(request->imageKey);  // 同时删除占位纹理。
+                    } else if (target) {
+                        target->releaseImage();  // 删除占位纹理。
+                        target->tex = tex;
+                        target->width = request->width;
+                        target->height = request->height;
+                        target->channels = request->channels;
+                        target->loaded = true;
+                    }
+                    if (target)
+                        std::cout << "Loaded texture " << request->name << " with " << request->channels
+                                  << " channels, size " << request->width << "x" << request->height
+                                  << (request->cooked ? " (block compressed)" : "") << " in "
+                                  << (asyncClock() - request->startTime) * 1000.0 << " ms" << std::endl;
+                } else {
+                    std::cout << "Failed to upload pixel buffer for " << request->name << std::endl;
+                    if (target) target->available = false;
+                }
+                if (target) target->pending = nullptr;
+                staging--;
+                uploads++;
+                done = true;
+            }
+
+            if (done) {
+                leaveImage(request);
+                releaseRequest(request);
+                asyncRequests.erase(asyncRequests.begin() + i);
+            } else {
+                i++;
+            }
+        }
+        return asyncRequests.size();
+    }
+
+    void Texture::finishAsyncLoads() {
+        while (pumpUploads() > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // ===== 纹理数组材质组 =====
+    // 一张图像的存储格式；levelSize是压缩格式每个mip层的字节数。
+    struct ArrayFormat {
+        GLenum internalFormat;
+        int width;
+        int height;
+        int levels;
+        bool compressed;
+        std::vector<GLint> levelSize;
+
+        ArrayFormat() : internalFormat(0), width(0), height(0), levels(0), compressed(false) {}
+
+        bool defined() const { return levels > 0; }
+
+        bool operator==(const ArrayFormat &other) const {
+            return internalFormat == other.internalFormat && width == other.width && height == other.height &&
+                   levels == other.levels && compressed == other.compressed;
+        }
+    };
+
+    // 读取已上传纹理的格式，纹理不可用或仍是占位纹理时返回false。
+    static bool describeTexture(GLuint tex, ArrayFormat &format) {
+        GLState::bindTexture(GL_TEXTURE_2D, tex);
+        GLint value = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &value);
+        format.internalFormat = (GLenum) value;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &value);
+        format.compressed = value != 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &format.width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &format.height);
+        GLint maxLevel = 0;
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+        format.levels = 0;
+        format.levelSize.clear();
+        for (int level = 0; level <= maxLevel && level < 16; level++) {
+            GLint width = 0;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+            if (width <= 0) break;
+            // 没有mip链的纹理（HDR、未生成mipmap的同步加载）只有第0层。
+            if (level > 0 && width != std::max(1, format.width >> level)) break;
+            GLint size = 0;
+            if (format.compressed)
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+            format.levelSize.push_back(size);
+            format.levels++;
+        }
+        return format.width > 0 && format.height > 0 && format.levels > 0;
+    }
+
+    // 用常量颜色填满数组的一层。压缩格式先把4x4的常量块按对应用途压缩一次，再复制到整层。
+    static void fillLayer(const ArrayFormat &format, int layer, unsigned int color) {
+        if (!format.compressed) {
+            std::vector<unsigned int> pixels((size_t) format.width * format.height, color);
+            for (int level = 0; level < format.levels; level++)
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, std::max(1, format.width >> level),
+                                std::max(1, format.height >> level), 1, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                                pixels.data());
+            return;
+        }
+        const TextureCook::Usage usages[] = {TextureCook::USAGE_COLOR, TextureCook::USAGE_NORMAL,
+                                             TextureCook::USAGE_OCCLUSION};
+        TextureCook::CookedImage block;
+        unsigned char texel[4] = {(unsigned char) (color & 0xff), (unsigned char) ((color >> 8) & 0xff),
+                                  (unsigned char) ((color >> 16) & 0xff), (unsigned char) (color >> 24)};
+        unsigned char pixels[4 * 4 * 4];
+        for (int i = 0; i < 16; i++) memcpy(pixels + i * 4, texel, 4);
+        bool cooked = false;
+        for (size_t i = 0; i < sizeof(usages) / sizeof(usages[0]) && !cooked; i++)
+            cooked = TextureCook::formatOf(usages[i]) == format.internalFormat &&
+                     TextureCook::cook(pixels, 4, 4, 4, usages[i], block);
+        if (!cooked || block.mips.empty()) {
+            std::cout << "Cannot fill a texture array layer of format 0x" << std::hex << format.internalFormat
+                      << std::dec << std::endl;
+            return;
+        }
+        size_t blockSize = block.mips[0].size;
+        std::vector<unsigned char> data;
+        for (int level = 0; level < format.levels; level++) {
+            data.resize(format.levelSize[level]);
+            for (size_t offset = 0; offset + blockSize <= data.size(); offset += blockSize)
+                memcpy(data.data() + offset, block.data() + block.mips[0].offset, blockSize);
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, std::max(1, format.width >> level),
+                                      std::max(1, format.height >> level), 1, format.internalFormat,
+                                      format.levelSize[level], data.data());
+        }
+    }
+
+    // 把纹理的各个mip层复制到数组的一层：经PBO在GPU上中转，不回读到内存。
+    static void copyLayer(GLuint source, GLuint array, const ArrayFormat &format, int layer, GLuint pbo) {
+        for (int level = 0; level < format.levels; level++) {
+            int width = std::max(1, format.width >> level), height = std::max(1, format.height >> level);
+            // 未压缩格式统一按RGBA浮点中转，8位和浮点纹理都能无损往返。
+            GLsizeiptr size = format.compressed ? format.levelSize[level] : (GLsizeiptr) width * height * 16;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_COPY);
+            GLState::bindTexture(GL_TEXTURE_2D, source);
+            if (format.compressed) glGetCompressedTexImage(GL_TEXTURE_2D, level, (void *) 0);
+            else glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_FLOAT, (void *) 0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            GLState::bindTexture(GL_TEXTURE_2D_ARRAY, array);
+            if (format.compressed)
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1,
+                                          format.internalFormat, format.levelSize[level], (const void *) 0);
+            else
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, GL_RGBA, GL_FLOAT,
+                                (const void *) 0);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+    }
+
+    TextureArraySet::TextureArraySet(const std::vector<unsigned int> &_placeholders)
+            : placeholders(_placeholders), built(false), final(false), loadedNum(0) {}
+
+    TextureArraySet::~TextureArraySet() { destroy(); }
+
+    size_t TextureArraySet::addSet(const std::vector<const Texture *> &_maps) {
+        std::vector<const Texture *> maps(_maps);
+        maps.resize(placeholders.size(), &Texture::error);
+        sets.push_back(maps);
+        built = final = false;  // 下次update()重新组装。
+        return sets.size() - 1;
+    }
+
+    void TextureArraySet::destroy() {
+        for (size_t group = 0; group < groupArrays.size(); group++)
+            for (size_t map = 0; map < groupArrays[group].size(); map++)
+                GLState::deleteTexture(groupArrays[group][map]);
+        groupArrays.clear();
+        setGroup.clear();
+        setLayer.clear();
+    }
+
+    bool TextureArraySet::update() {
+        if (final) return true;
+        bool settled = true;
+        size_t loaded = 0;
+        for (size_t set = 0; set < sets.size(); set++) {
+            for (size_t map = 0; map < sets[set].size(); map++) {
+                if (sets[set][map]->pending) settled = false;
+                if (sets[set][map]->loaded) loaded++;
+            }
+        }
+        // 每有贴图上传完成就重新组装，流式加载期间已完成的贴图也能先显示出来。
+        if (!built || settled || loaded != loadedNum) {
+            build();
+            built = true;
+            final = settled;
+            loadedNum = loaded;
+        }
+        return final;
+    }
+
+    void TextureArraySet::build() {
+        destroy();
+
+        // 按格式分组：贴图缺失的位置不参与比较，其余贴图格式都相同的材质组放进同一套数组。
+        std::vector<std::vector<ArrayFormat> > formats(sets.size(), std::vector<ArrayFormat>(placeholders.size()));
+        std::vector<std::vector<ArrayFormat> > groupFormats;
+        std::vector<std::vector<size_t> > groupSets;
+        for (size_t set = 0; set < sets.size(); set++) {
+            for (size_t map = 0; map < placeholders.size(); map++) {
+                const Texture *texture = sets[set][map];
+                if (!texture->available || !texture->loaded || texture->tex == 0 ||
+                    !describeTexture(texture->tex, formats[set][map]))
+                    formats[set][map] = ArrayFormat();
+            }
+            size_t group = 0;
+            for (; group < groupFormats.size(); group++) {
+                bool compatible = true;
+                for (size_t map = 0; map < placeholders.size() && compatible; map++)
+                    compatible = !formats[set][map].defined() || !groupFormats[group][map].defined() ||
+                                 formats[set][map] == groupFormats[group][map];
+                if (compatible) break;
+            }
+            if (group == groupFormats.size()) {
+                groupFormats.push_back(std::vector<ArrayFormat>(placeholders.size()));
+                groupSets.push_back(std::vector<size_t>());
+            }
+            for (size_t map = 0; map < placeholders.size(); map++)
+                if (!groupFormats[group][map].defined()) groupFormats[group][map] = formats[set][map];
+            setGroup.push_back(group);
+            setLayer.push_back((int) groupSets[group].size());
+            groupSets[group].push_back(set);
+        }
+
+        GLuint pbo = 0;
+        glGenBuffers(1, &pbo);
+        groupArrays.resize(groupFormats.size());
+        for (size_t group = 0; group < groupFormats.size(); group++) {
+            GLsizei layers = (GLsizei) groupSets[group].size();
+            for (size_t map = 0; map < placeholders.size(); map++) {
+                ArrayFormat format = groupFormats[group][map];
+                if (!format.defined()) {  // 这套数组里没有一张该贴图，只放占位颜色。
+                    format.internalFormat = GL_RGBA8;
+                    format.width = format.height = format.levels = 1;
+                }
+
+                GLuint array = 0;
+                glGenTextures(1, &array);
+                GLState::bindTexture(GL_TEXTURE_2D_ARRAY, array);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                                format.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, format.levels - 1);
+                for (int level = 0; level < format.levels; level++) {
+                    int width = std::max(1, format.width >> level), height = std::max(1, format.height >> level);
+                    if (format.compressed)
+                        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, format.internalFormat, width, height, layers,
+                                               0, format.levelSize[level] * layers, nullptr);
+                    else
+                        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, format.internalFormat, width, height, layers, 0,
+                                     GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+                }
+
+                for (GLsizei layer = 0; layer < layers; layer++) {
+                    size_t set = groupSets[group][layer];
+                    if (formats[set][map].defined()) {
+                        copyLayer(sets[set][map]->tex, array, format, layer, pbo);
+                    } else {
+                        GLState::bindTexture(GL_TEXTURE_2D_ARRAY, array);
+                        fillLayer(format, layer, placeholders[map]);
+                    }
+                }
+                groupArrays[group].push_back(array);
+            }
+        }
+        glDeleteBuffers(1, &pbo);
+    }
+
+    bool TextureArraySet::bind(size_t _set, GLuint _firstUnit) const {
+        if (_set >= setGroup.size()) return false;
+        const std::vector<GLuint> &arrays = groupArrays[setGroup[_set]];
+        for (size_t map = 0; map < arrays.size(); map++)
+            GLState::bindTexture(_firstUnit + (GLuint) map, GL_TEXTURE_2D_ARRAY, arrays[map]);
+        return true;
+    }
+}
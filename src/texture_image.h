@@ -17,6 +17,16 @@
 // 4. 在着色器中使用：
 //    uniform sampler2D u_diffuse;  // 在着色器中声明
 //    vec4 color = texture(u_diffuse, texCoord);  // 采样纹理
+// 5. 异步加载（不阻塞启动）：
+//    TextureImage::Texture &tex = TextureImage::Texture::loadTextureAsync("my_texture", "data/my_texture.png");
+//    立即返回1x1占位纹理，解码在线程池中进行；每帧调用 TextureImage::Texture::pumpUploads()
+//    在GL线程上通过PBO上传已解码的图像，完成后自动替换占位纹理。
+//    设置了 Texture::cacheDirectory 时，按用途（TextureCook::Usage）压缩成BC1/BC4/BC5并烘焙完整mip链，
+//    写入缓存；之后启动直接映射缓存上传，不再解码JPEG，也不再调用glGenerateMipmap。
+// 6. 内容相同的文件（即使名称或路径不同）只解码、上传一次：注册表按文件内容和解码参数计算指纹，
+//    多个纹理名共享同一个OpenGL纹理对象并引用计数，最后一个引用释放时才删除。
+// 7. 纹理数组材质组：TextureArraySet把尺寸和格式相同的多组材质装进GL_TEXTURE_2D_ARRAY，
+//    着色器中声明 uniform sampler2DArray，按层号选择材质，切换材质不需要重新绑定纹理。
 
 // ===== 文件头和预处理 =====
 // #pragma once 确保头文件只被包含一次，避免重复定义。
@@ -34,17 +44,57 @@
 
 // OpenGL环境头文件，提供GLFW、GLEW等初始化。
 #include "gl_env.h"
+#include "gl_state.h"  // 纹理绑定经过状态缓存，过滤重复调用。
 
 // STB图像库，用于加载图像文件。
 #include <stb_image.h>
 #include <tinyexr.h>
 
+#include "texture_cook.h"  // 块压缩纹理烘焙与缓存。
+
+// ===== 异步加载的占位颜色 =====
+// 按GL_UNSIGNED_INT_8_8_8_8_REV解释，即0xAABBGGRR。
+#define TEXTURE_PLACEHOLDER_GREY 0xff808080u
+#define TEXTURE_PLACEHOLDER_WHITE 0xffffffffu
+#define TEXTURE_PLACEHOLDER_BLACK 0xff000000u
+#define TEXTURE_PLACEHOLDER_NORMAL 0xffff8080u  // 切线空间的平坦法线(0.5, 0.5, 1.0)。
+#define TEXTURE_PLACEHOLDER_ORM 0xff0080ffu  // AO=1，粗糙度=0.5，金属度=0。
+#define TEXTURE_ORM_SUFFIX ".orm"  // 打包纹理的缓存键后缀。
+#define TEXTURE_ASYNC_MAX_STAGING 2  // 同时映射的PBO数量上限，限制暂存内存。
+#define TEXTURE_ASYNC_UPLOADS_PER_PUMP 1  // 每次pumpUploads()最多完成的上传数，避免单帧卡顿。
+
+// ===== 共享图像的解码参数 =====
+// 同一份文件内容按不同方式解码得到不同的GL纹理，这些值和内容哈希一起组成共享键。
+#define TEXTURE_VARIANT_LDR 0     // 8位未压缩，带glGenerateMipmap。
+#define TEXTURE_VARIANT_HDR 1     // 32位浮点，无mip。
+#define TEXTURE_VARIANT_PACKED 2  // 未压缩的ORM打包结果。
+#define TEXTURE_VARIANT_COOKED 3  // 块压缩，实际值再加上TextureCook::Usage。
+
 namespace TextureImage {  // 定义纹理图像处理的命名空间。
+    struct AsyncRequest;  // 异步加载请求，定义在texture_image.cpp中。
+    class TextureArraySet;
+
+    // 多个纹理名共享的一份GL纹理。
+    struct SharedImage {
+        GLuint tex;    // 上传完成前为0。
+        int refs;      // 正在使用它的Texture数。
+        int waiting;   // 等待它上传完成的异步请求数（包括负责上传的那个）。
+        bool ready;    // 是否已上传完成。
+        int width;
+        int height;
+        int channels;
+    };
+
     class Texture {  // 纹理类，负责加载和管理单个纹理。
+        friend class TextureArraySet;
+
     public:
         typedef std::map<std::string, Texture *> Name2Texture;  // 类型定义：字符串到纹理指针的映射。
+        typedef std::map<FileCache::Hash, SharedImage> Hash2Image;  // 类型定义：共享键到共享图像的映射。
         static Name2Texture allTexture;  // 静态成员：存储所有加载的纹理。
+        static Hash2Image allImage;  // 静态成员：按内容去重后的图像，只在GL线程上访问。
         static Texture error;  // 静态成员：错误纹理，当加载失败时返回。
+        static std::string cacheDirectory;  // 静态成员：压缩纹理缓存目录，为空时不压缩、不缓存。
 
     private:
         bool available;      // 纹理是否可用。
@@ -54,6 +104,10 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
         int height;          // 图像高度。
         int channels;        // 图像通道数。
         GLuint tex;          // OpenGL纹理对象ID。
+        bool loaded;         // 真实图像数据是否已上传（异步加载期间为false，此时tex是占位纹理）。
+        AsyncRequest *pending; // 进行中的异步加载请求，没有则为nullptr。
+        FileCache::Hash imageKey; // 共享图像的键，shared为true时有效。
+        bool shared;         // tex是否属于allImage中的共享图像（此时不能直接删除）。
 
         // ===== 私有构造函数，防止外部直接构造 =====
         // 禁止拷贝构造。
@@ -62,7 +116,8 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
 
         // 默认构造函数，初始化成员变量。
         Texture()
-                : available(false), name(), filename(), width(0), height(0), channels(0), tex(0) {}
+                : available(false), name(), filename(), width(0), height(0), channels(0), tex(0), loaded(false),
+                  pending(nullptr), imageKey(0), shared(false) {}
 
         // 虚析构函数，确保正确清理资源。
         virtual ~Texture() { clear(); }
@@ -77,10 +132,54 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
             width = 0;  // 重置宽度。
             height = 0;  // 重置高度。
             channels = 0;  // 重置通道数。
-            glDeleteTextures(1, &tex);  // 删除OpenGL纹理对象。
-            tex = 0;  // 重置纹理ID。
+            releaseImage();  // 删除OpenGL纹理对象，共享时只减少引用计数。
+            loaded = false;
+            cancelAsync();  // 解码任务仍会运行完，但结果会被丢弃。
         }
 
+        // 是否已经是真实图像（而不是占位纹理）。
+        bool isLoaded() const { return loaded; }
+
+        // ===== 异步加载（实现见texture_image.cpp）=====
+        // loadTextureAsync() 函数：立即返回带1x1占位纹理的对象，图像在线程池中解码（或从压缩缓存读取）。
+        // 参数：_usage - 纹理用途，决定占位颜色和压缩格式，例如法线贴图用TextureCook::USAGE_NORMAL。
+        // 返回：纹理引用，文件不存在时返回error。
+        static Texture &loadTextureAsync(std::string _name, std::string _filename,
+                                         TextureCook::Usage _usage = TextureCook::USAGE_COLOR);
+        // loadHDRTextureAsync() 函数：loadHDRTexture()的异步版本，占位为黑色。
+        static Texture &loadHDRTextureAsync(std::string _name, std::string _filename);
+        // loadPackedTextureAsync() 函数：把AO、粗糙度、金属度三张标量贴图打包成一张ORM纹理
+        // （R=AO，G=粗糙度，B=金属度），着色器只需采样一次。缺失的贴图用TEXTURE_PLACEHOLDER_ORM对应的常量填充。
+        // 返回：纹理引用，三张贴图都不存在时返回error。
+        static Texture &loadPackedTextureAsync(std::string _name, std::string _occlusionFile,
+                                               std::string _roughnessFile, std::string _metallicFile);
+        // pumpUploads() 函数：在GL线程上每帧调用，推进所有异步请求（映射PBO、上传、替换占位纹理）。
+        // 返回：尚未完成的请求数。
+        static size_t pumpUploads();
+        // finishAsyncLoads() 函数：阻塞直到所有异步请求完成。
+        static void finishAsyncLoads();
+
+    private:
+        static Texture &beginAsyncLoad(const std::string &_name, const std::string &_filename, bool _hdr,
+                                       TextureCook::Usage _usage,
+                                       const std::vector<std::string> &_packSources = std::vector<std::string>());
+        void cancelAsync();
+
+        // ===== 内容去重（实现见texture_image.cpp）=====
+        // acquireImage() 函数：如果_key对应的图像已上传完成，释放自己的纹理并改为引用它。
+        // 返回：是否成功共享。
+        bool acquireImage(FileCache::Hash _key);
+        // registerImage() 函数：把自己刚上传的纹理登记为_key对应的共享图像，供之后内容相同的纹理复用。
+        void registerImage(FileCache::Hash _key);
+        // releaseImage() 函数：释放tex，共享时减少引用计数，最后一个引用删除GL纹理。
+        void releaseImage();
+
+    public:
+        // contentKey() 函数：由文件内容哈希和解码参数（TEXTURE_VARIANT_*）得到共享键。
+        static FileCache::Hash contentKey(FileCache::Hash _contentHash, unsigned int _variant);
+        // uniqueImageNum() 函数：去重后实际占用显存的图像数。
+        static size_t uniqueImageNum() { return allImage.size(); }
+
         // testAllSuffix() 函数：尝试不同的文件扩展名，找到存在的文件。
         // 参数：no_suffix_name - 不带扩展名的文件名。
         // 返回：找到的文件名，如果没找到返回空字符串。
@@ -130,7 +229,7 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
                     allTexture.insert(Name2Texture::value_type(_name, new Texture()));  // 插入新纹理对象。
             Texture &target = *(insertion.first->second);  // 获取目标纹理引用。
             if (!insertion.second) {  // 如果纹理名称已存在。
-                if (target.filename == _filename && target.available) {  // 如果文件名相同且可用。
+                if (target.filename == _filename && target.available && target.pending == nullptr) {  // 如果文件名相同且已加载完成。
                     return target;  // 返回现有纹理。
                 } else {
                     target.clear();  // 否则清理现有纹理。
@@ -140,6 +239,15 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
             target.name = _name;  // 设置纹理名称。
             target.filename = _filename;  // 设置文件名。
 
+            // 内容和已加载的图像相同时直接共享，不再解码和上传。
+            FileCache::Hash key = 0;
+            if (FileCache::hashFile(_filename, key)) key = contentKey(key, TEXTURE_VARIANT_LDR);
+            if (key && target.acquireImage(key)) {
+                std::cout << "Texture " << _name << " shares an identical image, size " << target.width << "x"
+                          << target.height << std::endl;
+                return target;
+            }
+
             // 使用STB库加载图像数据。
             stbi_set_flip_vertically_on_load(true);  // 设置图像垂直翻转，因为OpenGL的Y轴方向不同。
             int channels;  // 图像通道数（1=灰度, 3=RGB, 4=RGBA）。
@@ -169,7 +277,7 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
 
             // 创建OpenGL纹理对象并设置参数。
             glGenTextures(1, &target.tex);  // 生成纹理对象。
-            glBindTexture(GL_TEXTURE_2D, target.tex);  // 绑定纹理。
+            GLState::bindTexture(GL_TEXTURE_2D, target.tex);  // 绑定纹理。
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);  // S轴重复。
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);  // T轴重复。
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);  // 放大过滤：线性。
@@ -177,7 +285,7 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
             glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, target.width, target.height,  // 上传纹理数据。
                          0, format, GL_UNSIGNED_BYTE, data);  // 内部格式和数据格式根据channels确定。
             glGenerateMipmap(GL_TEXTURE_2D);  // 生成多级渐远纹理。
-            glBindTexture(GL_TEXTURE_2D, 0);  // 解绑纹理。
+            GLState::bindTexture(GL_TEXTURE_2D, 0);  // 解绑纹理。
 
             stbi_image_free(data);  // 释放STB加载的图像数据。
 
@@ -190,6 +298,8 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
             }
 
             target.available = true;  // 标记纹理为可用。
+            target.loaded = true;
+            if (key) target.registerImage(key);  // 登记为共享图像。
             return target;  // 返回加载的纹理。
         }
 
@@ -197,7 +307,11 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
         // 参数：_name - 纹理名称。
         // 返回：是否成功卸载。
         static bool unloadTexture(std::string _name) {
-            return allTexture.erase(_name) != 0;  // 从映射中删除，返回是否成功。
+            Name2Texture::iterator find_result = allTexture.find(_name);  // 查找纹理。
+            if (find_result == allTexture.end()) return false;  // 如果没找到，返回false。
+            delete find_result->second;  // 析构时释放GL纹理或共享图像的引用。
+            allTexture.erase(find_result);  // 从映射中删除。
+            return true;
         }
 
         // getTexture() 函数：获取已加载的纹理。
@@ -214,8 +328,7 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
         // 返回：是否成功绑定。
         bool bind(GLenum textureChannel) const {
             if (!available) return false;  // 如果纹理不可用，返回false。
-            glActiveTexture(GL_TEXTURE0 + textureChannel);  // 激活纹理通道。
-            glBindTexture(GL_TEXTURE_2D, tex);  // 绑定纹理。
+            GLState::bindTexture(textureChannel, GL_TEXTURE_2D, tex);  // 绑定到纹理通道，已绑定时不再调用GL。
             return true;  // 返回true表示成功。
         }
 
@@ -241,7 +354,7 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
                     allTexture.insert(Name2Texture::value_type(_name, new Texture()));  // 插入新纹理对象。
             Texture &target = *(insertion.first->second);  // 获取目标纹理引用。
             if (!insertion.second) {  // 如果纹理名称已存在。
-                if (target.filename == _filename && target.available) {  // 如果文件名相同且可用。
+                if (target.filename == _filename && target.available && target.pending == nullptr) {  // 如果文件名相同且已加载完成。
                     return target;  // 返回现有纹理。
                 } else {
                     target.clear();  // 否则清理现有纹理。
@@ -251,6 +364,15 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
             target.name = _name;  // 设置纹理名称。
             target.filename = _filename;  // 设置文件名。
 
+            // 内容和已加载的图像相同时直接共享，不再解码和上传。
+            FileCache::Hash key = 0;
+            if (FileCache::hashFile(_filename, key)) key = contentKey(key, TEXTURE_VARIANT_HDR);
+            if (key && target.acquireImage(key)) {
+                std::cout << "HDR texture " << _name << " shares an identical image, size " << target.width << "x"
+                          << target.height << std::endl;
+                return target;
+            }
+
             // 检查文件扩展名，如果是.exr，使用TinyEXR加载，否则使用STB。
             if (_filename.substr(_filename.find_last_of(".") + 1) == "exr") {
                 // 使用TinyEXR加载EXR文件。
@@ -274,7 +396,7 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
 
                 // 创建OpenGL纹理对象并设置参数。
                 glGenTextures(1, &target.tex);  // 生成纹理对象。
-                glBindTexture(GL_TEXTURE_2D, target.tex);  // 绑定纹理。
+                GLState::bindTexture(GL_TEXTURE_2D, target.tex);  // 绑定纹理。
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);  // S轴边缘钳制。
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);  // T轴边缘钳制。
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);  // 放大过滤：线性。
@@ -282,7 +404,7 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
 
                 // 上传纹理数据到GPU。
                 glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, target.width, target.height, 0, GL_RGBA, GL_FLOAT, data);  // 上传数据。
-                glBindTexture(GL_TEXTURE_2D, 0);  // 解绑纹理。
+                GLState::bindTexture(GL_TEXTURE_2D, 0);  // 解绑纹理。
 
                 free(data);  // 释放TinyEXR加载的数据。
             } else {
@@ -299,7 +421,7 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
 
                 // 创建OpenGL纹理对象并设置参数。
                 glGenTextures(1, &target.tex);  // 生成纹理对象。
-                glBindTexture(GL_TEXTURE_2D, target.tex);  // 绑定纹理。
+                GLState::bindTexture(GL_TEXTURE_2D, target.tex);  // 绑定纹理。
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);  // S轴边缘钳制。
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);  // T轴边缘钳制。
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);  // 放大过滤：线性。
@@ -319,7 +441,7 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
 
                 glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, target.width, target.height,  // 上传纹理数据。
                              0, format, GL_FLOAT, data);  // 内部格式和数据格式根据channels确定。
-                glBindTexture(GL_TEXTURE_2D, 0);  // 解绑纹理。
+                GLState::bindTexture(GL_TEXTURE_2D, 0);  // 解绑纹理。
 
                 stbi_image_free(data);  // 释放STB加载的图像数据。
             }
@@ -333,7 +455,51 @@ namespace TextureImage {  // 定义纹理图像处理的命名空间。
             }
 
             target.available = true;  // 标记纹理为可用。
+            target.loaded = true;
+            if (key) target.registerImage(key);  // 登记为共享图像。
             return target;  // 返回加载的纹理。
         }
     };  // Texture类结束。
+
+    // ===== 纹理数组材质组 =====
+    // 把多组材质（每组若干种贴图，例如基础颜色、法线、ORM）装进GL_TEXTURE_2D_ARRAY：每种贴图一个数组，
+    // 尺寸、格式和mip层数都相同的材质组放在同一套数组的不同层，着色器用层号uniform选择材质。
+    // 同一套数组内切换材质或给实例使用不同材质都不需要重新绑定纹理；不兼容的材质组各自成为一套数组。
+    // 缺失或加载失败的贴图用该贴图的占位颜色填满对应的层。图像在GPU上经PBO复制，不回读到内存。
+    class TextureArraySet {
+    public:
+        // 参数：_placeholders - 每种贴图的占位颜色（TEXTURE_PLACEHOLDER_*），数量就是每组材质的贴图数。
+        explicit TextureArraySet(const std::vector<unsigned int> &_placeholders);
+        ~TextureArraySet();
+
+        // addSet() 函数：添加一组材质，_maps按贴图顺序排列，可以是Texture::error。
+        // 返回：材质组编号。
+        size_t addSet(const std::vector<const Texture *> &_maps);
+        // update() 函数：每帧调用。用已加载的图像组装（仍在异步加载的用占位颜色），每有贴图上传完成就重新组装，
+        // 所有贴图都加载完成或失败后组装最终版本；之后不再访问源纹理，可以卸载它们。
+        // 返回：是否已是最终版本。
+        bool update();
+        // bind() 函数：把材质组所在的各个数组依次绑定到从_firstUnit开始的纹理通道，已绑定时不调用GL。
+        bool bind(size_t _set, GLuint _firstUnit) const;
+        // layer() 函数：材质组在数组中的层号，各种贴图相同。
+        int layer(size_t _set) const { return _set < setLayer.size() ? setLayer[_set] : 0; }
+        // arrayNum() 函数：每种贴图的数组数，1表示所有材质组共用一套数组。
+        size_t arrayNum() const { return groupArrays.size(); }
+
+    private:
+        std::vector<unsigned int> placeholders;
+        std::vector<std::vector<const Texture *> > sets;
+        std::vector<size_t> setGroup;
+        std::vector<int> setLayer;
+        std::vector<std::vector<GLuint> > groupArrays;  // [数组套][贴图]
+        bool built;
+        bool final;
+        size_t loadedNum;  // 上次组装时已上传完成的贴图数。
+
+        void build();
+        void destroy();
+
+        TextureArraySet(const TextureArraySet &_copy);
+        TextureArraySet &operator=(const TextureArraySet &_copy);
+    };
 }  // TextureImage命名空间结束。